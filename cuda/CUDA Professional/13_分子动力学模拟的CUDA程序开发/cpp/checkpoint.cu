@@ -0,0 +1,262 @@
+#include "checkpoint.cuh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char checkpoint_magic[8] = {'L', 'J', 'M', 'D', 'C', 'K', 'P', 'T'};
+
+// per-atom real arrays in file order, followed by the box, id, NN and NL
+static const int NUM_REAL_ARRAYS = 15;
+
+static void real_arrays(Atom *atom, real **arrays)
+{
+    real *a[NUM_REAL_ARRAYS] =
+    {
+        atom->m, atom->x, atom->y, atom->z, atom->vx, atom->vy, atom->vz,
+        atom->fx, atom->fy, atom->fz, atom->pe, atom->ke, atom->x0, atom->y0, atom->z0
+    };
+    memcpy(arrays, a, sizeof(a));
+}
+
+static long long checkpoint_bytes(int N, long long num_pairs)
+{
+    return sizeof(Checkpoint_Header) + (NUM_REAL_ARRAYS * (long long) N + 6) * sizeof(real)
+        + (2 * (long long) N + num_pairs) * sizeof(int);
+}
+
+// the file image of the current state, malloc'ed
+static char *pack_checkpoint(long long step, unsigned int seed, int N, int MN, Atom *atom, long long *bytes)
+{
+    long long num_pairs = 0;
+    for (int n = 0; n < N; ++n) { num_pairs += atom->NN[n]; }
+    *bytes = checkpoint_bytes(N, num_pairs);
+    char *image = (char*) malloc(*bytes);
+
+    Checkpoint_Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, checkpoint_magic, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.real_size = sizeof(real);
+    header.N = N;
+    header.MN = MN;
+    header.step = step;
+    header.num_pairs = num_pairs;
+    header.bytes = *bytes;
+    header.seed = seed;
+    header.num_builds = atom->num_builds;
+    memcpy(image, &header, sizeof(header));
+
+    char *p = image + sizeof(header);
+    real *arrays[NUM_REAL_ARRAYS];
+    real_arrays(atom, arrays);
+    for (int a = 0; a < NUM_REAL_ARRAYS; ++a)
+    {
+        memcpy(p, arrays[a], N * sizeof(real));
+        p += N * sizeof(real);
+    }
+    memcpy(p, atom->box, 6 * sizeof(real));
+    p += 6 * sizeof(real);
+    memcpy(p, atom->id, N * sizeof(int));
+    p += N * sizeof(int);
+    memcpy(p, atom->NN, N * sizeof(int));
+    p += N * sizeof(int);
+    for (int n = 0; n < N; ++n)
+    {
+        memcpy(p, atom->NL + (long long) n * MN, atom->NN[n] * sizeof(int));
+        p += atom->NN[n] * sizeof(int);
+    }
+    return image;
+}
+
+// writes image to file.tmp, flushes it to disk and renames it over file
+static void write_image(const char *file, const char *image, long long bytes)
+{
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    FILE *fid = fopen(tmp, "wb");
+    if (fid == NULL)
+    {
+        printf("Error: cannot open %s for writing.\n", tmp);
+        return;
+    }
+    bool ok = fwrite(image, 1, bytes, fid) == (size_t) bytes && fflush(fid) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(fid)) == 0;
+#else
+    ok = ok && fsync(fileno(fid)) == 0;
+#endif
+    ok = fclose(fid) == 0 && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmp, file, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    ok = ok && rename(tmp, file) == 0;
+#endif
+    if (!ok)
+    {
+        printf("Error: writing checkpoint %s failed.\n", file);
+        remove(tmp);
+    }
+}
+
+void write_checkpoint(const char *file, long long step, unsigned int seed, int N, int MN, Atom *atom)
+{
+    wait_checkpoint();
+    long long bytes;
+    char *image = pack_checkpoint(step, seed, N, MN, atom, &bytes);
+    write_image(file, image, bytes);
+    free(image);
+}
+
+// the write in flight: its thread owns image until joined
+static std::thread writer;
+static char *pending_image = NULL;
+
+void write_checkpoint_async(const char *file, long long step, unsigned int seed, int N, int MN, Atom *atom)
+{
+    wait_checkpoint();
+    long long bytes;
+    pending_image = pack_checkpoint(step, seed, N, MN, atom, &bytes);
+    char *name = strdup(file);
+    const char *image = pending_image;
+    writer = std::thread([name, image, bytes]()
+    {
+        write_image(name, image, bytes);
+        free(name);
+    });
+}
+
+void wait_checkpoint()
+{
+    if (writer.joinable()) { writer.join(); }
+    free(pending_image);
+    pending_image = NULL;
+}
+
+// read-only view of a whole file
+struct Mapping
+{
+    const char *data;
+    long long bytes;
+#ifdef _WIN32
+    HANDLE file, map;
+#else
+    int fd;
+#endif
+};
+
+static bool map_file(const char *file, Mapping *mapping)
+{
+#ifdef _WIN32
+    mapping->file = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (mapping->file == INVALID_HANDLE_VALUE) { return false; }
+    LARGE_INTEGER size;
+    GetFileSizeEx(mapping->file, &size);
+    mapping->bytes = size.QuadPart;
+    mapping->map = CreateFileMappingA(mapping->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    mapping->data = mapping->map ? (const char*) MapViewOfFile(mapping->map, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (mapping->data == NULL)
+    {
+        if (mapping->map) { CloseHandle(mapping->map); }
+        CloseHandle(mapping->file);
+        return false;
+    }
+#else
+    mapping->fd = open(file, O_RDONLY);
+    if (mapping->fd < 0) { return false; }
+    struct stat st;
+    fstat(mapping->fd, &st);
+    mapping->bytes = st.st_size;
+    void *data = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, mapping->fd, 0) : MAP_FAILED;
+    if (data == MAP_FAILED)
+    {
+        close(mapping->fd);
+        return false;
+    }
+    mapping->data = (const char*) data;
+#endif
+    return true;
+}
+
+static void unmap_file(Mapping *mapping)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(mapping->data);
+    CloseHandle(mapping->map);
+    CloseHandle(mapping->file);
+#else
+    munmap((void*) mapping->data, mapping->bytes);
+    close(mapping->fd);
+#endif
+}
+
+bool read_checkpoint(const char *file, int N, int MN, Atom *atom, long long *step, unsigned int *seed)
+{
+    Mapping mapping;
+    if (!map_file(file, &mapping))
+    {
+        printf("Error: cannot open checkpoint %s.\n", file);
+        return false;
+    }
+    Checkpoint_Header header;
+    const char *error = NULL;
+    if (mapping.bytes < (long long) sizeof(header)) { error = "truncated"; }
+    else
+    {
+        memcpy(&header, mapping.data, sizeof(header));
+        if (memcmp(header.magic, checkpoint_magic, sizeof(header.magic)) != 0) { error = "not a checkpoint"; }
+        else if (header.version != CHECKPOINT_VERSION) { error = "of another version"; }
+        else if (header.real_size != (int) sizeof(real)) { error = "of another precision"; }
+        else if (header.N != N) { error = "of another number of atoms"; }
+        else if (header.bytes != mapping.bytes || header.bytes != checkpoint_bytes(N, header.num_pairs))
+        {
+            error = "truncated";
+        }
+    }
+    if (error != NULL)
+    {
+        printf("Error: checkpoint %s is %s.\n", file, error);
+        unmap_file(&mapping);
+        return false;
+    }
+
+    const char *p = mapping.data + sizeof(header);
+    real *arrays[NUM_REAL_ARRAYS];
+    real_arrays(atom, arrays);
+    for (int a = 0; a < NUM_REAL_ARRAYS; ++a)
+    {
+        memcpy(arrays[a], p, N * sizeof(real));
+        p += N * sizeof(real);
+    }
+    memcpy(atom->box, p, 6 * sizeof(real));
+    p += 6 * sizeof(real);
+    memcpy(atom->id, p, N * sizeof(int));
+    p += N * sizeof(int);
+    memcpy(atom->NN, p, N * sizeof(int));
+    p += N * sizeof(int);
+    for (int n = 0; n < N; ++n)
+    {
+        if (atom->NN[n] > MN)
+        {
+            printf("Error: checkpoint %s needs MN >= %d.\n", file, header.MN);
+            unmap_file(&mapping);
+            return false;
+        }
+        memcpy(atom->NL + (long long) n * MN, p, atom->NN[n] * sizeof(int));
+        p += atom->NN[n] * sizeof(int);
+    }
+    atom->num_builds = header.num_builds;
+    *step = header.step;
+    *seed = header.seed;
+    unmap_file(&mapping);
+    return true;
+}
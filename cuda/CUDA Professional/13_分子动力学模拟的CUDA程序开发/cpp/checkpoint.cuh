@@ -0,0 +1,37 @@
+#pragma once
+#include "common.cuh"
+
+// Binary checkpoint of the whole MD state: a header followed by the atom
+// arrays, the box and the neighbor list (rows compacted to NN[i] entries),
+// so that a restart continues exactly where the run stopped. A file is
+// written under file.tmp and renamed over file once complete, so a crash
+// mid-write leaves the previous checkpoint intact.
+
+#define CHECKPOINT_VERSION 1
+
+struct Checkpoint_Header
+{
+    char magic[8];          // "LJMDCKPT"
+    int version;            // CHECKPOINT_VERSION
+    int real_size;          // sizeof(real) of the writer
+    int N;
+    int MN;
+    long long step;         // production steps done
+    long long num_pairs;    // neighbor list entries, sum of NN
+    long long bytes;        // whole file, header included
+    unsigned int seed;      // srand seed the velocities were drawn with
+    int num_builds;
+};
+
+// writes the state after step production steps and returns when the file
+// is in place
+void write_checkpoint(const char *file, long long step, unsigned int seed, int N, int MN, Atom *atom);
+// copies the state and writes it from a background thread, first waiting
+// for the previous write; the run goes on while the file is written
+void write_checkpoint_async(const char *file, long long step, unsigned int seed, int N, int MN, Atom *atom);
+// waits for a pending write_checkpoint_async
+void wait_checkpoint();
+// maps file and copies it into atom, allocated for N atoms with MN
+// neighbors; false, with a message, if it is missing, of another version
+// or precision, or of another system size
+bool read_checkpoint(const char *file, int N, int MN, Atom *atom, long long *step, unsigned int *seed);
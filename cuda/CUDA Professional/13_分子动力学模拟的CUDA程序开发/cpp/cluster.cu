@@ -0,0 +1,543 @@
+#include "cluster.cuh"
+#include "mic.cuh"
+#include "potential.cuh"
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
+
+// SIMD width: AVX-512 puts two i atoms against the 8 lanes of a j cluster
+// in one vector, AVX2 one i atom; double precision runs the scalar loop
+#if defined(__AVX512F__) && !defined(USE_DP)
+    #define CLUSTER_AVX512
+    #define I_PER_VECTOR 2
+#elif defined(__AVX2__) && (defined(__FMA__) || defined(_MSC_VER)) && !defined(USE_DP)
+    #define CLUSTER_AVX2
+    #define I_PER_VECTOR 1
+#endif
+
+#if defined(CLUSTER_AVX512) || defined(CLUSTER_AVX2)
+#include <immintrin.h>
+#endif
+
+struct Clusters
+{
+    int N;
+    int build;                // atom->num_builds the pairs were made at
+    int num_clusters;
+    int *atoms;               // CLUSTER_SIZE atoms per cluster, -1 for padding
+    real *x, *y, *z;          // lane positions, NaN for padding
+    int *pair_start;          // j clusters of cluster c: pairs[pair_start[c] .. pair_start[c + 1]]
+    int *pairs;
+};
+
+static Clusters clusters;
+
+static void free_clusters()
+{
+    free(clusters.atoms);
+    free(clusters.x);
+    free(clusters.y);
+    free(clusters.z);
+    free(clusters.pair_start);
+    free(clusters.pairs);
+}
+
+static real wrap(real x, real box_length)
+{
+    return x - box_length * floor(x / box_length);
+}
+
+static int find_column(real x, real box_length, int num_columns)
+{
+    int c = (int) floor(x / box_length * num_columns);
+    return c >= num_columns ? num_columns - 1 : c;
+}
+
+struct Column_Entry
+{
+    real z;
+    int n;
+};
+
+static int compare_z(const void *a, const void *b)
+{
+    real za = ((const Column_Entry*) a)->z;
+    real zb = ((const Column_Entry*) b)->z;
+    return za < zb ? -1 : za > zb;
+}
+
+// clusters are runs of CLUSTER_SIZE atoms along z in columns of the x-y
+// plane, a column being as wide as a cluster is tall at the mean density;
+// both use the positions at the last neighbor list build
+static void build_clusters(int N, Atom *atom)
+{
+    free_clusters();
+    real *box = atom->box;
+    real width = cbrt(CLUSTER_SIZE * box[0] * box[1] * box[2] / N);
+    int ncx = (int) (box[0] / width), ncy = (int) (box[1] / width);
+    if (ncx < 1) { ncx = 1; }
+    if (ncy < 1) { ncy = 1; }
+    int num_columns = ncx * ncy;
+
+    // atoms sorted by column, then by z within each column
+    Column_Entry *entries = (Column_Entry*) malloc(N * sizeof(Column_Entry));
+    int *atom_column = (int*) malloc(N * sizeof(int));
+    int *column_start = (int*) calloc(num_columns + 1, sizeof(int));
+    int *column_fill = (int*) calloc(num_columns, sizeof(int));
+    for (int n = 0; n < N; ++n)
+    {
+        int cx = find_column(wrap(atom->x0[n], box[0]), box[0], ncx);
+        int cy = find_column(wrap(atom->y0[n], box[1]), box[1], ncy);
+        atom_column[n] = cx * ncy + cy;
+        column_start[atom_column[n] + 1]++;
+    }
+    for (int c = 0; c < num_columns; ++c)
+    {
+        column_start[c + 1] += column_start[c];
+    }
+    for (int n = 0; n < N; ++n)
+    {
+        Column_Entry *e = &entries[column_start[atom_column[n]] + column_fill[atom_column[n]]++];
+        e->z = wrap(atom->z0[n], box[2]);
+        e->n = n;
+    }
+
+    // a column holding k atoms makes ceil(k / CLUSTER_SIZE) clusters
+    int *column_clusters = (int*) calloc(num_columns + 1, sizeof(int));
+    for (int c = 0; c < num_columns; ++c)
+    {
+        int count = column_start[c + 1] - column_start[c];
+        qsort(entries + column_start[c], count, sizeof(Column_Entry), compare_z);
+        column_clusters[c + 1] = column_clusters[c] + (count + CLUSTER_SIZE - 1) / CLUSTER_SIZE;
+    }
+    int num_clusters = column_clusters[num_columns];
+    int num_lanes = num_clusters * CLUSTER_SIZE;
+    clusters.N = N;
+    clusters.build = atom->num_builds;
+    clusters.num_clusters = num_clusters;
+    clusters.atoms = (int*) malloc(num_lanes * sizeof(int));
+    clusters.x = (real*) malloc(num_lanes * sizeof(real));
+    clusters.y = (real*) malloc(num_lanes * sizeof(real));
+    clusters.z = (real*) malloc(num_lanes * sizeof(real));
+    for (int c = 0; c < num_columns; ++c)
+    {
+        int k = column_clusters[c] * CLUSTER_SIZE;
+        for (int e = column_start[c]; e < column_start[c + 1]; ++e)
+        {
+            clusters.atoms[k++] = entries[e].n;
+        }
+        for (; k < column_clusters[c + 1] * CLUSTER_SIZE; ++k)
+        {
+            clusters.atoms[k] = -1;
+        }
+    }
+
+    // bounding boxes as center and half extent
+    real *center = (real*) malloc(3 * num_clusters * sizeof(real));
+    real *half = (real*) malloc(3 * num_clusters * sizeof(real));
+    real *positions[3] = {atom->x0, atom->y0, atom->z0};
+    for (int c = 0; c < num_clusters; ++c)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            real lo = box[d], hi = 0.0;
+            for (int l = 0; l < CLUSTER_SIZE; ++l)
+            {
+                int n = clusters.atoms[c * CLUSTER_SIZE + l];
+                if (n < 0) { continue; }
+                real p = wrap(positions[d][n], box[d]);
+                lo = fmin(lo, p);
+                hi = fmax(hi, p);
+            }
+            center[3 * c + d] = 0.5 * (lo + hi);
+            half[3 * c + d] = 0.5 * (hi - lo);
+        }
+    }
+
+    // pairs (ci, cj >= ci) of clusters whose boxes come within the list
+    // cutoff, from the columns that reach that far
+    real cutoff = FORCE_CUTOFF + NEIGHBOR_SKIN;
+    int rx = (int) ceil(cutoff / (box[0] / ncx));
+    int ry = (int) ceil(cutoff / (box[1] / ncy));
+    int x_all = 2 * rx + 1 >= ncx, y_all = 2 * ry + 1 >= ncy;
+    int capacity = num_clusters * 64;
+    clusters.pair_start = (int*) malloc((num_clusters + 1) * sizeof(int));
+    clusters.pairs = (int*) malloc(capacity * sizeof(int));
+    int num_pairs = 0;
+    for (int cx = 0; cx < ncx; ++cx)
+    {
+        for (int cy = 0; cy < ncy; ++cy)
+        {
+            int column = cx * ncy + cy;
+            for (int ci = column_clusters[column]; ci < column_clusters[column + 1]; ++ci)
+            {
+                clusters.pair_start[ci] = num_pairs;
+                for (int dx = x_all ? 0 : -rx; dx <= (x_all ? ncx - 1 : rx); ++dx)
+                {
+                    for (int dy = y_all ? 0 : -ry; dy <= (y_all ? ncy - 1 : ry); ++dy)
+                    {
+                        int column2 = (x_all ? dx : (cx + dx + ncx) % ncx) * ncy
+                            + (y_all ? dy : (cy + dy + ncy) % ncy);
+                        int cj = column_clusters[column2];
+                        for (cj = cj > ci ? cj : ci; cj < column_clusters[column2 + 1]; ++cj)
+                        {
+                            real d_square = 0.0;
+                            for (int d = 0; d < 3; ++d)
+                            {
+                                real gap = center[3 * cj + d] - center[3 * ci + d];
+                                gap -= box[d] * floor(gap / box[d] + 0.5);
+                                gap = fabs(gap) - half[3 * ci + d] - half[3 * cj + d];
+                                if (gap > 0.0) { d_square += gap * gap; }
+                            }
+                            if (d_square >= cutoff * cutoff) { continue; }
+                            if (num_pairs == capacity)
+                            {
+                                capacity *= 2;
+                                clusters.pairs = (int*) realloc(clusters.pairs, capacity * sizeof(int));
+                            }
+                            clusters.pairs[num_pairs++] = cj;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    clusters.pair_start[num_clusters] = num_pairs;
+
+    free(entries);
+    free(atom_column);
+    free(column_start);
+    free(column_fill);
+    free(column_clusters);
+    free(center);
+    free(half);
+}
+
+
+#if defined(CLUSTER_AVX512)
+typedef __m512 vreal;
+typedef __mmask16 vmask;
+static inline vreal v_set1(real a) { return _mm512_set1_ps(a); }
+// lanes 0-7 hold i lane p[0], lanes 8-15 i lane p[1]
+static inline vreal v_load_i(const real *p)
+{
+    return _mm512_mask_blend_ps(0xFF00, _mm512_set1_ps(p[0]), _mm512_set1_ps(p[1]));
+}
+// the 8 lanes of a j cluster, twice
+static inline vreal v_load_j(const real *p)
+{
+    return _mm512_castpd_ps(_mm512_broadcast_f64x4(_mm256_castps_pd(_mm256_loadu_ps(p))));
+}
+static inline void v_add_i(real *p, vreal a)
+{
+    p[0] += _mm512_mask_reduce_add_ps(0x00FF, a);
+    p[1] += _mm512_mask_reduce_add_ps(0xFF00, a);
+}
+static inline void v_add_j(real *p, vreal a)
+{
+    __m256 sum = _mm256_add_ps(_mm512_castps512_ps256(a),
+        _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(a), 1)));
+    _mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p), sum));
+}
+static inline vreal v_add(vreal a, vreal b) { return _mm512_add_ps(a, b); }
+static inline vreal v_sub(vreal a, vreal b) { return _mm512_sub_ps(a, b); }
+static inline vreal v_mul(vreal a, vreal b) { return _mm512_mul_ps(a, b); }
+static inline vreal v_div(vreal a, vreal b) { return _mm512_div_ps(a, b); }
+static inline vreal v_fmadd(vreal a, vreal b, vreal c) { return _mm512_fmadd_ps(a, b, c); }
+static inline vreal v_fmsub(vreal a, vreal b, vreal c) { return _mm512_fmsub_ps(a, b, c); }
+static inline vreal v_fnmadd(vreal a, vreal b, vreal c) { return _mm512_fnmadd_ps(a, b, c); }
+static inline vreal v_round(vreal a)
+{
+    return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+static inline vmask v_lt(vreal a, vreal b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+static inline vmask v_and(vmask a, vmask b) { return a & b; }
+static inline vreal v_select(vmask m, vreal a, vreal b) { return _mm512_mask_blend_ps(m, b, a); }
+// a * b where m is set, 0 elsewhere, even where a or b is NaN
+static inline vreal v_mul_masked(vmask m, vreal a, vreal b) { return _mm512_maskz_mul_ps(m, a, b); }
+typedef __m512i vindex;
+static inline vreal v_sqrt(vreal a) { return _mm512_sqrt_ps(a); }
+static inline vreal v_min(vreal a, vreal b) { return _mm512_min_ps(a, b); }
+static inline vreal v_max(vreal a, vreal b) { return _mm512_max_ps(a, b); }
+static inline vreal v_floor(vreal a)
+{
+    return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+}
+static inline vindex v_to_index(vreal a) { return _mm512_cvttps_epi32(a); }
+static inline vreal v_gather(const real *table, vindex i) { return _mm512_i32gather_ps(i, table, sizeof(real)); }
+// 2^n for integral n
+static inline vreal v_pow2(vreal n)
+{
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(_mm512_cvtps_epi32(n), _mm512_set1_epi32(127)), 23));
+}
+#elif defined(CLUSTER_AVX2)
+typedef __m256 vreal;
+typedef __m256 vmask;
+static inline vreal v_set1(real a) { return _mm256_set1_ps(a); }
+static inline vreal v_load_i(const real *p) { return _mm256_set1_ps(p[0]); }
+static inline vreal v_load_j(const real *p) { return _mm256_loadu_ps(p); }
+static inline void v_add_i(real *p, vreal a)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    p[0] += _mm_cvtss_f32(s);
+}
+static inline void v_add_j(real *p, vreal a) { _mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p), a)); }
+static inline vreal v_add(vreal a, vreal b) { return _mm256_add_ps(a, b); }
+static inline vreal v_sub(vreal a, vreal b) { return _mm256_sub_ps(a, b); }
+static inline vreal v_mul(vreal a, vreal b) { return _mm256_mul_ps(a, b); }
+static inline vreal v_div(vreal a, vreal b) { return _mm256_div_ps(a, b); }
+static inline vreal v_fmadd(vreal a, vreal b, vreal c) { return _mm256_fmadd_ps(a, b, c); }
+static inline vreal v_fmsub(vreal a, vreal b, vreal c) { return _mm256_fmsub_ps(a, b, c); }
+static inline vreal v_fnmadd(vreal a, vreal b, vreal c) { return _mm256_fnmadd_ps(a, b, c); }
+static inline vreal v_round(vreal a)
+{
+    return _mm256_round_ps(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+}
+static inline vmask v_lt(vreal a, vreal b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline vmask v_and(vmask a, vmask b) { return _mm256_and_ps(a, b); }
+static inline vreal v_select(vmask m, vreal a, vreal b) { return _mm256_blendv_ps(b, a, m); }
+static inline vreal v_mul_masked(vmask m, vreal a, vreal b) { return _mm256_and_ps(m, _mm256_mul_ps(a, b)); }
+typedef __m256i vindex;
+static inline vreal v_sqrt(vreal a) { return _mm256_sqrt_ps(a); }
+static inline vreal v_min(vreal a, vreal b) { return _mm256_min_ps(a, b); }
+static inline vreal v_max(vreal a, vreal b) { return _mm256_max_ps(a, b); }
+static inline vreal v_floor(vreal a) { return _mm256_floor_ps(a); }
+static inline vindex v_to_index(vreal a) { return _mm256_cvttps_epi32(a); }
+static inline vreal v_gather(const real *table, vindex i) { return _mm256_i32gather_ps(table, i, sizeof(real)); }
+static inline vreal v_pow2(vreal n)
+{
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23));
+}
+#endif
+
+#ifdef I_PER_VECTOR
+// e^a as 2^n e^r, |r| <= ln 2 / 2, with the polynomial of the Cephes expf
+static inline vreal v_exp(vreal a)
+{
+    a = v_min(v_max(a, v_set1(-87.0)), v_set1(87.0));
+    vreal n = v_round(v_mul(a, v_set1(1.44269504088896341)));
+    vreal r = v_fnmadd(n, v_set1(0.693359375), a);
+    r = v_fnmadd(n, v_set1(-2.12194440e-4), r);
+    vreal p = v_fmadd(v_set1(1.9875691500e-4), r, v_set1(1.3981999507e-3));
+    p = v_fmadd(p, r, v_set1(8.3334519073e-3));
+    p = v_fmadd(p, r, v_set1(4.1665795894e-2));
+    p = v_fmadd(p, r, v_set1(1.6666665459e-1));
+    p = v_fmadd(p, r, v_set1(5.0000001201e-1));
+    p = v_fmadd(p, v_mul(r, r), v_add(r, v_set1(1.0)));
+    return v_mul(p, v_pow2(n));
+}
+
+// the operations of potential.cuh on the lanes of a vector
+struct Vector_Ops
+{
+    typedef vreal T;
+    typedef vindex I;
+    static inline T set1(real a) { return v_set1(a); }
+    static inline T add(T a, T b) { return v_add(a, b); }
+    static inline T sub(T a, T b) { return v_sub(a, b); }
+    static inline T mul(T a, T b) { return v_mul(a, b); }
+    static inline T div(T a, T b) { return v_div(a, b); }
+    static inline T fmadd(T a, T b, T c) { return v_fmadd(a, b, c); }
+    static inline T fmsub(T a, T b, T c) { return v_fmsub(a, b, c); }
+    static inline T sqrt(T a) { return v_sqrt(a); }
+    static inline T exp(T a) { return v_exp(a); }
+    static inline T min(T a, T b) { return v_min(a, b); }
+    static inline T max(T a, T b) { return v_max(a, b); }
+    static inline T floor(T a) { return v_floor(a); }
+    static inline I to_index(T a) { return v_to_index(a); }
+    static inline T gather(const real *table, I i) { return v_gather(table, i); }
+};
+#endif
+
+#ifdef I_PER_VECTOR
+// i lanes held in registers while a j cluster goes by
+#define I_TILE 4
+#define I_VECTORS (I_TILE / I_PER_VECTOR)
+
+// cluster c against its j clusters, adding to the lane results f (fx, fy,
+// fz and pe, each num_lanes long) of both sides. Padding lanes hold NaN and
+// fail every comparison, and within c only lanes m > l pair up, so masks
+// replace the cutoff, padding and double counting branches
+template <class Potential>
+static void find_force_one_cluster(const Potential &potential, int c, const real *box, real *f, int num_lanes)
+{
+    static const real lane_id[CLUSTER_SIZE] = {0, 1, 2, 3, 4, 5, 6, 7};
+    const vreal zero = v_set1(0.0), one = v_set1(1.0), rc2 = v_set1(cutoff_square);
+    const vreal bx = v_set1(box[0]), by = v_set1(box[1]), bz = v_set1(box[2]);
+    const vreal ibx = v_set1(1.0 / box[0]), iby = v_set1(1.0 / box[1]), ibz = v_set1(1.0 / box[2]);
+    const vreal half = v_set1(0.5);
+    real *fx = f, *fy = f + num_lanes, *fz = f + 2 * num_lanes, *pe = f + 3 * num_lanes;
+    for (int l0 = 0; l0 < CLUSTER_SIZE; l0 += I_TILE)
+    {
+        int k0 = c * CLUSTER_SIZE + l0;
+        vreal xi[I_VECTORS], yi[I_VECTORS], zi[I_VECTORS];
+        vreal fxi[I_VECTORS], fyi[I_VECTORS], fzi[I_VECTORS], pei[I_VECTORS];
+        vmask diagonal[I_VECTORS];
+        for (int v = 0; v < I_VECTORS; ++v)
+        {
+            xi[v] = v_load_i(&clusters.x[k0 + v * I_PER_VECTOR]);
+            yi[v] = v_load_i(&clusters.y[k0 + v * I_PER_VECTOR]);
+            zi[v] = v_load_i(&clusters.z[k0 + v * I_PER_VECTOR]);
+            fxi[v] = fyi[v] = fzi[v] = pei[v] = zero;
+            diagonal[v] = v_lt(v_load_i(&lane_id[l0 + v * I_PER_VECTOR]), v_load_j(lane_id));
+        }
+        for (int p = clusters.pair_start[c]; p < clusters.pair_start[c + 1]; ++p)
+        {
+            int j = clusters.pairs[p] * CLUSTER_SIZE;
+            vreal xj = v_load_j(&clusters.x[j]);
+            vreal yj = v_load_j(&clusters.y[j]);
+            vreal zj = v_load_j(&clusters.z[j]);
+            vreal fxj = zero, fyj = zero, fzj = zero, pej = zero;
+            for (int v = 0; v < I_VECTORS; ++v)
+            {
+                vreal x_ij = v_sub(xj, xi[v]);
+                vreal y_ij = v_sub(yj, yi[v]);
+                vreal z_ij = v_sub(zj, zi[v]);
+                x_ij = v_fnmadd(bx, v_round(v_mul(x_ij, ibx)), x_ij);
+                y_ij = v_fnmadd(by, v_round(v_mul(y_ij, iby)), y_ij);
+                z_ij = v_fnmadd(bz, v_round(v_mul(z_ij, ibz)), z_ij);
+                vreal r2 = v_fmadd(x_ij, x_ij, v_fmadd(y_ij, y_ij, v_mul(z_ij, z_ij)));
+                vmask inside = v_lt(r2, rc2);
+                if (j == k0 - l0) { inside = v_and(inside, diagonal[v]); }
+                vreal f_ij, e_ij;
+                potential.template find<Vector_Ops>(v_select(inside, r2, one), &f_ij, &e_ij);
+                // masked lanes add nothing, padding ones having NaN distances
+                e_ij = v_select(inside, e_ij, zero);
+                vreal fx_ij = v_mul_masked(inside, f_ij, x_ij);
+                vreal fy_ij = v_mul_masked(inside, f_ij, y_ij);
+                vreal fz_ij = v_mul_masked(inside, f_ij, z_ij);
+                fxi[v] = v_add(fxi[v], fx_ij); fxj = v_sub(fxj, fx_ij);
+                fyi[v] = v_add(fyi[v], fy_ij); fyj = v_sub(fyj, fy_ij);
+                fzi[v] = v_add(fzi[v], fz_ij); fzj = v_sub(fzj, fz_ij);
+                pei[v] = v_add(pei[v], e_ij); pej = v_add(pej, e_ij);
+            }
+            v_add_j(&fx[j], fxj);
+            v_add_j(&fy[j], fyj);
+            v_add_j(&fz[j], fzj);
+            v_add_j(&pe[j], v_mul(pej, half));
+        }
+        for (int v = 0; v < I_VECTORS; ++v)
+        {
+            int k = k0 + v * I_PER_VECTOR;
+            v_add_i(&fx[k], fxi[v]);
+            v_add_i(&fy[k], fyi[v]);
+            v_add_i(&fz[k], fzi[v]);
+            v_add_i(&pe[k], v_mul(pei[v], half));
+        }
+    }
+}
+#else
+template <class Potential>
+static void find_force_one_cluster(const Potential &potential, int c, const real *box, real *f, int num_lanes)
+{
+    real *fx = f, *fy = f + num_lanes, *fz = f + 2 * num_lanes, *pe = f + 3 * num_lanes;
+    real *b = (real*) box;
+    for (int l = 0; l < CLUSTER_SIZE; ++l)
+    {
+        int k = c * CLUSTER_SIZE + l;
+        for (int p = clusters.pair_start[c]; p < clusters.pair_start[c + 1]; ++p)
+        {
+            int j = clusters.pairs[p] * CLUSTER_SIZE;
+            for (int m = j == c * CLUSTER_SIZE ? l + 1 : 0; m < CLUSTER_SIZE; ++m)
+            {
+                real x_ij = clusters.x[j + m] - clusters.x[k];
+                real y_ij = clusters.y[j + m] - clusters.y[k];
+                real z_ij = clusters.z[j + m] - clusters.z[k];
+                apply_mic(b, &x_ij, &y_ij, &z_ij);
+                real r2 = x_ij*x_ij + y_ij*y_ij + z_ij*z_ij;
+                if (!(r2 < cutoff_square)) { continue; }
+                real f_ij, e_ij;
+                potential.find(r2, &f_ij, &e_ij);
+                e_ij *= 0.5;
+                pe[k] += e_ij; pe[j + m] += e_ij;
+                fx[k] += f_ij * x_ij; fx[j + m] -= f_ij * x_ij;
+                fy[k] += f_ij * y_ij; fy[j + m] -= f_ij * y_ij;
+                fz[k] += f_ij * z_ij; fz[j + m] -= f_ij * z_ij;
+            }
+        }
+    }
+}
+#endif
+
+const char *cluster_kernel_isa()
+{
+#if defined(CLUSTER_AVX512)
+    return "AVX-512";
+#elif defined(CLUSTER_AVX2)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+}
+
+template <class Potential>
+static void find_force_clusters(const Potential &potential, const real *box, real *buffer, int num_lanes)
+{
+    #pragma omp for schedule(dynamic, 16)
+    for (int c = 0; c < clusters.num_clusters; ++c)
+    {
+        find_force_one_cluster(potential, c, box, buffer, num_lanes);
+    }
+}
+
+void find_force_cluster(int N, Atom *atom, int num_threads, Pair_Potential pair_potential)
+{
+    if (clusters.N != N || clusters.build != atom->num_builds)
+    {
+        build_clusters(N, atom);
+    }
+    int num_lanes = clusters.num_clusters * CLUSTER_SIZE;
+    const int *atoms = clusters.atoms;
+
+    // lane results of each thread, kept between steps
+    static real **buffers = NULL;
+    static int buffers_lanes = 0, buffers_count = 0;
+    if (buffers_lanes != num_lanes || buffers_count < num_threads)
+    {
+        for (int s = 0; s < buffers_count; ++s) { free(buffers[s]); }
+        free(buffers);
+        buffers = (real**) malloc(num_threads * sizeof(real*));
+        for (int s = 0; s < num_threads; ++s)
+        {
+            buffers[s] = (real*) malloc(4 * num_lanes * sizeof(real));
+        }
+        buffers_lanes = num_lanes;
+        buffers_count = num_threads;
+    }
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+        int num_used = omp_get_num_threads();
+        real *buffer = buffers[omp_get_thread_num()];
+        for (int k = 0; k < 4 * num_lanes; ++k) { buffer[k] = 0.0; }
+        #pragma omp for
+        for (int k = 0; k < num_lanes; ++k)
+        {
+            int n = atoms[k];
+            clusters.x[k] = n < 0 ? NAN : atom->x[n];
+            clusters.y[k] = n < 0 ? NAN : atom->y[n];
+            clusters.z[k] = n < 0 ? NAN : atom->z[n];
+        }
+        with_pair_potential(pair_potential, [&](const auto &potential)
+        {
+            find_force_clusters(potential, atom->box, buffer, num_lanes);
+        });
+        #pragma omp for
+        for (int k = 0; k < num_lanes; ++k)
+        {
+            int n = atoms[k];
+            if (n < 0) { continue; }
+            real f[4] = {0.0, 0.0, 0.0, 0.0};
+            for (int s = 0; s < num_used; ++s)
+            {
+                for (int d = 0; d < 4; ++d) { f[d] += buffers[s][d * num_lanes + k]; }
+            }
+            atom->fx[n] = f[0];
+            atom->fy[n] = f[1];
+            atom->fz[n] = f[2];
+            atom->pe[n] = f[3];
+        }
+    }
+}
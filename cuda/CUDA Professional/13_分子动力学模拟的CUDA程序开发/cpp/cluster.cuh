@@ -0,0 +1,14 @@
+#pragma once
+#include "common.cuh"
+#include "potential.cuh"
+
+// atoms per spatial cluster, the width of a j cluster in the SIMD kernel
+#define CLUSTER_SIZE 8
+
+// forces from a list of cluster pairs: atoms are grouped into clusters of
+// CLUSTER_SIZE neighbors, and each cluster is paired with every cluster whose
+// bounding box comes within the list cutoff; the pairs are remade whenever
+// the atom neighbor list has been rebuilt since the last call
+void find_force_cluster(int N, Atom *atom, int num_threads, Pair_Potential potential);
+// instruction set the cluster kernel was compiled for
+const char *cluster_kernel_isa();
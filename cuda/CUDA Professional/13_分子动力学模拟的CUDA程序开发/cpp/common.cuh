@@ -8,6 +8,9 @@
 
 const real K_B = 8.617343e-5;
 const real TIME_UNIT_CONVERSION = 1.018051e+1;
+const real FORCE_CUTOFF = 10.0;
+// neighbor lists reach this far beyond the force cutoff
+const real NEIGHBOR_SKIN = 1.0;
 
 struct Atom
 {
@@ -26,4 +29,10 @@ struct Atom
     real *pe;
     real *ke;
     real *box;
+    real *x0; // positions at the last neighbor list build
+    real *y0;
+    real *z0;
+    int *id;        // index at initialization, carried along by sort_atoms
+    int num_builds; // neighbor list builds and atom sorts so far; lists of
+                    // atom indices made before it last changed are stale
 };
@@ -0,0 +1,590 @@
+#include "domain.cuh"
+#include "memory.cuh"
+#include "potential.cuh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const real list_cutoff = FORCE_CUTOFF + NEIGHBOR_SKIN;
+
+// an atom moving to another rank
+struct Migrant
+{
+    int id;
+    real data[10]; // m, x, y, z, vx, vy, vz, fx, fy, fz
+};
+
+static void reserve_atoms(Domain *domain, Atom *atom, int count)
+{
+    if (count <= domain->capacity) { return; }
+    int capacity = count + count / 4 + 16;
+    real **arrays[] =
+    {
+        &atom->m, &atom->x, &atom->y, &atom->z, &atom->vx, &atom->vy, &atom->vz,
+        &atom->fx, &atom->fy, &atom->fz, &atom->pe, &atom->ke, &atom->x0, &atom->y0, &atom->z0
+    };
+    for (int a = 0; a < (int) (sizeof(arrays) / sizeof(arrays[0])); ++a)
+    {
+        *arrays[a] = (real*) realloc(*arrays[a], capacity * sizeof(real));
+    }
+    int MN = domain->MN;
+    atom->id = (int*) realloc(atom->id, capacity * sizeof(int));
+    atom->NN = (int*) realloc(atom->NN, capacity * sizeof(int));
+    atom->NL = (int*) realloc(atom->NL, (size_t) capacity * MN * sizeof(int));
+    domain->NN_ghost = (int*) realloc(domain->NN_ghost, capacity * sizeof(int));
+    domain->NL_ghost = (int*) realloc(domain->NL_ghost, (size_t) capacity * MN * sizeof(int));
+    domain->capacity = capacity;
+}
+
+// subdomain index of a wrapped coordinate
+static int owner_coord(real x, real box_length, int dims)
+{
+    int c = (int) floor(x / box_length * dims);
+    return c < 0 ? 0 : c >= dims ? dims - 1 : c;
+}
+
+static int offset_index(int ox, int oy, int oz)
+{
+    int o = (ox + 1) * 9 + (oy + 1) * 3 + (oz + 1);
+    return o < 13 ? o : o - 1;
+}
+
+// sends send_size[o] bytes at send + send_start[o] to the rank at offset o,
+// receiving recv_size[o] bytes from the rank at the opposite offset
+static void exchange_bytes
+(
+    Domain *domain, const char *send, const int *send_start, const int *send_size,
+    char *recv, const int *recv_start, const int *recv_size
+)
+{
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        MPI_Irecv(recv + recv_start[o], recv_size[o], MPI_BYTE, domain->neighbor[NUM_OFFSETS - 1 - o],
+            o, domain->comm, &domain->requests[o]);
+    }
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        MPI_Isend(send + send_start[o], send_size[o], MPI_BYTE, domain->neighbor[o],
+            o, domain->comm, &domain->requests[NUM_OFFSETS + o]);
+    }
+    MPI_Waitall(2 * NUM_OFFSETS, domain->requests, MPI_STATUSES_IGNORE);
+}
+
+static void exchange_counts(Domain *domain, const int *send_count, int *recv_count)
+{
+    int start[NUM_OFFSETS], size[NUM_OFFSETS];
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        start[o] = o * sizeof(int);
+        size[o] = sizeof(int);
+    }
+    exchange_bytes(domain, (const char*) send_count, start, size, (char*) recv_count, start, size);
+}
+
+// deterministic uniform number in [0, 1) per key (splitmix64)
+static real random_uniform(unsigned long long key)
+{
+    unsigned long long z = key + 0x9E3779B97F4A7C15ull;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return (z >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void initialize_velocity_domain(real T_0, Domain *domain, Atom *atom)
+{
+    int n_local = domain->num_local;
+    double momentum[4] = {0.0, 0.0, 0.0, 0.0};
+    real *v[3] = {atom->vx, atom->vy, atom->vz};
+    for (int n = 0; n < n_local; ++n)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            v[d][n] = -1.0 + 2.0 * random_uniform(3ull * atom->id[n] + d);
+            momentum[d] += atom->m[n] * v[d][n];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, momentum, 3, MPI_DOUBLE, MPI_SUM, domain->comm);
+    for (int n = 0; n < n_local; ++n)
+    {
+        for (int d = 0; d < 3; ++d)
+        {
+            v[d][n] -= momentum[d] / domain->N / atom->m[n];
+            momentum[3] += atom->m[n] * v[d][n] * v[d][n];
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &momentum[3], 1, MPI_DOUBLE, MPI_SUM, domain->comm);
+    real temperature = momentum[3] / (3.0 * K_B * domain->N);
+    real scale_factor = sqrt(T_0 / temperature);
+    for (int n = 0; n < n_local; ++n)
+    {
+        for (int d = 0; d < 3; ++d) { v[d][n] *= scale_factor; }
+    }
+}
+
+bool create_domain(int nx, real ax, real mass, real T_0, int MN, Domain *domain, Atom *atom)
+{
+    memset(domain, 0, sizeof(Domain));
+    MPI_Comm_size(MPI_COMM_WORLD, &domain->num_ranks);
+    int periods[3] = {1, 1, 1};
+    MPI_Dims_create(domain->num_ranks, 3, domain->dims);
+    MPI_Cart_create(MPI_COMM_WORLD, 3, domain->dims, periods, 0, &domain->comm);
+    MPI_Comm_rank(domain->comm, &domain->rank);
+    MPI_Cart_coords(domain->comm, domain->rank, 3, domain->coords);
+    domain->N = 4 * nx * nx * nx;
+    domain->MN = MN;
+
+    real box_length = ax * nx;
+    for (int d = 0; d < 3; ++d)
+    {
+        domain->lo[d] = box_length * domain->coords[d] / domain->dims[d];
+        domain->hi[d] = box_length * (domain->coords[d] + 1) / domain->dims[d];
+        if (box_length / domain->dims[d] < list_cutoff || box_length < 2.0 * list_cutoff)
+        {
+            if (domain->rank == 0)
+            {
+                printf("Error: a %d x %d x %d rank grid leaves subdomains thinner than the list cutoff.\n",
+                    domain->dims[0], domain->dims[1], domain->dims[2]);
+            }
+            MPI_Comm_free(&domain->comm);
+            return false;
+        }
+    }
+    int o = 0;
+    for (int ox = -1; ox <= 1; ++ox)
+    {
+        for (int oy = -1; oy <= 1; ++oy)
+        {
+            for (int oz = -1; oz <= 1; ++oz)
+            {
+                if (ox == 0 && oy == 0 && oz == 0) { continue; }
+                int c[3] = {domain->coords[0] + ox, domain->coords[1] + oy, domain->coords[2] + oz};
+                int off[3] = {ox, oy, oz};
+                for (int d = 0; d < 3; ++d)
+                {
+                    domain->offset[o][d] = off[d];
+                    domain->shift[o][d] = c[d] < 0 ? box_length : c[d] >= domain->dims[d] ? -box_length : 0.0;
+                }
+                MPI_Cart_rank(domain->comm, c, &domain->neighbor[o]);
+                o++;
+            }
+        }
+    }
+
+    // the lattice sites of this subdomain, numbered as in initialize_position
+    int capacity = domain->N / domain->num_ranks + domain->N / domain->num_ranks / 4 + 16;
+    allocate_memory(capacity, MN, atom);
+    domain->capacity = capacity;
+    domain->NN_ghost = (int*) malloc(capacity * sizeof(int));
+    domain->NL_ghost = (int*) malloc((size_t) capacity * MN * sizeof(int));
+    for (int d = 0; d < 3; ++d)
+    {
+        atom->box[d] = box_length;
+        atom->box[d + 3] = box_length * 0.5;
+    }
+    real x0[4] = {0.0, 0.0, 0.5, 0.5};
+    real y0[4] = {0.0, 0.5, 0.0, 0.5};
+    real z0[4] = {0.0, 0.5, 0.5, 0.0};
+    int n = 0;
+    for (int ix = 0; ix < nx; ++ix)
+    {
+        for (int iy = 0; iy < nx; ++iy)
+        {
+            for (int iz = 0; iz < nx; ++iz)
+            {
+                for (int i = 0; i < 4; ++i, ++n)
+                {
+                    real r[3] = {(ix + x0[i]) * ax, (iy + y0[i]) * ax, (iz + z0[i]) * ax};
+                    int mine = 1;
+                    for (int d = 0; d < 3; ++d)
+                    {
+                        mine &= owner_coord(r[d], box_length, domain->dims[d]) == domain->coords[d];
+                    }
+                    if (!mine) { continue; }
+                    int k = domain->num_local++;
+                    reserve_atoms(domain, atom, domain->num_local);
+                    atom->id[k] = n;
+                    atom->m[k] = mass;
+                    atom->x[k] = r[0];
+                    atom->y[k] = r[1];
+                    atom->z[k] = r[2];
+                    atom->fx[k] = atom->fy[k] = atom->fz[k] = 0.0;
+                }
+            }
+        }
+    }
+    initialize_velocity_domain(T_0, domain, atom);
+    return true;
+}
+
+void destroy_domain(Domain *domain, Atom *atom)
+{
+    for (int o = 0; o < NUM_OFFSETS; ++o) { free(domain->send_list[o]); }
+    free(domain->send_buffer);
+    free(domain->recv_buffer);
+    free(domain->NN_ghost);
+    free(domain->NL_ghost);
+    MPI_Comm_free(&domain->comm);
+    deallocate_memory(atom);
+}
+
+// local atoms that have left the subdomain go to the rank now owning them,
+// at most one subdomain away as no atom moves more than NEIGHBOR_SKIN / 2
+// between builds
+static void migrate(Domain *domain, Atom *atom)
+{
+    int n_local = domain->num_local;
+    real *r[3] = {atom->x, atom->y, atom->z};
+    int *target = (int*) malloc((n_local + 1) * sizeof(int));
+    int send_count[NUM_OFFSETS], recv_count[NUM_OFFSETS];
+    memset(send_count, 0, sizeof(send_count));
+    for (int n = 0; n < n_local; ++n)
+    {
+        int off[3];
+        for (int d = 0; d < 3; ++d)
+        {
+            r[d][n] -= atom->box[d] * floor(r[d][n] / atom->box[d]);
+            int c = owner_coord(r[d][n], atom->box[d], domain->dims[d]);
+            int dims = domain->dims[d], mine = domain->coords[d];
+            off[d] = c == mine ? 0 : c == (mine + 1) % dims ? 1 : c == (mine + dims - 1) % dims ? -1 : 2;
+            if (off[d] == 2)
+            {
+                printf("Error: atom %d moved further than one subdomain.\n", atom->id[n]);
+                MPI_Abort(domain->comm, 1);
+            }
+        }
+        target[n] = off[0] == 0 && off[1] == 0 && off[2] == 0 ? -1 : offset_index(off[0], off[1], off[2]);
+        if (target[n] >= 0) { send_count[target[n]]++; }
+    }
+    exchange_counts(domain, send_count, recv_count);
+
+    int send_start[NUM_OFFSETS], send_size[NUM_OFFSETS], recv_start[NUM_OFFSETS], recv_size[NUM_OFFSETS];
+    int num_send = 0, num_recv = 0;
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        send_start[o] = num_send * sizeof(Migrant);
+        send_size[o] = send_count[o] * sizeof(Migrant);
+        recv_start[o] = num_recv * sizeof(Migrant);
+        recv_size[o] = recv_count[o] * sizeof(Migrant);
+        num_send += send_count[o];
+        num_recv += recv_count[o];
+    }
+    Migrant *send = (Migrant*) malloc((num_send + 1) * sizeof(Migrant));
+    Migrant *recv = (Migrant*) malloc((num_recv + 1) * sizeof(Migrant));
+    int fill[NUM_OFFSETS];
+    memset(fill, 0, sizeof(fill));
+
+    // the leaving atoms are packed, the staying ones moved down over them
+    real *arrays[10] = {atom->m, atom->x, atom->y, atom->z, atom->vx, atom->vy, atom->vz, atom->fx, atom->fy, atom->fz};
+    int kept = 0;
+    for (int n = 0; n < n_local; ++n)
+    {
+        if (target[n] >= 0)
+        {
+            Migrant *m = &send[send_start[target[n]] / sizeof(Migrant) + fill[target[n]]++];
+            m->id = atom->id[n];
+            for (int a = 0; a < 10; ++a) { m->data[a] = arrays[a][n]; }
+            continue;
+        }
+        atom->id[kept] = atom->id[n];
+        for (int a = 0; a < 10; ++a) { arrays[a][kept] = arrays[a][n]; }
+        kept++;
+    }
+    exchange_bytes(domain, (const char*) send, send_start, send_size, (char*) recv, recv_start, recv_size);
+
+    reserve_atoms(domain, atom, kept + num_recv);
+    real *grown[10] = {atom->m, atom->x, atom->y, atom->z, atom->vx, atom->vy, atom->vz, atom->fx, atom->fy, atom->fz};
+    for (int k = 0; k < num_recv; ++k)
+    {
+        atom->id[kept + k] = recv[k].id;
+        for (int a = 0; a < 10; ++a) { grown[a][kept + k] = recv[k].data[a]; }
+    }
+    domain->num_local = kept + num_recv;
+    free(target);
+    free(send);
+    free(recv);
+}
+
+// posts the exchange of ghost positions
+static void begin_halo(Domain *domain, Atom *atom)
+{
+    int num_send = 0;
+    for (int o = 0; o < NUM_OFFSETS; ++o) { num_send += domain->send_count[o]; }
+    if (3 * num_send > domain->send_buffer_size)
+    {
+        domain->send_buffer_size = 3 * num_send + 3 * num_send / 4 + 16;
+        domain->send_buffer = (real*) realloc(domain->send_buffer, domain->send_buffer_size * sizeof(real));
+    }
+    if (3 * domain->num_ghost > domain->recv_buffer_size)
+    {
+        domain->recv_buffer_size = 3 * domain->num_ghost + 3 * domain->num_ghost / 4 + 16;
+        domain->recv_buffer = (real*) realloc(domain->recv_buffer, domain->recv_buffer_size * sizeof(real));
+    }
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        MPI_Irecv(domain->recv_buffer + 3 * domain->recv_start[o], 3 * domain->recv_count[o], MPI_REAL_TYPE,
+            domain->neighbor[NUM_OFFSETS - 1 - o], o, domain->comm, &domain->requests[o]);
+    }
+    real *buffer = domain->send_buffer;
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        real *start = buffer;
+        const real *shift = domain->shift[o];
+        for (int k = 0; k < domain->send_count[o]; ++k)
+        {
+            int n = domain->send_list[o][k];
+            *buffer++ = atom->x[n] + shift[0];
+            *buffer++ = atom->y[n] + shift[1];
+            *buffer++ = atom->z[n] + shift[2];
+        }
+        MPI_Isend(start, 3 * domain->send_count[o], MPI_REAL_TYPE, domain->neighbor[o], o, domain->comm,
+            &domain->requests[NUM_OFFSETS + o]);
+    }
+}
+
+static void end_halo(Domain *domain, Atom *atom)
+{
+    MPI_Waitall(2 * NUM_OFFSETS, domain->requests, MPI_STATUSES_IGNORE);
+    const real *buffer = domain->recv_buffer;
+    for (int k = domain->num_local; k < domain->num_local + domain->num_ghost; ++k)
+    {
+        atom->x[k] = *buffer++;
+        atom->y[k] = *buffer++;
+        atom->z[k] = *buffer++;
+    }
+}
+
+// local atoms within the list cutoff of each face, edge and corner
+static void build_halo(Domain *domain, Atom *atom)
+{
+    for (int o = 0; o < NUM_OFFSETS; ++o) { domain->send_count[o] = 0; }
+    real *r[3] = {atom->x, atom->y, atom->z};
+    for (int n = 0; n < domain->num_local; ++n)
+    {
+        int near_lo[3], near_hi[3];
+        for (int d = 0; d < 3; ++d)
+        {
+            near_lo[d] = r[d][n] < domain->lo[d] + list_cutoff;
+            near_hi[d] = r[d][n] >= domain->hi[d] - list_cutoff;
+        }
+        for (int o = 0; o < NUM_OFFSETS; ++o)
+        {
+            int send = 1;
+            for (int d = 0; d < 3; ++d)
+            {
+                int off = domain->offset[o][d];
+                send &= off == 0 || (off > 0 ? near_hi[d] : near_lo[d]);
+            }
+            if (!send) { continue; }
+            if (domain->send_count[o] == domain->send_capacity[o])
+            {
+                domain->send_capacity[o] = 2 * domain->send_capacity[o] + 16;
+                domain->send_list[o] = (int*) realloc(domain->send_list[o], domain->send_capacity[o] * sizeof(int));
+            }
+            domain->send_list[o][domain->send_count[o]++] = n;
+        }
+    }
+    exchange_counts(domain, domain->send_count, domain->recv_count);
+    domain->num_ghost = 0;
+    for (int o = 0; o < NUM_OFFSETS; ++o)
+    {
+        domain->recv_start[o] = domain->num_ghost;
+        domain->num_ghost += domain->recv_count[o];
+    }
+    reserve_atoms(domain, atom, domain->num_local + domain->num_ghost);
+    begin_halo(domain, atom);
+    end_halo(domain, atom);
+}
+
+static int find_cell(real x, real lower, real width, int num_cells)
+{
+    int c = (int) floor((x - lower) / width);
+    return c < 0 ? 0 : c >= num_cells ? num_cells - 1 : c;
+}
+
+static void add_neighbor(int MN, int *NN, int *NL, int n1, int n2)
+{
+    if (NN[n1] == MN)
+    {
+        printf("Error: MN is too small.\n");
+        exit(1);
+    }
+    NL[n1 * MN + NN[n1]++] = n2;
+}
+
+// linked cells over the subdomain and its halo, with plain differences
+static void build_lists(Domain *domain, Atom *atom)
+{
+    int n_local = domain->num_local;
+    int count = n_local + domain->num_ghost;
+    int MN = domain->MN;
+    real list_cutoff_square = list_cutoff * list_cutoff;
+    int nc[3];
+    real lower[3], width[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        real length = domain->hi[d] - domain->lo[d] + 2.0 * list_cutoff;
+        nc[d] = (int) floor(length / list_cutoff);
+        width[d] = length / nc[d];
+        lower[d] = domain->lo[d] - list_cutoff;
+    }
+    int num_cells = nc[0] * nc[1] * nc[2];
+    int *atom_cell = (int*) malloc(count * sizeof(int));
+    int *cell_start = (int*) calloc(num_cells + 1, sizeof(int));
+    int *cell_fill = (int*) calloc(num_cells, sizeof(int));
+    int *cell_atoms = (int*) malloc(count * sizeof(int));
+    for (int n = 0; n < count; ++n)
+    {
+        int cx = find_cell(atom->x[n], lower[0], width[0], nc[0]);
+        int cy = find_cell(atom->y[n], lower[1], width[1], nc[1]);
+        int cz = find_cell(atom->z[n], lower[2], width[2], nc[2]);
+        atom_cell[n] = (cx * nc[1] + cy) * nc[2] + cz;
+        cell_start[atom_cell[n] + 1]++;
+    }
+    for (int c = 0; c < num_cells; ++c)
+    {
+        cell_start[c + 1] += cell_start[c];
+    }
+    for (int n = 0; n < count; ++n)
+    {
+        cell_atoms[cell_start[atom_cell[n]] + cell_fill[atom_cell[n]]++] = n;
+    }
+
+    for (int n1 = 0; n1 < n_local; ++n1)
+    {
+        atom->NN[n1] = 0;
+        domain->NN_ghost[n1] = 0;
+        int c = atom_cell[n1];
+        int cx = c / (nc[1] * nc[2]);
+        int cy = c / nc[2] % nc[1];
+        int cz = c % nc[2];
+        for (int x2 = cx > 0 ? cx - 1 : 0; x2 <= cx + 1 && x2 < nc[0]; ++x2)
+        {
+            for (int y2 = cy > 0 ? cy - 1 : 0; y2 <= cy + 1 && y2 < nc[1]; ++y2)
+            {
+                for (int z2 = cz > 0 ? cz - 1 : 0; z2 <= cz + 1 && z2 < nc[2]; ++z2)
+                {
+                    int c2 = (x2 * nc[1] + y2) * nc[2] + z2;
+                    for (int k = cell_start[c2]; k < cell_start[c2 + 1]; ++k)
+                    {
+                        int n2 = cell_atoms[k];
+                        if (n2 < n_local && n2 <= n1) { continue; }
+                        real x12 = atom->x[n2] - atom->x[n1];
+                        real y12 = atom->y[n2] - atom->y[n1];
+                        real z12 = atom->z[n2] - atom->z[n1];
+                        if (x12*x12 + y12*y12 + z12*z12 >= list_cutoff_square) { continue; }
+                        if (n2 < n_local)
+                        {
+                            add_neighbor(MN, atom->NN, atom->NL, n1, n2);
+                        }
+                        else
+                        {
+                            add_neighbor(MN, domain->NN_ghost, domain->NL_ghost, n1, n2);
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(atom_cell);
+    free(cell_start);
+    free(cell_fill);
+    free(cell_atoms);
+}
+
+void build_domain(Domain *domain, Atom *atom)
+{
+    migrate(domain, atom);
+    build_halo(domain, atom);
+    build_lists(domain, atom);
+    for (int n = 0; n < domain->num_local; ++n)
+    {
+        atom->x0[n] = atom->x[n];
+        atom->y0[n] = atom->y[n];
+        atom->z0[n] = atom->z[n];
+    }
+    domain->num_builds++;
+}
+
+int update_domain(Domain *domain, Atom *atom)
+{
+    real limit_square = NEIGHBOR_SKIN * NEIGHBOR_SKIN * 0.25;
+    int rebuild = 0;
+    for (int n = 0; n < domain->num_local && !rebuild; ++n)
+    {
+        real dx = atom->x[n] - atom->x0[n];
+        real dy = atom->y[n] - atom->y0[n];
+        real dz = atom->z[n] - atom->z0[n];
+        rebuild = dx*dx + dy*dy + dz*dz > limit_square;
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &rebuild, 1, MPI_INT, MPI_MAX, domain->comm);
+    if (rebuild) { build_domain(domain, atom); }
+    return rebuild;
+}
+
+void find_force_domain(Domain *domain, Atom *atom, double *t_wait)
+{
+    int n_local = domain->num_local;
+    int MN = domain->MN;
+    real *x = atom->x, *y = atom->y, *z = atom->z;
+    real *fx = atom->fx, *fy = atom->fy, *fz = atom->fz, *pe = atom->pe;
+    Lennard_Jones potential;
+    begin_halo(domain, atom);
+
+    // local pairs, both atoms updated, each taking half the energy
+    for (int n = 0; n < n_local; ++n) { fx[n] = fy[n] = fz[n] = pe[n] = 0.0; }
+    for (int i = 0; i < n_local; ++i)
+    {
+        for (int k = 0; k < atom->NN[i]; ++k)
+        {
+            int j = atom->NL[i * MN + k];
+            real x_ij = x[j] - x[i];
+            real y_ij = y[j] - y[i];
+            real z_ij = z[j] - z[i];
+            real r2 = x_ij*x_ij + y_ij*y_ij + z_ij*z_ij;
+            if (r2 > cutoff_square) { continue; }
+            real f_ij, e_ij;
+            potential.find(r2, &f_ij, &e_ij);
+            pe[i] += e_ij * 0.5; pe[j] += e_ij * 0.5;
+            fx[i] += f_ij * x_ij; fx[j] -= f_ij * x_ij;
+            fy[i] += f_ij * y_ij; fy[j] -= f_ij * y_ij;
+            fz[i] += f_ij * z_ij; fz[j] -= f_ij * z_ij;
+        }
+    }
+
+    double t_start = MPI_Wtime();
+    end_halo(domain, atom);
+    *t_wait += MPI_Wtime() - t_start;
+
+    // ghost pairs: the rank owning the ghost computes the other half
+    for (int i = 0; i < n_local; ++i)
+    {
+        for (int k = 0; k < domain->NN_ghost[i]; ++k)
+        {
+            int j = domain->NL_ghost[i * MN + k];
+            real x_ij = x[j] - x[i];
+            real y_ij = y[j] - y[i];
+            real z_ij = z[j] - z[i];
+            real r2 = x_ij*x_ij + y_ij*y_ij + z_ij*z_ij;
+            if (r2 > cutoff_square) { continue; }
+            real f_ij, e_ij;
+            potential.find(r2, &f_ij, &e_ij);
+            pe[i] += e_ij * 0.5;
+            fx[i] += f_ij * x_ij;
+            fy[i] += f_ij * y_ij;
+            fz[i] += f_ij * z_ij;
+        }
+    }
+}
+
+real sum_domain(Domain *domain, const real *x)
+{
+    double s = 0.0;
+    for (int n = 0; n < domain->num_local; ++n)
+    {
+        s += x[n];
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &s, 1, MPI_DOUBLE, MPI_SUM, domain->comm);
+    return s;
+}
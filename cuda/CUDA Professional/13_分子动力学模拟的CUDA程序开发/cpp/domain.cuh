@@ -0,0 +1,61 @@
+#pragma once
+#include "common.cuh"
+#include <mpi.h>
+
+#ifdef USE_DP
+    #define MPI_REAL_TYPE MPI_DOUBLE
+#else
+    #define MPI_REAL_TYPE MPI_FLOAT
+#endif
+
+// neighboring subdomains, face, edge and corner; offset 25 - o is opposite o
+#define NUM_OFFSETS 26
+
+// 3D domain decomposition: the box is cut into a periodic grid of ranks,
+// each owning the atoms in its part. Atoms within the list cutoff of a face,
+// edge or corner are sent as halo (ghost) atoms straight to the rank across
+// it, shifted when that rank lies across the periodic boundary, so that
+// lists and forces need no minimum image convention. An Atom holds the
+// local atoms in 0 .. num_local - 1 and the ghosts after them.
+struct Domain
+{
+    MPI_Comm comm;                  // periodic cartesian grid of ranks
+    int rank, num_ranks;
+    int dims[3], coords[3];
+    int offset[NUM_OFFSETS][3];     // -1, 0 or +1 subdomains per direction
+    int neighbor[NUM_OFFSETS];      // rank at each offset
+    real shift[NUM_OFFSETS][3];     // added to the atoms sent to each offset
+    real lo[3], hi[3];              // owned part of the box
+    int N;                          // atoms in the whole system
+    int MN;
+    int num_local, num_ghost, capacity;
+    int num_builds;
+    int *send_list[NUM_OFFSETS];    // local atoms sent to each offset
+    int send_count[NUM_OFFSETS], send_capacity[NUM_OFFSETS];
+    int recv_start[NUM_OFFSETS];    // ghosts from offset o, as sent by the
+    int recv_count[NUM_OFFSETS];    // rank at 25 - o: num_local + recv_start[o] ..
+    real *send_buffer, *recv_buffer;
+    int send_buffer_size, recv_buffer_size;
+    MPI_Request requests[2 * NUM_OFFSETS];
+    int *NN_ghost;                  // ghost neighbors of local atom i:
+    int *NL_ghost;                  // NL_ghost[i * MN .. + NN_ghost[i]]
+};
+
+// sets up the rank grid over MPI_COMM_WORLD and the FCC lattice atoms of
+// this rank, with velocities drawn per atom id, so that runs on any number
+// of ranks start alike; false if a subdomain is thinner than the list cutoff
+bool create_domain(int nx, real ax, real mass, real T_0, int MN, Domain *domain, Atom *atom);
+void destroy_domain(Domain *domain, Atom *atom);
+// migrates atoms that left the subdomain to their new owners, exchanges
+// the halo and builds the neighbor lists: atom->NL for local pairs (j > i),
+// NL_ghost for ghost neighbors
+void build_domain(Domain *domain, Atom *atom);
+// rebuilds once an atom on any rank has moved NEIGHBOR_SKIN / 2 since the
+// last build; returns 1 when it did
+int update_domain(Domain *domain, Atom *atom);
+// forces on the local atoms: the local pairs are computed while the ghost
+// positions are in flight, the ghost pairs after they arrived; t_wait gets
+// the time spent waiting for them
+void find_force_domain(Domain *domain, Atom *atom, double *t_wait);
+// sum of x over the local atoms of all ranks
+real sum_domain(Domain *domain, const real *x);
@@ -1,34 +1,33 @@
 #include "force.cuh"
 #include "mic.cuh"
+#include "potential.cuh"
+#include "cluster.cuh"
+#include "ghost.cuh"
+#include "neighbor.cuh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <omp.h>
 
-void find_force(int N, int MN, Atom *atom)
+static Force_Strategy force_strategy = FORCE_SERIAL;
+static int force_threads = 1;
+static Pair_Potential pair_potential = POTENTIAL_LJ;
+
+// pairs (i, j > i) of atoms i in [i0, i1), added to fx .. pe
+template <class Potential>
+static void find_force_half
+(
+    const Potential &potential, int i0, int i1, int MN, Atom *atom,
+    real *fx, real *fy, real *fz, real *pe
+)
 {
     int *NN = atom->NN;
     int *NL = atom->NL;
     real *x = atom->x;
     real *y = atom->y;
     real *z = atom->z;
-    real *fx = atom->fx;
-    real *fy = atom->fy;
-    real *fz = atom->fz;
-    real *pe = atom->pe;
     real *box = atom->box;
-    const real epsilon = 1.032e-2;
-    const real sigma = 3.405;
-    const real cutoff = 10.0;
-    const real cutoff_square = cutoff * cutoff;
-    const real sigma_3 = sigma * sigma * sigma;
-    const real sigma_6 = sigma_3 * sigma_3;
-    const real sigma_12 = sigma_6 * sigma_6;
-    const real e24s6 = 24.0 * epsilon * sigma_6; 
-    const real e48s12 = 48.0 * epsilon * sigma_12;
-    const real e4s6 = 4.0 * epsilon * sigma_6; 
-    const real e4s12 = 4.0 * epsilon * sigma_12;
-    for (int n = 0; n < N; ++n) 
-    { 
-        fx[n] = fy[n] = fz[n] = pe[n] = 0.0; 
-    }
-    for (int i = 0; i < N; ++i)
+    for (int i = i0; i < i1; ++i)
     {
         for (int k = 0; k < NN[i]; k++)
         {
@@ -40,14 +39,9 @@ void find_force(int N, int MN, Atom *atom)
             apply_mic(box, &x_ij, &y_ij, &z_ij);
             real r2 = x_ij*x_ij + y_ij*y_ij + z_ij*z_ij;
             if (r2 > cutoff_square) { continue; }
-            real r2inv = 1.0 / r2;
-            real r4inv = r2inv * r2inv;
-            real r6inv = r2inv * r4inv;
-            real r8inv = r4inv * r4inv;
-            real r12inv = r4inv * r8inv;
-            real r14inv = r6inv * r8inv;
-            real f_ij = e24s6 * r8inv - e48s12 * r14inv;
-            pe[i] += e4s12 * r12inv - e4s6 * r6inv;
+            real f_ij, e_ij;
+            potential.find(r2, &f_ij, &e_ij);
+            pe[i] += e_ij;
             fx[i] += f_ij * x_ij; fx[j] -= f_ij * x_ij;
             fy[i] += f_ij * y_ij; fy[j] -= f_ij * y_ij;
             fz[i] += f_ij * z_ij; fz[j] -= f_ij * z_ij;
@@ -55,3 +49,248 @@ void find_force(int N, int MN, Atom *atom)
     }
 }
 
+// both directions of the pairs of atoms i in [i0, i1), written to i only
+template <class Potential>
+static void find_force_full(const Potential &potential, int i0, int i1, int MN, Atom *atom)
+{
+    int *NN = atom->NN;
+    int *NL = atom->NL;
+    real *x = atom->x;
+    real *y = atom->y;
+    real *z = atom->z;
+    real *box = atom->box;
+    for (int i = i0; i < i1; ++i)
+    {
+        real fx_i = 0.0, fy_i = 0.0, fz_i = 0.0, pe_i = 0.0;
+        for (int k = 0; k < NN[i]; k++)
+        {
+            int j = NL[i * MN + k];
+            real x_ij = x[j] - x[i];
+            real y_ij = y[j] - y[i];
+            real z_ij = z[j] - z[i];
+            apply_mic(box, &x_ij, &y_ij, &z_ij);
+            real r2 = x_ij*x_ij + y_ij*y_ij + z_ij*z_ij;
+            if (r2 > cutoff_square) { continue; }
+            real f_ij, e_ij;
+            potential.find(r2, &f_ij, &e_ij);
+            pe_i += e_ij * 0.5;
+            fx_i += f_ij * x_ij;
+            fy_i += f_ij * y_ij;
+            fz_i += f_ij * z_ij;
+        }
+        atom->fx[i] = fx_i;
+        atom->fy[i] = fy_i;
+        atom->fz[i] = fz_i;
+        atom->pe[i] = pe_i;
+    }
+}
+
+// spatial blocks of the positions at the last neighbor list build, at least
+// one list cutoff wide, so that the neighbors of an atom lie in its block
+// or the 26 around it; blocks are numbered color by color
+struct Blocks
+{
+    int num_colors;
+    int color_start[28];  // blocks of color c: color_start[c] .. color_start[c + 1]
+    int *block_start;     // atoms of block b: block_atoms[block_start[b] .. block_start[b + 1]]
+    int *block_atoms;
+};
+
+static int find_block(real x, real box_length, int num_blocks)
+{
+    int b = (int) floor(x / box_length * num_blocks);
+    b %= num_blocks;
+    return b < 0 ? b + num_blocks : b;
+}
+
+static void build_blocks(int N, Atom *atom, Blocks *blocks)
+{
+    // a multiple of 3 blocks per direction (3 colors), or a single block that
+    // only ever writes to itself
+    int nb[3], colors[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        nb[d] = (int) floor(atom->box[d] / (FORCE_CUTOFF + NEIGHBOR_SKIN));
+        nb[d] = nb[d] >= 3 ? nb[d] - nb[d] % 3 : 1;
+        colors[d] = nb[d] >= 3 ? 3 : 1;
+    }
+    int num_blocks = nb[0] * nb[1] * nb[2];
+    blocks->num_colors = colors[0] * colors[1] * colors[2];
+
+    int *rank = (int*) malloc(num_blocks * sizeof(int));
+    int r = 0;
+    for (int c = 0; c < blocks->num_colors; ++c)
+    {
+        blocks->color_start[c] = r;
+        for (int b = 0; b < num_blocks; ++b)
+        {
+            int bx = b / (nb[1] * nb[2]), by = b / nb[2] % nb[1], bz = b % nb[2];
+            if ((bx % colors[0]) + colors[0] * ((by % colors[1]) + colors[1] * (bz % colors[2])) == c)
+            {
+                rank[b] = r++;
+            }
+        }
+    }
+    blocks->color_start[blocks->num_colors] = r;
+
+    int *atom_block = (int*) malloc(N * sizeof(int));
+    int *fill = (int*) calloc(num_blocks, sizeof(int));
+    blocks->block_start = (int*) calloc(num_blocks + 1, sizeof(int));
+    blocks->block_atoms = (int*) malloc(N * sizeof(int));
+    for (int n = 0; n < N; ++n)
+    {
+        int bx = find_block(atom->x0[n], atom->box[0], nb[0]);
+        int by = find_block(atom->y0[n], atom->box[1], nb[1]);
+        int bz = find_block(atom->z0[n], atom->box[2], nb[2]);
+        atom_block[n] = rank[(bx * nb[1] + by) * nb[2] + bz];
+        blocks->block_start[atom_block[n] + 1]++;
+    }
+    for (int b = 0; b < num_blocks; ++b)
+    {
+        blocks->block_start[b + 1] += blocks->block_start[b];
+    }
+    for (int n = 0; n < N; ++n)
+    {
+        blocks->block_atoms[blocks->block_start[atom_block[n]] + fill[atom_block[n]]++] = n;
+    }
+    free(rank);
+    free(atom_block);
+    free(fill);
+}
+
+// per-thread buffers of find_force_threaded, kept between steps
+static real **buffers = NULL;
+static int buffers_N = 0, buffers_count = 0;
+
+template <class Potential>
+static void find_force_threaded(const Potential &potential, int N, int MN, Atom *atom)
+{
+    if (force_strategy == FORCE_HALF_BUFFERS && (buffers_N != N || buffers_count < force_threads))
+    {
+        for (int s = 0; s < buffers_count; ++s) { free(buffers[s]); }
+        free(buffers);
+        buffers = (real**) malloc(force_threads * sizeof(real*));
+        for (int s = 0; s < force_threads; ++s)
+        {
+            buffers[s] = (real*) malloc(4 * N * sizeof(real));
+        }
+        buffers_N = N;
+        buffers_count = force_threads;
+    }
+    Blocks blocks;
+    if (force_strategy == FORCE_COLORED)
+    {
+        build_blocks(N, atom, &blocks);
+    }
+
+    #pragma omp parallel num_threads(force_threads)
+    {
+        int tid = omp_get_thread_num();
+        int num_threads = omp_get_num_threads();
+        int n0 = (long)N * tid / num_threads;
+        int n1 = (long)N * (tid + 1) / num_threads;
+
+        if (force_strategy == FORCE_FULL)
+        {
+            find_force_full(potential, n0, n1, MN, atom);
+        }
+        else if (force_strategy == FORCE_HALF_BUFFERS)
+        {
+            real *buffer = buffers[tid];
+            for (int n = 0; n < 4 * N; ++n) { buffer[n] = 0.0; }
+            find_force_half(potential, n0, n1, MN, atom, buffer, buffer + N, buffer + 2 * N, buffer + 3 * N);
+            #pragma omp barrier
+            for (int n = n0; n < n1; ++n)
+            {
+                real f[4] = {0.0, 0.0, 0.0, 0.0};
+                for (int s = 0; s < num_threads; ++s)
+                {
+                    for (int d = 0; d < 4; ++d) { f[d] += buffers[s][d * N + n]; }
+                }
+                atom->fx[n] = f[0];
+                atom->fy[n] = f[1];
+                atom->fz[n] = f[2];
+                atom->pe[n] = f[3];
+            }
+        }
+        else
+        {
+            for (int n = n0; n < n1; ++n)
+            {
+                atom->fx[n] = atom->fy[n] = atom->fz[n] = atom->pe[n] = 0.0;
+            }
+            for (int c = 0; c < blocks.num_colors; ++c)
+            {
+                #pragma omp barrier
+                for (int b = blocks.color_start[c] + tid; b < blocks.color_start[c + 1]; b += num_threads)
+                {
+                    for (int k = blocks.block_start[b]; k < blocks.block_start[b + 1]; ++k)
+                    {
+                        int i = blocks.block_atoms[k];
+                        find_force_half(potential, i, i + 1, MN, atom, atom->fx, atom->fy, atom->fz, atom->pe);
+                    }
+                }
+            }
+        }
+    }
+
+    if (force_strategy == FORCE_COLORED)
+    {
+        free(blocks.block_start);
+        free(blocks.block_atoms);
+    }
+}
+
+const char *force_strategy_name(Force_Strategy strategy)
+{
+    const char *names[] = {"serial", "full", "half", "colored", "cluster", "ghost"};
+    return names[strategy];
+}
+
+void set_force_strategy(Force_Strategy strategy, int num_threads)
+{
+    force_strategy = strategy;
+    force_threads = num_threads < 1 ? 1 : num_threads;
+    set_ghost_mode(strategy == FORCE_GHOST);
+}
+
+void set_pair_potential(Pair_Potential potential)
+{
+    pair_potential = potential;
+    // built here rather than on first use inside a parallel region
+    if (potential == POTENTIAL_TABLE) { tabulated_lj(); }
+}
+
+void find_force(int N, int MN, Atom *atom)
+{
+    if (force_strategy == FORCE_CLUSTER)
+    {
+        find_force_cluster(N, atom, force_threads, pair_potential);
+        return;
+    }
+    if (force_strategy == FORCE_GHOST)
+    {
+        find_force_ghost(N, MN, atom, pair_potential);
+        return;
+    }
+    if (force_strategy != FORCE_SERIAL)
+    {
+        with_pair_potential(pair_potential, [&](const auto &potential)
+        {
+            find_force_threaded(potential, N, MN, atom);
+        });
+        return;
+    }
+    real *fx = atom->fx;
+    real *fy = atom->fy;
+    real *fz = atom->fz;
+    real *pe = atom->pe;
+    for (int n = 0; n < N; ++n) 
+    { 
+        fx[n] = fy[n] = fz[n] = pe[n] = 0.0; 
+    }
+    with_pair_potential(pair_potential, [&](const auto &potential)
+    {
+        find_force_half(potential, 0, N, MN, atom, fx, fy, fz, pe);
+    });
+}
@@ -1,5 +1,29 @@
 #pragma once
 #include "common.cuh"
+#include "potential.cuh"
 
-void find_force(int N, int MN, Atom *atom);
+// how find_force splits the pairs across threads
+enum Force_Strategy
+{
+    FORCE_SERIAL,       // one thread over the half list (j > i), scattering to j
+    FORCE_FULL,         // each thread owns a range of atoms and visits both
+                        // directions of every pair, so nothing is scattered
+    FORCE_HALF_BUFFERS, // half list, each thread scattering into its own force
+                        // buffer, then a parallel sum of the buffers
+    FORCE_COLORED,      // half list over spatial blocks in 27 colors; blocks of
+                        // one color share no atoms and run in parallel
+    FORCE_CLUSTER,      // SIMD kernel over a half list of 8-atom cluster pairs,
+                        // adding each force to the i lane and, by Newton's
+                        // third law, the j lane of its thread's lane buffer;
+                        // the buffers are summed into the atoms (see cluster.cuh)
+    FORCE_GHOST         // one thread over a half list with explicit periodic
+                        // images instead of the minimum image (see ghost.cuh)
+};
 
+const char *force_strategy_name(Force_Strategy strategy);
+// selects the strategy and thread count used by find_force from now on; the
+// ghost strategy also switches find_neighbor to ghost mode, the others off it
+void set_force_strategy(Force_Strategy strategy, int num_threads);
+// selects the pair potential of find_force, LJ by default
+void set_pair_potential(Pair_Potential potential);
+void find_force(int N, int MN, Atom *atom);
@@ -0,0 +1,117 @@
+#include "common.cuh"
+#include "memory.cuh"
+#include "initialize.cuh"
+#include "neighbor.cuh"
+#include "force.cuh"
+#include "cluster.cuh"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+
+// wall-clock seconds per find_force call, after one untimed call that builds
+// the lists and buffers of the strategy just selected
+static double time_force(int N, int MN, Atom *atom, int repeat)
+{
+    find_force(N, MN, atom);
+    double start = omp_get_wtime();
+    for (int r = 0; r < repeat; ++r)
+    {
+        find_force(N, MN, atom);
+    }
+    return (omp_get_wtime() - start) / repeat;
+}
+
+static real max_difference(int N, const real *a, const real *b)
+{
+    real d = 0.0;
+    for (int n = 0; n < N; ++n) { d = fmax(d, fabs(a[n] - b[n])); }
+    return d;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 5)
+    {
+        printf("Usage: %s nx [num_threads [repeat [lj|lj-sf|morse|table]]]\n", argv[0]);
+        exit(1);
+    }
+    int nx = atoi(argv[1]);
+    int num_threads = argc > 2 ? atoi(argv[2]) : omp_get_num_procs();
+    int repeat = argc > 3 ? atoi(argv[3]) : 10;
+    int potential = 0;
+    while (argc > 4 && potential < NUM_POTENTIALS
+        && strcmp(argv[4], pair_potential_name((Pair_Potential) potential)) != 0) { potential++; }
+    if (potential == NUM_POTENTIALS)
+    {
+        printf("Unknown pair potential %s\n", argv[4]);
+        exit(1);
+    }
+    set_pair_potential((Pair_Potential) potential);
+    int N = 4 * nx * nx * nx;
+    int MN = 200;
+    real ax = 5.385;
+    Atom atom;
+    allocate_memory(N, MN, &atom);
+    for (int n = 0; n < N; ++n) { atom.m[n] = 40.0; }
+    initialize_position(nx, ax, &atom);
+    // move the atoms off the lattice, within the skin, so that not every pair is alike
+    for (int n = 0; n < N; ++n)
+    {
+        atom.x[n] += 0.2 * (rand() * 2.0 / RAND_MAX - 1.0);
+        atom.y[n] += 0.2 * (rand() * 2.0 / RAND_MAX - 1.0);
+        atom.z[n] += 0.2 * (rand() * 2.0 / RAND_MAX - 1.0);
+    }
+    find_neighbor(N, MN, &atom);
+
+    set_force_strategy(FORCE_SERIAL, 1);
+    double t_serial = time_force(N, MN, &atom, repeat);
+    real *reference = (real*) malloc(4 * N * sizeof(real));
+    real *arrays[4] = {atom.fx, atom.fy, atom.fz, atom.pe};
+    for (int d = 0; d < 4; ++d)
+    {
+        for (int n = 0; n < N; ++n) { reference[d * N + n] = arrays[d][n]; }
+    }
+    real pe_reference = 0.0;
+    for (int n = 0; n < N; ++n) { pe_reference += atom.pe[n]; }
+
+    printf("N = %d, %d threads, %s potential, serial find_force %g ms, %s cluster kernel\n",
+        N, num_threads, pair_potential_name((Pair_Potential) potential), t_serial * 1.0e3, cluster_kernel_isa());
+    printf("%10s %14s %14s %10s %12s\n", "strategy", "1 thread (ms)", "threads (ms)", "speedup", "efficiency");
+    Force_Strategy strategies[] = {FORCE_FULL, FORCE_HALF_BUFFERS, FORCE_COLORED, FORCE_CLUSTER, FORCE_GHOST};
+    for (int s = 0; s < 5; ++s)
+    {
+        set_force_strategy(strategies[s], 1);
+        double t_one = time_force(N, MN, &atom, repeat);
+        if (strategies[s] == FORCE_GHOST)
+        {
+            // single-threaded: a threads column would only repeat the 1 thread one
+            printf("%10s %14g %14s %10.2f %12s\n", force_strategy_name(strategies[s]),
+                t_one * 1.0e3, "-", t_serial / t_one, "-");
+        }
+        else
+        {
+            set_force_strategy(strategies[s], num_threads);
+            double t_all = time_force(N, MN, &atom, repeat);
+            printf("%10s %14g %14g %10.2f %11.1f%%\n", force_strategy_name(strategies[s]),
+                t_one * 1.0e3, t_all * 1.0e3, t_serial / t_all, 100.0 * t_one / (num_threads * t_all));
+        }
+
+        // per-atom energies differ between half and full lists, their sum does not
+        real pe = 0.0;
+        for (int n = 0; n < N; ++n) { pe += atom.pe[n]; }
+        real error = 0.0;
+        for (int d = 0; d < 3; ++d)
+        {
+            error = fmax(error, max_difference(N, arrays[d], reference + d * N));
+        }
+        if (error > 1.0e-3 || fabs(pe - pe_reference) > 1.0e-3 * fabs(pe_reference))
+        {
+            printf("Error: %s forces differ from the serial ones by %g.\n", force_strategy_name(strategies[s]), error);
+        }
+    }
+    free(reference);
+    deallocate_memory(&atom);
+    return 0;
+}
@@ -0,0 +1,249 @@
+#include "ghost.cuh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+struct Ghosts
+{
+    int N;
+    int build;               // atom->num_builds the list was made at
+    int num_ghosts;
+    int capacity;            // entries allocated, atoms and ghosts
+    int *source;             // atom each entry copies (itself for n < N)
+    real *ox, *oy, *oz;      // offset of each entry from its source: the
+                             // wrapping of the atom plus the image shift
+    real *x, *y, *z;         // entry positions, refreshed every step
+    real *fx, *fy, *fz;
+    int *NN;                 // half list of atom i: NL[i * MN .. + NN[i]]
+    int *NL;
+};
+
+static Ghosts ghosts;
+
+static void reserve_entries(int count)
+{
+    if (count <= ghosts.capacity) { return; }
+    int capacity = count + count / 4;
+    ghosts.source = (int*) realloc(ghosts.source, capacity * sizeof(int));
+    real **arrays[] =
+    {
+        &ghosts.ox, &ghosts.oy, &ghosts.oz, &ghosts.x, &ghosts.y, &ghosts.z,
+        &ghosts.fx, &ghosts.fy, &ghosts.fz
+    };
+    for (int a = 0; a < 9; ++a)
+    {
+        *arrays[a] = (real*) realloc(*arrays[a], capacity * sizeof(real));
+    }
+    ghosts.capacity = capacity;
+}
+
+static void add_entry(int k, int source, real ox, real oy, real oz, Atom *atom)
+{
+    ghosts.source[k] = source;
+    ghosts.ox[k] = ox;
+    ghosts.oy[k] = oy;
+    ghosts.oz[k] = oz;
+    ghosts.x[k] = atom->x[source] + ox;
+    ghosts.y[k] = atom->y[source] + oy;
+    ghosts.z[k] = atom->z[source] + oz;
+}
+
+// image shifts (-1, 0 or +1 box lengths) a wrapped coordinate s may take:
+// +1 within the cutoff of the lower face, -1 within that of the upper one
+static int find_shifts(real s, real box_length, real cutoff, int *shifts)
+{
+    int count = 0;
+    shifts[count++] = 0;
+    if (s < cutoff) { shifts[count++] = 1; }
+    if (s >= box_length - cutoff) { shifts[count++] = -1; }
+    return count;
+}
+
+static int find_cell(real x, real lower, real width, int num_cells)
+{
+    int c = (int) floor((x - lower) / width);
+    return c < 0 ? 0 : c >= num_cells ? num_cells - 1 : c;
+}
+
+void find_neighbor_ghost(int N, int MN, Atom *atom)
+{
+    real *box = atom->box;
+    real cutoff = FORCE_CUTOFF + NEIGHBOR_SKIN;
+    real cutoff_square = cutoff * cutoff;
+    for (int n = 0; n < N; ++n) { atom->NN[n] = 0; }
+    if (ghosts.N != N)
+    {
+        free(ghosts.NN);
+        free(ghosts.NL);
+        ghosts.NN = (int*) malloc(N * sizeof(int));
+        ghosts.NL = (int*) malloc(N * MN * sizeof(int));
+        ghosts.N = N;
+    }
+
+    // atoms wrapped into the box first, then their images near the faces
+    reserve_entries(N);
+    for (int n = 0; n < N; ++n)
+    {
+        add_entry(n, n, -box[0] * floor(atom->x[n] / box[0]), -box[1] * floor(atom->y[n] / box[1]),
+            -box[2] * floor(atom->z[n] / box[2]), atom);
+    }
+    int count = N;
+    for (int n = 0; n < N; ++n)
+    {
+        int sx[3], sy[3], sz[3];
+        int nsx = find_shifts(ghosts.x[n], box[0], cutoff, sx);
+        int nsy = find_shifts(ghosts.y[n], box[1], cutoff, sy);
+        int nsz = find_shifts(ghosts.z[n], box[2], cutoff, sz);
+        for (int a = 0; a < nsx; ++a)
+        {
+            for (int b = 0; b < nsy; ++b)
+            {
+                for (int c = 0; c < nsz; ++c)
+                {
+                    if (a == 0 && b == 0 && c == 0) { continue; }
+                    reserve_entries(count + 1);
+                    add_entry(count++, n, ghosts.ox[n] + sx[a] * box[0], ghosts.oy[n] + sy[b] * box[1],
+                        ghosts.oz[n] + sz[c] * box[2], atom);
+                }
+            }
+        }
+    }
+    ghosts.num_ghosts = count - N;
+
+    // cells over the box and its halo, at least one cutoff wide, without
+    // periodic wrapping: the ghosts stand in for the periodic neighbors
+    int nc[3];
+    real width[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        nc[d] = (int) floor((box[d] + 2.0 * cutoff) / cutoff);
+        width[d] = (box[d] + 2.0 * cutoff) / nc[d];
+    }
+    int num_cells = nc[0] * nc[1] * nc[2];
+    int *entry_cell = (int*) malloc(count * sizeof(int));
+    int *cell_start = (int*) calloc(num_cells + 1, sizeof(int));
+    int *cell_fill = (int*) calloc(num_cells, sizeof(int));
+    int *cell_entries = (int*) malloc(count * sizeof(int));
+    for (int k = 0; k < count; ++k)
+    {
+        int cx = find_cell(ghosts.x[k], -cutoff, width[0], nc[0]);
+        int cy = find_cell(ghosts.y[k], -cutoff, width[1], nc[1]);
+        int cz = find_cell(ghosts.z[k], -cutoff, width[2], nc[2]);
+        entry_cell[k] = (cx * nc[1] + cy) * nc[2] + cz;
+        cell_start[entry_cell[k] + 1]++;
+    }
+    for (int c = 0; c < num_cells; ++c)
+    {
+        cell_start[c + 1] += cell_start[c];
+    }
+    for (int k = 0; k < count; ++k)
+    {
+        cell_entries[cell_start[entry_cell[k]] + cell_fill[entry_cell[k]]++] = k;
+    }
+
+    for (int n1 = 0; n1 < N; ++n1)
+    {
+        ghosts.NN[n1] = 0;
+        int c = entry_cell[n1];
+        int cx = c / (nc[1] * nc[2]);
+        int cy = c / nc[2] % nc[1];
+        int cz = c % nc[2];
+        for (int x2 = cx > 0 ? cx - 1 : 0; x2 <= cx + 1 && x2 < nc[0]; ++x2)
+        {
+            for (int y2 = cy > 0 ? cy - 1 : 0; y2 <= cy + 1 && y2 < nc[1]; ++y2)
+            {
+                for (int z2 = cz > 0 ? cz - 1 : 0; z2 <= cz + 1 && z2 < nc[2]; ++z2)
+                {
+                    int c2 = (x2 * nc[1] + y2) * nc[2] + z2;
+                    for (int k = cell_start[c2]; k < cell_start[c2 + 1]; ++k)
+                    {
+                        // each periodic pair once: (n1, n2) for n2 > n1, or
+                        // n1 with a ghost of an atom after it
+                        int n2 = cell_entries[k];
+                        if (ghosts.source[n2] <= n1) { continue; }
+                        real x12 = ghosts.x[n2] - ghosts.x[n1];
+                        real y12 = ghosts.y[n2] - ghosts.y[n1];
+                        real z12 = ghosts.z[n2] - ghosts.z[n1];
+                        if (x12*x12 + y12*y12 + z12*z12 < cutoff_square)
+                        {
+                            if (ghosts.NN[n1] == MN)
+                            {
+                                printf("Error: MN is too small.\n");
+                                exit(1);
+                            }
+                            ghosts.NL[n1 * MN + ghosts.NN[n1]++] = n2;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    ghosts.build = atom->num_builds;
+
+    free(entry_cell);
+    free(cell_start);
+    free(cell_fill);
+    free(cell_entries);
+}
+
+template <class Potential>
+static void find_force_entries(const Potential &potential, int N, int MN, Atom *atom)
+{
+    int count = N + ghosts.num_ghosts;
+    const int *source = ghosts.source;
+    real *x = ghosts.x, *y = ghosts.y, *z = ghosts.z;
+    real *fx = ghosts.fx, *fy = ghosts.fy, *fz = ghosts.fz;
+    real *pe = atom->pe;
+    for (int k = 0; k < count; ++k)
+    {
+        x[k] = atom->x[source[k]] + ghosts.ox[k];
+        y[k] = atom->y[source[k]] + ghosts.oy[k];
+        z[k] = atom->z[source[k]] + ghosts.oz[k];
+        fx[k] = fy[k] = fz[k] = 0.0;
+    }
+    for (int i = 0; i < N; ++i)
+    {
+        pe[i] = 0.0;
+        for (int k = 0; k < ghosts.NN[i]; ++k)
+        {
+            int j = ghosts.NL[i * MN + k];
+            real x_ij = x[j] - x[i];
+            real y_ij = y[j] - y[i];
+            real z_ij = z[j] - z[i];
+            real r2 = x_ij*x_ij + y_ij*y_ij + z_ij*z_ij;
+            if (r2 > cutoff_square) { continue; }
+            real f_ij, e_ij;
+            potential.find(r2, &f_ij, &e_ij);
+            pe[i] += e_ij;
+            fx[i] += f_ij * x_ij; fx[j] -= f_ij * x_ij;
+            fy[i] += f_ij * y_ij; fy[j] -= f_ij * y_ij;
+            fz[i] += f_ij * z_ij; fz[j] -= f_ij * z_ij;
+        }
+    }
+
+    // ghost forces fold back onto the atoms they image
+    for (int k = N; k < count; ++k)
+    {
+        fx[source[k]] += fx[k];
+        fy[source[k]] += fy[k];
+        fz[source[k]] += fz[k];
+    }
+    for (int n = 0; n < N; ++n)
+    {
+        atom->fx[n] = fx[n];
+        atom->fy[n] = fy[n];
+        atom->fz[n] = fz[n];
+    }
+}
+
+void find_force_ghost(int N, int MN, Atom *atom, Pair_Potential pair_potential)
+{
+    if (ghosts.N != N || ghosts.build != atom->num_builds)
+    {
+        find_neighbor_ghost(N, MN, atom);
+    }
+    with_pair_potential(pair_potential, [&](const auto &potential)
+    {
+        find_force_entries(potential, N, MN, atom);
+    });
+}
@@ -0,0 +1,16 @@
+#pragma once
+#include "common.cuh"
+#include "potential.cuh"
+
+// Ghost (halo) mode: atoms within the list cutoff of a box face are copied as
+// explicit periodic images, so that the neighbor list and the force loop work
+// with plain coordinate differences and no minimum image convention. Entries
+// N .. N + num_ghosts - 1 of the list are ghosts, whose forces are folded
+// back onto the atoms they image.
+
+// builds the ghosts and a half list (j > i, or a ghost of an atom j > i)
+// from the current positions; atom->NL is left empty
+void find_neighbor_ghost(int N, int MN, Atom *atom);
+// serial half-list forces over the ghost list, rebuilt first if the atom
+// list has been rebuilt or the atoms sorted since
+void find_force_ghost(int N, int MN, Atom *atom, Pair_Potential potential);
@@ -1,9 +1,34 @@
 #include "integrate.cuh"
 #include "force.cuh"
+#include "neighbor.cuh"
+#include "checkpoint.cuh"
+#include "output.cuh"
 #include "error.cuh"
 #include <stdio.h>
 #include <math.h>
-#include <time.h>
+#include <omp.h>
+
+static const char *checkpoint_file = NULL;
+static int checkpoint_interval = 0;
+static unsigned int checkpoint_seed = 0;
+
+void set_checkpoint(const char *file, int interval, unsigned int seed)
+{
+    checkpoint_file = file;
+    checkpoint_interval = interval;
+    checkpoint_seed = seed;
+}
+
+static const char *trajectory_file = NULL;
+static int trajectory_stride = 0;
+static int trajectory_flags = 0;
+
+void set_trajectory(const char *file, int stride, int flags)
+{
+    trajectory_file = file;
+    trajectory_stride = stride;
+    trajectory_flags = flags;
+}
 
 static real sum(int N, real *x)
 {
@@ -75,6 +100,7 @@ void equilibration
     for (int step = 0; step < Ne; ++step)
     { 
         integrate(N, time_step, atom, 1);
+        update_neighbor(N, MN, atom);
         find_force(N, MN, atom);
         integrate(N, time_step, atom, 2);
         scale_velocity(N, T_0, atom);
@@ -83,41 +109,62 @@ void equilibration
 
 void production
 (
-    int Np, int Ns, int N, int MN, real T_0, 
+    int first_step, int Np, int Ns, int N, int MN, real T_0, 
     real time_step, Atom *atom
 )
 {
     float t_force = 0.0f;
+    float t_neighbor = 0.0f;
+    int num_rebuilds = 0;
 
-    clock_t t_total_start = clock();
+    double t_total_start = omp_get_wtime();
 
-    FILE *fid = fopen("energy.txt", "w");
-    for (int step = 0; step < Np; ++step)
+    open_output("energy.txt", trajectory_stride > 0 ? trajectory_file : NULL, trajectory_stride,
+        trajectory_flags, N, atom->box, Ns, first_step);
+    for (int step = first_step; step < Np; ++step)
     {
         integrate(N, time_step, atom, 1);
 
-        clock_t t_force_start = clock();
+        double t_neighbor_start = omp_get_wtime();
+
+        num_rebuilds += update_neighbor(N, MN, atom);
+
+        double t_neighbor_stop = omp_get_wtime();
+
+        t_neighbor += t_neighbor_stop - t_neighbor_start;
+
+        double t_force_start = omp_get_wtime();
 
         find_force(N, MN, atom);
 
-        clock_t t_force_stop = clock();
+        double t_force_stop = omp_get_wtime();
 
-        t_force += float(t_force_stop - t_force_start) / CLOCKS_PER_SEC;
+        t_force += t_force_stop - t_force_start;
 
         integrate(N, time_step, atom, 2);
 
-        if (0 == step % Ns)
+        output_step(step, 0 == step % Ns, trajectory_stride > 0 && 0 == step % trajectory_stride, N, atom);
+
+        if (checkpoint_interval > 0 && (step + 1) % checkpoint_interval == 0 && step + 1 < Np)
         {
-            fprintf(fid, "%g %g\n", sum(N, atom->ke), sum(N, atom->pe));
+            // a restart from the checkpoint keeps the output before it
+            drain_output();
+            write_checkpoint_async(checkpoint_file, step + 1, checkpoint_seed, N, MN, atom);
         }
     }
-    fclose(fid);
+    close_output();
+    if (checkpoint_interval > 0)
+    {
+        write_checkpoint(checkpoint_file, Np, checkpoint_seed, N, MN, atom);
+    }
 
-    clock_t t_total_stop = clock();
+    double t_total_stop = omp_get_wtime();
 
-    float t_total = float(t_total_stop - t_total_start) / CLOCKS_PER_SEC;
+    float t_total = t_total_stop - t_total_start;
     printf("Time used for production = %g s\n", t_total);
     printf("Time used for force part = %g s\n", t_force);
+    printf("Time used for neighbor part = %g s (%d rebuilds)\n", t_neighbor, num_rebuilds);
+    printf("Time waiting for the output writer = %g s\n", output_wait_time());
 }
 
 
@@ -7,9 +7,21 @@ void equilibration
     real time_step, Atom *atom
 );
 
+// runs production steps first_step .. Np - 1, first_step > 0 continuing
+// from a checkpoint; energy.txt and the trajectory then continue those of
+// the earlier run
 void production
 (
-    int Np, int Ns, int N, int MN, real T_0, 
+    int first_step, int Np, int Ns, int N, int MN, real T_0, 
     real time_step, Atom *atom
 );
 
+// makes production write a checkpoint (checkpoint.cuh) to file every
+// interval steps, in the background, and once more at its end; 0, the
+// default, never does. seed is recorded for the velocities drawn with it
+void set_checkpoint(const char *file, int interval, unsigned int seed);
+
+// makes production write a binary trajectory (output.cuh) to file every
+// stride steps, with OUTPUT_VELOCITIES and OUTPUT_QUANTIZED flags; 0, the
+// default, writes none
+void set_trajectory(const char *file, int stride, int flags);
@@ -0,0 +1,14 @@
+#pragma once
+#include "common.cuh"
+
+// Lennard-Jones parameters of argon, in eV and angstrom
+const real epsilon = 1.032e-2;
+const real sigma = 3.405;
+const real cutoff_square = FORCE_CUTOFF * FORCE_CUTOFF;
+const real sigma_3 = sigma * sigma * sigma;
+const real sigma_6 = sigma_3 * sigma_3;
+const real sigma_12 = sigma_6 * sigma_6;
+const real e24s6 = 24.0 * epsilon * sigma_6; 
+const real e48s12 = 48.0 * epsilon * sigma_12;
+const real e4s6 = 4.0 * epsilon * sigma_6; 
+const real e4s12 = 4.0 * epsilon * sigma_12;
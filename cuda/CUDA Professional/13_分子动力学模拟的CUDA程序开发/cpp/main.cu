@@ -3,8 +3,14 @@
 #include "initialize.cuh"
 #include "neighbor.cuh"
 #include "integrate.cuh"
+#include "force.cuh"
+#include "reorder.cuh"
+#include "checkpoint.cuh"
+#include "output.cuh"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <omp.h>
 
 int main(int argc, char **argv)
 {
@@ -12,9 +18,35 @@ int main(int argc, char **argv)
     int Ne = 20000;
     int Np = 20000;
 
-    if (argc != 3) 
+    // --checkpoint interval writes checkpoint.bin every interval production
+    // steps; --restart continues production from it, without equilibration;
+    // --trajectory stride writes trajectory.bin every stride steps, with
+    // velocities after --velocities, 16-bit quantized after --quantize;
+    // --potential lj|lj-sf|morse|table selects the pair potential
+    const char *checkpoint_file = "checkpoint.bin";
+    int checkpoint_interval = 0;
+    bool restart = false;
+    int trajectory_stride = 0;
+    int trajectory_flags = 0;
+    const char *potential_name = pair_potential_name(POTENTIAL_LJ);
+    int num_args = 1;
+    for (int a = 1; a < argc; ++a)
+    {
+        if (strcmp(argv[a], "--restart") == 0) { restart = true; }
+        else if (strcmp(argv[a], "--checkpoint") == 0 && a + 1 < argc) { checkpoint_interval = atoi(argv[++a]); }
+        else if (strcmp(argv[a], "--trajectory") == 0 && a + 1 < argc) { trajectory_stride = atoi(argv[++a]); }
+        else if (strcmp(argv[a], "--velocities") == 0) { trajectory_flags |= OUTPUT_VELOCITIES; }
+        else if (strcmp(argv[a], "--quantize") == 0) { trajectory_flags |= OUTPUT_QUANTIZED; }
+        else if (strcmp(argv[a], "--potential") == 0 && a + 1 < argc) { potential_name = argv[++a]; }
+        else { argv[num_args++] = argv[a]; }
+    }
+    argc = num_args;
+
+    if (argc < 3 || argc > 6) 
     { 
-        printf("Usage: %s nx Ne\n", argv[0]);
+        printf("Usage: %s nx Ne [num_threads [serial|full|half|colored|cluster|ghost [sort_interval]]]"
+            " [--checkpoint interval] [--restart] [--trajectory stride [--velocities] [--quantize]]"
+            " [--potential lj|lj-sf|morse|table]\n", argv[0]);
         exit(1);
     }
     else
@@ -23,6 +55,34 @@ int main(int argc, char **argv)
         Ne = atoi(argv[2]);
         Np = Ne;
     }
+    int num_threads = argc > 3 ? atoi(argv[3]) : 1;
+    Force_Strategy strategy = num_threads > 1 ? FORCE_HALF_BUFFERS : FORCE_SERIAL;
+    if (argc > 4)
+    {
+        Force_Strategy strategies[] = {FORCE_SERIAL, FORCE_FULL, FORCE_HALF_BUFFERS, FORCE_COLORED, FORCE_CLUSTER, FORCE_GHOST};
+        int s = 0;
+        while (s < 6 && strcmp(argv[4], force_strategy_name(strategies[s])) != 0) { s++; }
+        if (s == 6)
+        {
+            printf("Unknown force strategy %s\n", argv[4]);
+            exit(1);
+        }
+        strategy = strategies[s];
+    }
+    set_force_strategy(strategy, num_threads);
+    int p = 0;
+    while (p < NUM_POTENTIALS && strcmp(potential_name, pair_potential_name((Pair_Potential) p)) != 0) { p++; }
+    if (p == NUM_POTENTIALS)
+    {
+        printf("Unknown pair potential %s\n", potential_name);
+        exit(1);
+    }
+    set_pair_potential((Pair_Potential) p);
+    printf("Force strategy = %s, %d threads, %s potential\n", force_strategy_name(strategy), num_threads, potential_name);
+    // atoms are put in Morton order before every sort_interval-th neighbor
+    // list rebuild, 0 for never
+    int sort_interval = argc > 5 ? atoi(argv[5]) : 0;
+    set_sort_interval(sort_interval);
 
     int N = 4 * nx * nx * nx;
     int Ns = 100;
@@ -30,14 +90,32 @@ int main(int argc, char **argv)
     real T_0 = 60.0;
     real ax = 5.385;
     real time_step = 5.0 / TIME_UNIT_CONVERSION;
+    unsigned int seed = 1;
     Atom atom;
     allocate_memory(N, MN, &atom);
-    for (int n = 0; n < N; ++n) { atom.m[n] = 40.0; }
-    initialize_position(nx, ax, &atom);
-    initialize_velocity(N, T_0, &atom);
-    find_neighbor(N, MN, &atom);
-    equilibration(Ne, N, MN, T_0, time_step, &atom);
-    production(Np, Ns, N, MN, T_0, time_step, &atom);
+    int first_step = 0;
+    if (restart)
+    {
+        double t_start = omp_get_wtime();
+        long long step;
+        if (!read_checkpoint(checkpoint_file, N, MN, &atom, &step, &seed)) { exit(1); }
+        first_step = (int) step;
+        printf("Restarted from %s at step %d in %g ms\n", checkpoint_file, first_step,
+            (omp_get_wtime() - t_start) * 1.0e3);
+    }
+    else
+    {
+        srand(seed);
+        for (int n = 0; n < N; ++n) { atom.m[n] = 40.0; }
+        initialize_position(nx, ax, &atom);
+        initialize_velocity(N, T_0, &atom);
+        find_neighbor(N, MN, &atom);
+        if (sort_interval > 0) { sort_atoms(N, MN, &atom); }
+        equilibration(Ne, N, MN, T_0, time_step, &atom);
+    }
+    set_checkpoint(checkpoint_file, checkpoint_interval, seed);
+    set_trajectory("trajectory.bin", trajectory_stride, trajectory_flags);
+    production(first_step, Np, Ns, N, MN, T_0, time_step, &atom);
     deallocate_memory(&atom);
     return 0;
 }
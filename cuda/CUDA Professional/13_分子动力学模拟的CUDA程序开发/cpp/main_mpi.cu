@@ -0,0 +1,129 @@
+#include "common.cuh"
+#include "domain.cuh"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+static void scale_velocity(Domain *domain, real T_0, Atom *atom)
+{
+    real temperature = sum_domain(domain, atom->ke) / (1.5 * K_B * domain->N);
+    real scale_factor = sqrt(T_0 / temperature);
+    for (int n = 0; n < domain->num_local; ++n)
+    {
+        atom->vx[n] *= scale_factor;
+        atom->vy[n] *= scale_factor;
+        atom->vz[n] *= scale_factor;
+    }
+}
+
+static void integrate(int N, real time_step, Atom *atom, int flag)
+{
+    real time_step_half = time_step * 0.5;
+    for (int n = 0; n < N; ++n)
+    {
+        real mass_inv = 1.0 / atom->m[n];
+        atom->vx[n] += atom->fx[n] * mass_inv * time_step_half;
+        atom->vy[n] += atom->fy[n] * mass_inv * time_step_half;
+        atom->vz[n] += atom->fz[n] * mass_inv * time_step_half;
+        if (flag == 1)
+        {
+            atom->x[n] += atom->vx[n] * time_step;
+            atom->y[n] += atom->vy[n] * time_step;
+            atom->z[n] += atom->vz[n] * time_step;
+        }
+        else
+        {
+            real v2 = atom->vx[n]*atom->vx[n] + atom->vy[n]*atom->vy[n] + atom->vz[n]*atom->vz[n];
+            atom->ke[n] = atom->m[n] * v2 * 0.5;
+        }
+    }
+}
+
+// the same run as ljmd with the box split over the MPI ranks, e.g.
+// mpirun -np 8 ./ljmd_mpi 10 20000
+int main(int argc, char **argv)
+{
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+    if (argc != 3)
+    {
+        if (rank == 0) { printf("Usage: mpirun -np P %s nx Ne\n", argv[0]); }
+        MPI_Finalize();
+        exit(1);
+    }
+    int nx = atoi(argv[1]);
+    int Ne = atoi(argv[2]);
+    int Np = Ne;
+    int Ns = 100;
+    int MN = 200;
+    real T_0 = 60.0;
+    real ax = 5.385;
+    real time_step = 5.0 / TIME_UNIT_CONVERSION;
+
+    Domain domain;
+    Atom atom;
+    if (!create_domain(nx, ax, 40.0, T_0, MN, &domain, &atom))
+    {
+        MPI_Finalize();
+        exit(1);
+    }
+    if (rank == 0)
+    {
+        printf("N = %d on %d ranks (%d x %d x %d)\n", domain.N, domain.num_ranks,
+            domain.dims[0], domain.dims[1], domain.dims[2]);
+    }
+    build_domain(&domain, &atom);
+
+    double t_wait = 0.0;
+    find_force_domain(&domain, &atom, &t_wait);
+    for (int step = 0; step < Ne; ++step)
+    {
+        integrate(domain.num_local, time_step, &atom, 1);
+        update_domain(&domain, &atom);
+        find_force_domain(&domain, &atom, &t_wait);
+        integrate(domain.num_local, time_step, &atom, 2);
+        scale_velocity(&domain, T_0, &atom);
+    }
+
+    double t_force = 0.0;
+    double t_neighbor = 0.0;
+    int num_rebuilds = 0;
+    t_wait = 0.0;
+    double t_total_start = MPI_Wtime();
+    FILE *fid = rank == 0 ? fopen("energy.txt", "w") : NULL;
+    for (int step = 0; step < Np; ++step)
+    {
+        integrate(domain.num_local, time_step, &atom, 1);
+
+        double t_neighbor_start = MPI_Wtime();
+        num_rebuilds += update_domain(&domain, &atom);
+        t_neighbor += MPI_Wtime() - t_neighbor_start;
+
+        double t_force_start = MPI_Wtime();
+        find_force_domain(&domain, &atom, &t_wait);
+        t_force += MPI_Wtime() - t_force_start;
+
+        integrate(domain.num_local, time_step, &atom, 2);
+
+        if (0 == step % Ns)
+        {
+            // collective: every rank takes part, rank 0 writes
+            real ke = sum_domain(&domain, atom.ke);
+            real pe = sum_domain(&domain, atom.pe);
+            if (rank == 0) { fprintf(fid, "%g %g\n", ke, pe); }
+        }
+    }
+    if (rank == 0) { fclose(fid); }
+    double t_total = MPI_Wtime() - t_total_start;
+
+    if (rank == 0)
+    {
+        printf("Time used for production = %g s\n", t_total);
+        printf("Time used for force part = %g s (%g s waiting for the halo)\n", t_force, t_wait);
+        printf("Time used for neighbor part = %g s (%d rebuilds)\n", t_neighbor, num_rebuilds);
+    }
+    destroy_domain(&domain, &atom);
+    MPI_Finalize();
+    return 0;
+}
@@ -18,6 +18,12 @@ void allocate_memory(int N, int MN, Atom *atom)
     atom->pe = (real*) malloc(N * sizeof(real));
     atom->ke = (real*) malloc(N * sizeof(real));
     atom->box = (real*) malloc(6 * sizeof(real));
+    atom->x0 = (real*) malloc(N * sizeof(real));
+    atom->y0 = (real*) malloc(N * sizeof(real));
+    atom->z0 = (real*) malloc(N * sizeof(real));
+    atom->id = (int*) malloc(N * sizeof(int));
+    for (int n = 0; n < N; ++n) { atom->id[n] = n; }
+    atom->num_builds = 0;
 }
 
 void deallocate_memory(Atom *atom)
@@ -37,5 +43,9 @@ void deallocate_memory(Atom *atom)
     free(atom->pe);
     free(atom->ke);
     free(atom->box);
+    free(atom->x0);
+    free(atom->y0);
+    free(atom->z0);
+    free(atom->id);
 }
 
@@ -1,9 +1,40 @@
 #include "neighbor.cuh"
 #include "mic.cuh"
+#include "reorder.cuh"
+#include "ghost.cuh"
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
-void find_neighbor(int N, int MN, Atom *atom)
+static const real cutoff = FORCE_CUTOFF + NEIGHBOR_SKIN;
+// update_neighbor sorts the atoms before every sort_interval-th rebuild
+static int sort_interval = 0;
+static int rebuilds_since_sort = 0;
+// find_neighbor builds the ghost list (ghost.cuh) instead of atom->NL
+static int ghost_mode = 0;
+
+static void add_neighbor(int MN, int *NN, int *NL, int n1, int n2)
+{
+    if (NN[n1] == MN)
+    {
+        printf("Error: MN is too small.\n");
+        exit(1);
+    }
+    NL[n1 * MN + NN[n1]++] = n2;
+}
+
+static void save_positions(int N, Atom *atom)
+{
+    for (int n = 0; n < N; ++n)
+    {
+        atom->x0[n] = atom->x[n];
+        atom->y0[n] = atom->y[n];
+        atom->z0[n] = atom->z[n];
+    }
+    atom->num_builds++;
+}
+
+void find_neighbor_all_pairs(int N, int MN, Atom *atom)
 {
     int *NN = atom->NN;
     int *NL = atom->NL;
@@ -11,7 +42,6 @@ void find_neighbor(int N, int MN, Atom *atom)
     real *y = atom->y;
     real *z = atom->z;
     real *box = atom->box; 
-    real cutoff = 11.0;
     real cutoff_square = cutoff * cutoff;
 
     for (int n = 0; n < N; n++)
@@ -31,19 +61,148 @@ void find_neighbor(int N, int MN, Atom *atom)
 
             if (d_square < cutoff_square)
             {        
-                NL[n1 * MN + NN[n1]++] = n2;
-                NL[n2 * MN + NN[n2]++] = n1;
+                add_neighbor(MN, NN, NL, n1, n2);
+                add_neighbor(MN, NN, NL, n2, n1);
             }
         }
     }
+    save_positions(N, atom);
+}
 
-    for (int n1 = 0; n1 < N - 1; n1++)
+// cell index along one direction, wrapping atoms that drifted out of the box
+static int find_cell(real x, real box_length, int num_cells)
+{
+    int c = (int) floor(x / box_length * num_cells);
+    c %= num_cells;
+    return c < 0 ? c + num_cells : c;
+}
+
+void find_neighbor(int N, int MN, Atom *atom)
+{
+    int *NN = atom->NN;
+    int *NL = atom->NL;
+    real *x = atom->x;
+    real *y = atom->y;
+    real *z = atom->z;
+    real *box = atom->box; 
+    real cutoff_square = cutoff * cutoff;
+
+    if (ghost_mode)
+    {
+        save_positions(N, atom);
+        find_neighbor_ghost(N, MN, atom);
+        return;
+    }
+
+    // cells at least one cutoff wide; with fewer than 3 per direction
+    // the 27 neighboring cells would overlap
+    int nc[3];
+    for (int d = 0; d < 3; ++d)
+    {
+        nc[d] = (int) floor(box[d] / cutoff);
+    }
+    if (nc[0] < 3 || nc[1] < 3 || nc[2] < 3)
+    {
+        find_neighbor_all_pairs(N, MN, atom);
+        return;
+    }
+    int num_cells = nc[0] * nc[1] * nc[2];
+
+    // bin the atoms: cell_atoms[cell_start[c] .. cell_start[c + 1]) are in cell c
+    int *atom_cell = (int*) malloc(N * sizeof(int));
+    int *cell_start = (int*) calloc(num_cells + 1, sizeof(int));
+    int *cell_fill = (int*) calloc(num_cells, sizeof(int));
+    int *cell_atoms = (int*) malloc(N * sizeof(int));
+    for (int n = 0; n < N; ++n)
+    {
+        int cx = find_cell(x[n], box[0], nc[0]);
+        int cy = find_cell(y[n], box[1], nc[1]);
+        int cz = find_cell(z[n], box[2], nc[2]);
+        atom_cell[n] = (cx * nc[1] + cy) * nc[2] + cz;
+        cell_start[atom_cell[n] + 1]++;
+    }
+    for (int c = 0; c < num_cells; ++c)
     {
-        if (NN[n1] > MN)
+        cell_start[c + 1] += cell_start[c];
+    }
+    for (int n = 0; n < N; ++n)
+    {
+        cell_atoms[cell_start[atom_cell[n]] + cell_fill[atom_cell[n]]++] = n;
+    }
+
+    for (int n1 = 0; n1 < N; ++n1)
+    {
+        NN[n1] = 0;
+        int c = atom_cell[n1];
+        int cx = c / (nc[1] * nc[2]);
+        int cy = c / nc[2] % nc[1];
+        int cz = c % nc[2];
+        for (int dx = -1; dx <= 1; ++dx)
         {
-            printf("Error: MN is too small.\n");
-            exit(1);
+            for (int dy = -1; dy <= 1; ++dy)
+            {
+                for (int dz = -1; dz <= 1; ++dz)
+                {
+                    int c2 = (((cx + dx + nc[0]) % nc[0]) * nc[1]
+                        + (cy + dy + nc[1]) % nc[1]) * nc[2]
+                        + (cz + dz + nc[2]) % nc[2];
+                    for (int k = cell_start[c2]; k < cell_start[c2 + 1]; ++k)
+                    {
+                        int n2 = cell_atoms[k];
+                        if (n2 == n1) { continue; }
+                        real x12 = x[n2] - x[n1];
+                        real y12 = y[n2] - y[n1];
+                        real z12 = z[n2] - z[n1];
+                        apply_mic(box, &x12, &y12, &z12);
+                        real d_square = x12*x12 + y12*y12 + z12*z12;
+                        if (d_square < cutoff_square)
+                        {
+                            add_neighbor(MN, NN, NL, n1, n2);
+                        }
+                    }
+                }
+            }
         }
-    } 
+    }
+
+    free(atom_cell);
+    free(cell_start);
+    free(cell_fill);
+    free(cell_atoms);
+    save_positions(N, atom);
+}
+
+int update_neighbor(int N, int MN, Atom *atom)
+{
+    // the list holds every pair within the force cutoff until two atoms
+    // have closed the skin between them, i.e. until one moved skin / 2
+    real limit_square = NEIGHBOR_SKIN * NEIGHBOR_SKIN * 0.25;
+    for (int n = 0; n < N; ++n)
+    {
+        real dx = atom->x[n] - atom->x0[n];
+        real dy = atom->y[n] - atom->y0[n];
+        real dz = atom->z[n] - atom->z0[n];
+        if (dx*dx + dy*dy + dz*dz > limit_square)
+        {
+            if (sort_interval > 0 && ++rebuilds_since_sort == sort_interval)
+            {
+                sort_atoms(N, MN, atom);
+                rebuilds_since_sort = 0;
+            }
+            find_neighbor(N, MN, atom);
+            return 1;
+        }
+    }
+    return 0;
 }
 
+void set_sort_interval(int rebuilds)
+{
+    sort_interval = rebuilds;
+    rebuilds_since_sort = 0;
+}
+
+void set_ghost_mode(int enabled)
+{
+    ghost_mode = enabled;
+}
@@ -1,4 +1,16 @@
 #pragma once
 #include "common.cuh"
 
+// linked-cell builder, O(N); small boxes fall back to all pairs
 void find_neighbor(int N, int MN, Atom *atom);
+// O(N^2) loop over all pairs
+void find_neighbor_all_pairs(int N, int MN, Atom *atom);
+// rebuilds the list once an atom has moved more than NEIGHBOR_SKIN / 2
+// since the last build; returns 1 when it did
+int update_neighbor(int N, int MN, Atom *atom);
+// makes update_neighbor put the atoms in Morton order (sort_atoms) before
+// every given number of rebuilds; 0, the default, never sorts
+void set_sort_interval(int rebuilds);
+// makes find_neighbor build ghost atoms and their list (ghost.cuh) in place
+// of atom->NL, for find_force_ghost
+void set_ghost_mode(int enabled);
@@ -0,0 +1,82 @@
+#include "common.cuh"
+#include "memory.cuh"
+#include "initialize.cuh"
+#include "neighbor.cuh"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static int compare_int(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// the builders list the neighbors of an atom in different orders
+static bool same_lists(int N, int MN, const int *NN, int *NL, const int *NN_ref, int *NL_ref)
+{
+    for (int n = 0; n < N; ++n)
+    {
+        if (NN[n] != NN_ref[n]) { return false; }
+        qsort(NL + n * MN, NN[n], sizeof(int), compare_int);
+        qsort(NL_ref + n * MN, NN[n], sizeof(int), compare_int);
+        if (memcmp(NL + n * MN, NL_ref + n * MN, NN[n] * sizeof(int)) != 0) { return false; }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    int nx_list[] = {5, 10, 15, 20, 30};
+    int num_nx = sizeof(nx_list) / sizeof(int);
+    int *nx_values = nx_list;
+    if (argc > 1)
+    {
+        num_nx = argc - 1;
+        nx_values = (int*) malloc(num_nx * sizeof(int));
+        for (int i = 0; i < num_nx; ++i) { nx_values[i] = atoi(argv[i + 1]); }
+    }
+
+    int MN = 200;
+    real ax = 5.385;
+    // the all-pairs builder is skipped above this many atoms
+    int N_all_pairs = 40000;
+    printf("%6s %10s %16s %16s\n", "nx", "N", "all pairs (s)", "cell list (s)");
+    for (int i = 0; i < num_nx; ++i)
+    {
+        int nx = nx_values[i];
+        int N = 4 * nx * nx * nx;
+        Atom atom;
+        allocate_memory(N, MN, &atom);
+        initialize_position(nx, ax, &atom);
+
+        clock_t t_start = clock();
+        find_neighbor(N, MN, &atom);
+        float t_cell = float(clock() - t_start) / CLOCKS_PER_SEC;
+
+        if (N > N_all_pairs)
+        {
+            printf("%6d %10d %16s %16g\n", nx, N, "-", t_cell);
+        }
+        else
+        {
+            int *NN_cell = atom.NN;
+            int *NL_cell = atom.NL;
+            atom.NN = (int*) malloc(N * sizeof(int));
+            atom.NL = (int*) malloc(N * MN * sizeof(int));
+            t_start = clock();
+            find_neighbor_all_pairs(N, MN, &atom);
+            float t_all = float(clock() - t_start) / CLOCKS_PER_SEC;
+            printf("%6d %10d %16g %16g\n", nx, N, t_all, t_cell);
+            if (!same_lists(N, MN, NN_cell, NL_cell, atom.NN, atom.NL))
+            {
+                printf("Error: the cell list differs from the all-pairs list.\n");
+            }
+            free(NN_cell);
+            free(NL_cell);
+        }
+        deallocate_memory(&atom);
+    }
+    if (nx_values != nx_list) { free(nx_values); }
+    return 0;
+}
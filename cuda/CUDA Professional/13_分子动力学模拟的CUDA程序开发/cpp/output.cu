@@ -0,0 +1,333 @@
+#include "output.cuh"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// one step handed to the writer
+struct Snapshot
+{
+    int step;
+    bool energy, trajectory;
+    real ke, pe;
+    real *r[6];         // x, y, z, vx, vy, vz; velocities with OUTPUT_VELOCITIES
+};
+
+struct Output
+{
+    FILE *energy_fid;
+    FILE *trajectory_fid;
+    int N, flags;
+    real box[3];
+    Snapshot snapshots[2];
+    int num_ready;      // snapshots filled and not yet written
+    int next_fill, next_write;
+    bool stopping;
+    char *staging;      // one trajectory frame, formatted
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::thread writer;
+    double wait_time;
+};
+
+static Output output;
+
+static int num_arrays()
+{
+    return output.flags & OUTPUT_VELOCITIES ? 6 : 3;
+}
+
+static size_t frame_bytes()
+{
+    size_t value_size = output.flags & OUTPUT_QUANTIZED ? sizeof(uint16_t) : sizeof(float);
+    size_t bytes = sizeof(int64_t) + (size_t) num_arrays() * output.N * value_size;
+    if ((output.flags & (OUTPUT_QUANTIZED | OUTPUT_VELOCITIES)) == (OUTPUT_QUANTIZED | OUTPUT_VELOCITIES))
+    {
+        bytes += sizeof(float);
+    }
+    return bytes;
+}
+
+static void write_trajectory_frame(const Snapshot *s)
+{
+    int N = output.N;
+    char *p = output.staging;
+    int64_t step = s->step;
+    memcpy(p, &step, sizeof(step));
+    p += sizeof(step);
+    if (!(output.flags & OUTPUT_QUANTIZED))
+    {
+        for (int a = 0; a < num_arrays(); ++a)
+        {
+            float *values = (float*) p;
+            for (int n = 0; n < N; ++n) { values[n] = (float) s->r[a][n]; }
+            p += N * sizeof(float);
+        }
+    }
+    else
+    {
+        float scale = 1.0f;
+        if (output.flags & OUTPUT_VELOCITIES)
+        {
+            real v_max = 0.0;
+            for (int d = 3; d < 6; ++d)
+            {
+                for (int n = 0; n < N; ++n) { v_max = fmax(v_max, fabs(s->r[d][n])); }
+            }
+            if (v_max > 0.0) { scale = v_max / 32767.0; }
+            memcpy(p, &scale, sizeof(scale));
+            p += sizeof(scale);
+        }
+        for (int d = 0; d < 3; ++d)
+        {
+            uint16_t *values = (uint16_t*) p;
+            real box_length = output.box[d];
+            for (int n = 0; n < N; ++n)
+            {
+                real fraction = s->r[d][n] / box_length;
+                fraction -= floor(fraction);
+                int q = (int) (fraction * 65536.0 + 0.5);
+                values[n] = (uint16_t) (q & 0xFFFF);
+            }
+            p += N * sizeof(uint16_t);
+        }
+        if (output.flags & OUTPUT_VELOCITIES)
+        {
+            for (int d = 3; d < 6; ++d)
+            {
+                int16_t *values = (int16_t*) p;
+                for (int n = 0; n < N; ++n) { values[n] = (int16_t) lrint(s->r[d][n] / scale); }
+                p += N * sizeof(int16_t);
+            }
+        }
+    }
+    fwrite(output.staging, 1, p - output.staging, output.trajectory_fid);
+}
+
+static void write_loop()
+{
+    std::unique_lock<std::mutex> lock(output.mutex);
+    while (true)
+    {
+        output.changed.wait(lock, [] { return output.num_ready > 0 || output.stopping; });
+        if (output.num_ready == 0) { break; }
+        // the snapshot being written is not touched by output_step until
+        // num_ready drops
+        Snapshot *s = &output.snapshots[output.next_write];
+        lock.unlock();
+        if (s->energy)
+        {
+            fprintf(output.energy_fid, "%g %g\n", s->ke, s->pe);
+            fflush(output.energy_fid);
+        }
+        if (s->trajectory)
+        {
+            write_trajectory_frame(s);
+            fflush(output.trajectory_fid);
+        }
+        lock.lock();
+        output.next_write ^= 1;
+        output.num_ready--;
+        output.changed.notify_all();
+    }
+}
+
+// cuts file to bytes and reopens it for appending with mode
+static FILE *truncate_for_append(const char *file, long bytes, const char *mode)
+{
+    FILE *fid = fopen(file, "r+b");
+    if (fid == NULL) { return NULL; }
+#ifdef _WIN32
+    bool ok = _chsize_s(_fileno(fid), bytes) == 0;
+#else
+    bool ok = ftruncate(fileno(fid), bytes) == 0;
+#endif
+    fclose(fid);
+    return ok ? fopen(file, mode) : NULL;
+}
+
+// bytes of the first num_lines complete lines of file, fewer if it is
+// shorter; -1 if it cannot be read
+static long line_bytes(const char *file, int num_lines)
+{
+    FILE *fid = fopen(file, "rb");
+    if (fid == NULL) { return -1; }
+    long bytes = 0, position = 0;
+    int c, lines = 0;
+    while (lines < num_lines && (c = fgetc(fid)) != EOF)
+    {
+        ++position;
+        if (c == '\n') { ++lines; bytes = position; }
+    }
+    fclose(fid);
+    return bytes;
+}
+
+// bytes of the header and the frames before first_step of a trajectory
+// written with the same N, flags and stride; -1 if there is none such
+static long trajectory_bytes(const char *file, int stride, int first_step)
+{
+    FILE *fid = fopen(file, "rb");
+    if (fid == NULL) { return -1; }
+    Trajectory_Header header;
+    if (fread(&header, sizeof(header), 1, fid) != 1
+        || memcmp(header.magic, "LJMDTRAJ", sizeof(header.magic)) != 0 || header.version != 1
+        || header.N != output.N || header.flags != output.flags || header.stride != stride)
+    {
+        fclose(fid);
+        return -1;
+    }
+    long frame = (long) frame_bytes();
+    fseek(fid, 0, SEEK_END);
+    long num_frames = (ftell(fid) - (long) sizeof(header)) / frame;
+    long k = 0;
+    for (; k < num_frames; ++k)
+    {
+        int64_t step;
+        fseek(fid, (long) sizeof(header) + k * frame, SEEK_SET);
+        if (fread(&step, sizeof(step), 1, fid) != 1 || step >= first_step) { break; }
+    }
+    fclose(fid);
+    return (long) sizeof(header) + k * frame;
+}
+
+void open_output(const char *energy_file, const char *trajectory_file, int stride, int flags, int N, const real *box,
+    int energy_stride, int first_step)
+{
+    output.energy_fid = NULL;
+    output.trajectory_fid = NULL;
+    output.N = N;
+    output.flags = flags;
+    for (int d = 0; d < 3; ++d) { output.box[d] = box[d]; }
+    if (first_step > 0)
+    {
+        long bytes = line_bytes(energy_file, (first_step + energy_stride - 1) / energy_stride);
+        if (bytes >= 0) { output.energy_fid = truncate_for_append(energy_file, bytes, "a"); }
+    }
+    if (output.energy_fid == NULL) { output.energy_fid = fopen(energy_file, "w"); }
+    int arrays = 0;
+    if (trajectory_file != NULL)
+    {
+        if (first_step > 0)
+        {
+            long bytes = trajectory_bytes(trajectory_file, stride, first_step);
+            if (bytes >= 0) { output.trajectory_fid = truncate_for_append(trajectory_file, bytes, "ab"); }
+        }
+        if (output.trajectory_fid == NULL)
+        {
+            output.trajectory_fid = fopen(trajectory_file, "wb");
+            if (output.trajectory_fid == NULL)
+            {
+                printf("Error: cannot open %s for writing.\n", trajectory_file);
+                exit(1);
+            }
+            Trajectory_Header header;
+            memset(&header, 0, sizeof(header));
+            memcpy(header.magic, "LJMDTRAJ", sizeof(header.magic));
+            header.version = 1;
+            header.N = N;
+            header.flags = flags;
+            header.stride = stride;
+            for (int d = 0; d < 3; ++d) { header.box[d] = box[d]; }
+            fwrite(&header, sizeof(header), 1, output.trajectory_fid);
+        }
+        output.staging = (char*) malloc(frame_bytes());
+        arrays = num_arrays();
+    }
+    for (int b = 0; b < 2; ++b)
+    {
+        for (int a = 0; a < 6; ++a)
+        {
+            output.snapshots[b].r[a] = a < arrays ? (real*) malloc(N * sizeof(real)) : NULL;
+        }
+    }
+    output.num_ready = 0;
+    output.next_fill = output.next_write = 0;
+    output.stopping = false;
+    output.wait_time = 0.0;
+    output.writer = std::thread(write_loop);
+}
+
+void output_step(int step, bool energy, bool trajectory, int N, Atom *atom)
+{
+    trajectory = trajectory && output.trajectory_fid != NULL;
+    if (!energy && !trajectory) { return; }
+    std::unique_lock<std::mutex> lock(output.mutex);
+    if (output.num_ready == 2)
+    {
+        auto start = std::chrono::steady_clock::now();
+        output.changed.wait(lock, [] { return output.num_ready < 2; });
+        output.wait_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    Snapshot *s = &output.snapshots[output.next_fill];
+    lock.unlock();
+
+    s->step = step;
+    s->energy = energy;
+    s->trajectory = trajectory;
+    if (energy)
+    {
+        real ke = 0.0, pe = 0.0;
+        for (int n = 0; n < N; ++n)
+        {
+            ke += atom->ke[n];
+            pe += atom->pe[n];
+        }
+        s->ke = ke;
+        s->pe = pe;
+    }
+    if (trajectory)
+    {
+        real *r[6] = {atom->x, atom->y, atom->z, atom->vx, atom->vy, atom->vz};
+        for (int a = 0; a < num_arrays(); ++a) { memcpy(s->r[a], r[a], N * sizeof(real)); }
+    }
+
+    lock.lock();
+    output.next_fill ^= 1;
+    output.num_ready++;
+    output.changed.notify_all();
+}
+
+void drain_output()
+{
+    std::unique_lock<std::mutex> lock(output.mutex);
+    if (output.num_ready == 0) { return; }
+    auto start = std::chrono::steady_clock::now();
+    output.changed.wait(lock, [] { return output.num_ready == 0; });
+    output.wait_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void close_output()
+{
+    {
+        std::lock_guard<std::mutex> lock(output.mutex);
+        output.stopping = true;
+        output.changed.notify_all();
+    }
+    output.writer.join();
+    fclose(output.energy_fid);
+    if (output.trajectory_fid != NULL)
+    {
+        fclose(output.trajectory_fid);
+        free(output.staging);
+    }
+    for (int b = 0; b < 2; ++b)
+    {
+        for (int a = 0; a < 6; ++a) { free(output.snapshots[b].r[a]); }
+    }
+}
+
+double output_wait_time()
+{
+    return output.wait_time;
+}
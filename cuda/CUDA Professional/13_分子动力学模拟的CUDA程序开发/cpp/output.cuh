@@ -0,0 +1,45 @@
+#pragma once
+#include "common.cuh"
+
+// Output of production: energy.txt lines and an optional binary trajectory,
+// formatted and written by a dedicated thread. A step copies the data into
+// one of two snapshot buffers and returns; the integrator waits only when
+// the writer is still busy with both, which output_wait_time reports.
+//
+// Trajectory file: a Trajectory_Header, then per frame the step (int64) and
+// for each of x, y, z (and vx, vy, vz with OUTPUT_VELOCITIES) N values:
+// - float, positions as integrated (not wrapped), or with OUTPUT_QUANTIZED
+// - uint16 positions wrapped into the box, in units of box / 65536, and
+//   int16 velocities in units of a float per-frame scale written after the
+//   step (max |v| / 32767)
+
+#define OUTPUT_VELOCITIES 1
+#define OUTPUT_QUANTIZED 2
+
+struct Trajectory_Header
+{
+    char magic[8];      // "LJMDTRAJ"
+    int version;        // 1
+    int N;
+    int flags;          // OUTPUT_VELOCITIES | OUTPUT_QUANTIZED
+    int stride;         // steps between frames
+    float box[3];
+    int reserved;
+};
+
+// starts the writer; trajectory_file NULL for energies only. With first_step
+// > 0, a run restarted there, the files of the earlier run are kept up to
+// first_step and appended to: energy_file cut to the lines of the steps
+// before it (one per energy_stride steps), trajectory_file, if its header
+// matches, to the frames before it
+void open_output(const char *energy_file, const char *trajectory_file, int stride, int flags, int N, const real *box,
+    int energy_stride, int first_step);
+// hands step over to the writer: the ke and pe sums for energy, the
+// coordinates for trajectory
+void output_step(int step, bool energy, bool trajectory, int N, Atom *atom);
+// waits until the writer has written (and flushed) every step handed over
+void drain_output();
+// writes what is pending and stops the writer
+void close_output();
+// seconds output_step spent waiting for a free buffer since open_output
+double output_wait_time();
@@ -0,0 +1,58 @@
+#include "potential.cuh"
+#include <stdlib.h>
+
+const char *pair_potential_name(Pair_Potential potential)
+{
+    const char *names[] = {"lj", "lj-sf", "morse", "table"};
+    return names[potential];
+}
+
+// LJ energy and dU/ds at s = r^2, in double precision
+static double lj_energy(double s)
+{
+    double r6inv = 1.0 / (s * s * s);
+    return 4.0 * epsilon * (sigma_12 * r6inv * r6inv - sigma_6 * r6inv);
+}
+
+static double lj_derivative(double s)
+{
+    double r6inv = 1.0 / (s * s * s);
+    return (-24.0 * sigma_12 * r6inv * r6inv + 12.0 * sigma_6 * r6inv) * epsilon / s;
+}
+
+// from 0.8 sigma, where the energy is 40 epsilon, to the list cutoff
+static const int TABLE_INTERVALS = 4096;
+static const double TABLE_R_MIN = 0.8 * sigma;
+
+static Tabulated_Potential table;
+static real *table_data = NULL;
+
+const Tabulated_Potential &tabulated_lj()
+{
+    if (table_data != NULL) { return table; }
+    int n = TABLE_INTERVALS;
+    double s_0 = TABLE_R_MIN * TABLE_R_MIN;
+    double s_1 = (FORCE_CUTOFF + NEIGHBOR_SKIN) * (FORCE_CUTOFF + NEIGHBOR_SKIN);
+    double ds = (s_1 - s_0) / n;
+    table_data = (real*) malloc(4 * n * sizeof(real));
+    real *e[4];
+    for (int c = 0; c < 4; ++c) { e[c] = table_data + c * n; }
+    // cubic Hermite interpolation of the energy and its derivative at the knots
+    for (int k = 0; k < n; ++k)
+    {
+        double u0 = lj_energy(s_0 + k * ds), u1 = lj_energy(s_0 + (k + 1) * ds);
+        double d0 = lj_derivative(s_0 + k * ds) * ds, d1 = lj_derivative(s_0 + (k + 1) * ds) * ds;
+        e[0][k] = u0;
+        e[1][k] = d0;
+        e[2][k] = 3.0 * (u1 - u0) - 2.0 * d0 - d1;
+        e[3][k] = 2.0 * (u0 - u1) + d0 + d1;
+    }
+    table.s_0 = s_0;
+    table.inv_ds = 1.0 / ds;
+    table.num_intervals = n;
+    table.e0 = e[0];
+    table.e1 = e[1];
+    table.e2 = e[2];
+    table.e3 = e[3];
+    return table;
+}
@@ -0,0 +1,153 @@
+#pragma once
+#include "common.cuh"
+#include "lj.cuh"
+#include <math.h>
+
+// Pair potentials as compile-time policies of the force loops. find(r2, &f_ij,
+// &e_ij) gives, for a pair at distance^2 r2 within the cutoff, the force over
+// r (f_ij, the force on i being f_ij * r_ij with r_ij = r_j - r_i) and the
+// energy. Each potential is written once over an Ops type: Scalar_Ops below
+// for the plain loops, the SIMD cluster kernel passing its vector operations
+// (cluster.cu). The loops are templates over the potential, instantiated for
+// each one, and find_force picks the instance once per call.
+
+enum Pair_Potential
+{
+    POTENTIAL_LJ,               // Lennard-Jones, cut at FORCE_CUTOFF
+    POTENTIAL_LJ_SHIFTED_FORCE, // LJ with energy and force shifted to 0 at the cutoff
+    POTENTIAL_MORSE,            // Morse with the LJ well depth, minimum and curvature
+    POTENTIAL_TABLE,            // cubic Hermite spline of LJ in r^2
+    NUM_POTENTIALS
+};
+
+const char *pair_potential_name(Pair_Potential potential);
+
+// one pair at a time
+struct Scalar_Ops
+{
+    typedef real T;
+    typedef int I;
+    static inline T set1(real a) { return a; }
+    static inline T add(T a, T b) { return a + b; }
+    static inline T sub(T a, T b) { return a - b; }
+    static inline T mul(T a, T b) { return a * b; }
+    static inline T div(T a, T b) { return a / b; }
+    static inline T fmadd(T a, T b, T c) { return a * b + c; }
+    static inline T fmsub(T a, T b, T c) { return a * b - c; }
+    static inline T sqrt(T a) { return ::sqrt(a); }
+    static inline T exp(T a) { return ::exp(a); }
+    static inline T min(T a, T b) { return fmin(a, b); }
+    static inline T max(T a, T b) { return fmax(a, b); }
+    static inline T floor(T a) { return ::floor(a); }
+    static inline I to_index(T a) { return (int) a; }
+    static inline T gather(const real *table, I i) { return table[i]; }
+};
+
+struct Lennard_Jones
+{
+    template <class Ops = Scalar_Ops>
+    inline void find(typename Ops::T r2, typename Ops::T *f_ij, typename Ops::T *e_ij) const
+    {
+        typedef typename Ops::T T;
+        T r2inv = Ops::div(Ops::set1(1.0), r2);
+        T r4inv = Ops::mul(r2inv, r2inv);
+        T r6inv = Ops::mul(r2inv, r4inv);
+        T r8inv = Ops::mul(r4inv, r4inv);
+        T r12inv = Ops::mul(r4inv, r8inv);
+        T r14inv = Ops::mul(r6inv, r8inv);
+        *f_ij = Ops::fmsub(Ops::set1(e24s6), r8inv, Ops::mul(Ops::set1(e48s12), r14inv));
+        *e_ij = Ops::fmsub(Ops::set1(e4s12), r12inv, Ops::mul(Ops::set1(e4s6), r6inv));
+    }
+};
+
+// U(r) - U(r_c) - (r - r_c) U'(r_c): no jump in energy or force at the cutoff
+struct Shifted_Force_LJ
+{
+    real e_c;       // U(r_c)
+    real de_c;      // U'(r_c)
+
+    Shifted_Force_LJ()
+    {
+        real f_c;
+        Lennard_Jones().find(cutoff_square, &f_c, &e_c);
+        de_c = f_c * FORCE_CUTOFF;
+    }
+
+    template <class Ops = Scalar_Ops>
+    inline void find(typename Ops::T r2, typename Ops::T *f_ij, typename Ops::T *e_ij) const
+    {
+        typedef typename Ops::T T;
+        T f, e;
+        Lennard_Jones().find<Ops>(r2, &f, &e);
+        T r = Ops::sqrt(r2);
+        *f_ij = Ops::sub(f, Ops::div(Ops::set1(de_c), r));
+        *e_ij = Ops::sub(e, Ops::fmadd(Ops::sub(r, Ops::set1(FORCE_CUTOFF)), Ops::set1(de_c), Ops::set1(e_c)));
+    }
+};
+
+// D (x^2 - 2 x) with x = exp(-a (r - r_0)); a = 6 / r_0 matches the LJ
+// curvature at the minimum
+struct Morse
+{
+    real depth, width, r_0;
+
+    Morse() : depth(epsilon), width(6.0 / (1.122462048309373 * sigma)), r_0(1.122462048309373 * sigma) {}
+
+    template <class Ops = Scalar_Ops>
+    inline void find(typename Ops::T r2, typename Ops::T *f_ij, typename Ops::T *e_ij) const
+    {
+        typedef typename Ops::T T;
+        T r = Ops::sqrt(r2);
+        T x = Ops::exp(Ops::mul(Ops::set1(-width), Ops::sub(r, Ops::set1(r_0))));
+        *e_ij = Ops::mul(Ops::mul(Ops::set1(depth), x), Ops::sub(x, Ops::set1(2.0)));
+        // U'(r) = -2 a D (x^2 - x)
+        T de = Ops::mul(Ops::mul(Ops::set1(-2.0 * width * depth), x), Ops::sub(x, Ops::set1(1.0)));
+        *f_ij = Ops::div(de, r);
+    }
+};
+
+// U as a cubic in t within each of num_intervals equal steps of s = r^2 from
+// s_0, e = ((e3 t + e2) t + e1) t + e0, and f = U'(r) / r = 2 dU/ds from the
+// same four coefficients; s is clamped to the table, which reaches the list
+// cutoff, so that masked SIMD lanes read valid entries
+struct Tabulated_Potential
+{
+    real s_0, inv_ds;
+    int num_intervals;
+    const real *e0, *e1, *e2, *e3;
+
+    template <class Ops = Scalar_Ops>
+    inline void find(typename Ops::T r2, typename Ops::T *f_ij, typename Ops::T *e_ij) const
+    {
+        typedef typename Ops::T T;
+        T s = Ops::mul(Ops::sub(r2, Ops::set1(s_0)), Ops::set1(inv_ds));
+        s = Ops::min(Ops::max(s, Ops::set1(0.0)), Ops::set1(num_intervals - 1));
+        T s_floor = Ops::floor(s);
+        typename Ops::I k = Ops::to_index(s_floor);
+        T t = Ops::sub(s, s_floor);
+        T c1 = Ops::gather(e1, k), c2 = Ops::gather(e2, k), c3 = Ops::gather(e3, k);
+        T e = Ops::fmadd(Ops::fmadd(c3, t, c2), t, c1);
+        *e_ij = Ops::fmadd(e, t, Ops::gather(e0, k));
+        // 2 dU/ds = 2 / ds (3 e3 t^2 + 2 e2 t + e1)
+        T f = Ops::fmadd(Ops::fmadd(Ops::mul(Ops::set1(3.0), c3), t, Ops::add(c2, c2)), t, c1);
+        *f_ij = Ops::mul(f, Ops::set1(2.0 * inv_ds));
+    }
+};
+
+// the table of Lennard_Jones, built on first use
+const Tabulated_Potential &tabulated_lj();
+
+// calls kernel(p) with the policy object p of potential, so that a kernel
+// template is instantiated for every potential and the choice is made once
+// per call rather than per pair
+template <class Kernel>
+inline void with_pair_potential(Pair_Potential potential, const Kernel &kernel)
+{
+    switch (potential)
+    {
+        case POTENTIAL_LJ_SHIFTED_FORCE: kernel(Shifted_Force_LJ()); break;
+        case POTENTIAL_MORSE: kernel(Morse()); break;
+        case POTENTIAL_TABLE: kernel(tabulated_lj()); break;
+        default: kernel(Lennard_Jones()); break;
+    }
+}
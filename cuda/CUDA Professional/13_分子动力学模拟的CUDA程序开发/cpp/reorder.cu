@@ -0,0 +1,133 @@
+#include "reorder.cuh"
+#include <stdlib.h>
+#include <math.h>
+
+// bits per direction of the Morton key of a position within its cell
+#define MORTON_BITS 10
+
+struct Sort_Entry
+{
+    unsigned long long key;
+    int n;
+};
+
+static int compare_key(const void *a, const void *b)
+{
+    const Sort_Entry *ea = (const Sort_Entry*) a;
+    const Sort_Entry *eb = (const Sort_Entry*) b;
+    if (ea->key != eb->key) { return ea->key < eb->key ? -1 : 1; }
+    return ea->n - eb->n;
+}
+
+// the low MORTON_BITS bits of v moved to every third bit
+static unsigned int spread_bits(unsigned int v)
+{
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v << 8)) & 0x0300F00F;
+    v = (v | (v << 4)) & 0x030C30C3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+static unsigned int grid_index(real s, int num_points)
+{
+    int i = (int) (s * num_points);
+    return i < 0 ? 0 : i >= num_points ? num_points - 1 : i;
+}
+
+// sort key: the index of the linked cell holding the position, numbered as
+// in find_neighbor, then the Morton key of the position within the cell.
+// With whole cells contiguous, every neighboring cell lies wholly before or
+// after an atom and the j > i test of the half-list force loop stays
+// predictable; numbering the cells along a Morton curve too was slower for
+// breaking that test up into 27 runs
+static unsigned long long sort_key(const real *position, const real *box)
+{
+    unsigned long long cell = 0, fine = 0;
+    for (int d = 0; d < 3; ++d)
+    {
+        int num_cells = (int) floor(box[d] / (FORCE_CUTOFF + NEIGHBOR_SKIN));
+        if (num_cells < 1) { num_cells = 1; }
+        real s = position[d] / box[d];
+        s = (s - floor(s)) * num_cells;
+        unsigned int c = grid_index(s / num_cells, num_cells);
+        cell = cell * num_cells + c;
+        fine |= (unsigned long long) spread_bits(grid_index(s - c, 1 << MORTON_BITS)) << d;
+    }
+    return cell << (3 * MORTON_BITS) | fine;
+}
+
+// array[n] = old array[order[n]]; the old array becomes the scratch
+static void permute(int N, const int *order, real **array, real **scratch)
+{
+    real *a = *array, *s = *scratch;
+    for (int n = 0; n < N; ++n) { s[n] = a[order[n]]; }
+    *array = s;
+    *scratch = a;
+}
+
+static void permute(int N, const int *order, int **array, int **scratch)
+{
+    int *a = *array, *s = *scratch;
+    for (int n = 0; n < N; ++n) { s[n] = a[order[n]]; }
+    *array = s;
+    *scratch = a;
+}
+
+void sort_atoms(int N, int MN, Atom *atom)
+{
+    Sort_Entry *entries = (Sort_Entry*) malloc(N * sizeof(Sort_Entry));
+    for (int n = 0; n < N; ++n)
+    {
+        real position[3] = {atom->x[n], atom->y[n], atom->z[n]};
+        entries[n].key = sort_key(position, atom->box);
+        entries[n].n = n;
+    }
+    qsort(entries, N, sizeof(Sort_Entry), compare_key);
+
+    // order[new] = old, rank[old] = new
+    int *order = (int*) malloc(N * sizeof(int));
+    int *rank = (int*) malloc(N * sizeof(int));
+    for (int n = 0; n < N; ++n)
+    {
+        order[n] = entries[n].n;
+        rank[entries[n].n] = n;
+    }
+
+    real *scratch = (real*) malloc(N * sizeof(real));
+    real **arrays[] =
+    {
+        &atom->m, &atom->x, &atom->y, &atom->z, &atom->vx, &atom->vy, &atom->vz,
+        &atom->fx, &atom->fy, &atom->fz, &atom->pe, &atom->ke, &atom->x0, &atom->y0, &atom->z0
+    };
+    for (int a = 0; a < (int) (sizeof(arrays) / sizeof(arrays[0])); ++a)
+    {
+        permute(N, order, arrays[a], &scratch);
+    }
+    free(scratch);
+
+    int *int_scratch = (int*) malloc(N * sizeof(int));
+    permute(N, order, &atom->id, &int_scratch);
+    free(int_scratch);
+
+    // rows move with their atoms, entries are renumbered
+    int *NL = (int*) malloc(N * MN * sizeof(int));
+    for (int n = 0; n < N; ++n)
+    {
+        int old = order[n];
+        for (int k = 0; k < atom->NN[old]; ++k)
+        {
+            NL[n * MN + k] = rank[atom->NL[old * MN + k]];
+        }
+    }
+    free(atom->NL);
+    atom->NL = NL;
+    int_scratch = (int*) malloc(N * sizeof(int));
+    permute(N, order, &atom->NN, &int_scratch);
+    free(int_scratch);
+
+    atom->num_builds++;
+    free(entries);
+    free(order);
+    free(rank);
+}
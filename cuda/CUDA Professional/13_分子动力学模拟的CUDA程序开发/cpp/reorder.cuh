@@ -0,0 +1,8 @@
+#pragma once
+#include "common.cuh"
+
+// permutes every per-atom array into cell order, and Morton (Z-curve) order
+// within each linked cell, so that atoms close in space sit close in memory
+// whatever order the run has left them in; the entries of the neighbor list,
+// which must have been built, are renumbered to match
+void sort_atoms(int N, int MN, Atom *atom);
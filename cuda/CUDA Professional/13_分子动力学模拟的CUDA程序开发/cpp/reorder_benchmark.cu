@@ -0,0 +1,143 @@
+#include "common.cuh"
+#include "memory.cuh"
+#include "initialize.cuh"
+#include "neighbor.cuh"
+#include "integrate.cuh"
+#include "force.cuh"
+#include "reorder.cuh"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <omp.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// hardware cache miss counters of this process, where the OS grants them
+enum Counter {L1D_MISSES, LLC_MISSES, NUM_COUNTERS};
+static const char *counter_names[NUM_COUNTERS] = {"L1D misses/step", "LLC misses/step"};
+
+struct Counters
+{
+    int fd[NUM_COUNTERS];
+    long long value[NUM_COUNTERS];
+};
+
+static void start_counters(Counters *c)
+{
+#ifdef __linux__
+    unsigned long long configs[NUM_COUNTERS] =
+    {
+        PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+        PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+    };
+    for (int i = 0; i < NUM_COUNTERS; ++i)
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        c->fd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (c->fd[i] >= 0)
+        {
+            ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#else
+    for (int i = 0; i < NUM_COUNTERS; ++i) { c->fd[i] = -1; }
+#endif
+}
+
+static void stop_counters(Counters *c)
+{
+    for (int i = 0; i < NUM_COUNTERS; ++i)
+    {
+        c->value[i] = -1;
+#ifdef __linux__
+        if (c->fd[i] < 0) { continue; }
+        ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(c->fd[i], &c->value[i], sizeof(long long)) != sizeof(long long)) { c->value[i] = -1; }
+        close(c->fd[i]);
+#endif
+    }
+}
+
+// the same random permutation of the initial atoms for every run, standing
+// in for the order a long run leaves behind
+static void shuffle_atoms(int N, Atom *atom)
+{
+    srand(12345);
+    real *arrays[] = {atom->x, atom->y, atom->z, atom->vx, atom->vy, atom->vz};
+    for (int n = N - 1; n > 0; --n)
+    {
+        int k = rand() % (n + 1);
+        for (int a = 0; a < 6; ++a)
+        {
+            real t = arrays[a][n];
+            arrays[a][n] = arrays[a][k];
+            arrays[a][k] = t;
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2 || argc > 4)
+    {
+        printf("Usage: %s nx [steps [num_threads]]\n", argv[0]);
+        exit(1);
+    }
+    int nx = atoi(argv[1]);
+    int steps = argc > 2 ? atoi(argv[2]) : 20;
+    int num_threads = argc > 3 ? atoi(argv[3]) : 1;
+    int N = 4 * nx * nx * nx;
+    int MN = 200;
+    real T_0 = 60.0;
+    real ax = 5.385;
+    real time_step = 5.0 / TIME_UNIT_CONVERSION;
+    set_force_strategy(num_threads > 1 ? FORCE_HALF_BUFFERS : FORCE_SERIAL, num_threads);
+
+    printf("N = %d, %d steps of %s find_force\n", N, steps,
+        force_strategy_name(num_threads > 1 ? FORCE_HALF_BUFFERS : FORCE_SERIAL));
+    printf("%10s %14s %18s %18s\n", "order", "ms per step", counter_names[L1D_MISSES], counter_names[LLC_MISSES]);
+    const char *orders[] = {"lattice", "shuffled", "sorted"};
+    for (int o = 0; o < 3; ++o)
+    {
+        Atom atom;
+        allocate_memory(N, MN, &atom);
+        for (int n = 0; n < N; ++n) { atom.m[n] = 40.0; }
+        srand(1);
+        initialize_position(nx, ax, &atom);
+        initialize_velocity(N, T_0, &atom);
+        if (o > 0) { shuffle_atoms(N, &atom); }
+        find_neighbor(N, MN, &atom);
+        if (o == 2) { sort_atoms(N, MN, &atom); }
+        set_sort_interval(o == 2 ? 1 : 0);
+
+        Counters counters;
+        start_counters(&counters);
+        double start = omp_get_wtime();
+        equilibration(steps, N, MN, T_0, time_step, &atom);
+        double t_step = (omp_get_wtime() - start) / steps;
+        stop_counters(&counters);
+
+        printf("%10s %14g", orders[o], t_step * 1.0e3);
+        for (int i = 0; i < NUM_COUNTERS; ++i)
+        {
+            if (counters.value[i] < 0) { printf(" %18s", "n/a"); }
+            else { printf(" %18.4g", (double) counters.value[i] / steps); }
+        }
+        printf("\n");
+        deallocate_memory(&atom);
+    }
+    return 0;
+}
@@ -1,8 +1,32 @@
 #include "matmul.h"
+#include "transpose.h"
+#include "gemm.h"
+#include "ooc_gemm.h"
+#include "arena.h"
+#include "conv.h"
+#include "attention.h"
+#include "small_gemm.h"
+#include "einsum.h"
+#include "factorize.h"
+#include "eigensolver.h"
+#include "level3.h"
+#include "bsr.h"
+#include "gemm_server.h"
+#include "trace.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <float.h>
 #include <iostream>
+#include <algorithm>
+#include <pthread.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#endif
 
 #define BLK_SIZE 32
 #define MAX_PRECISION_ERROR 0.01
@@ -14,12 +38,20 @@
 #define C_ROW 640
 #define C_COLUMN 640
 #define NUM_THREAD 4
+#define OOC_TILE 256
+#define OOC_MEMORY_BUDGET (4 * 1024 * 1024)
+#define FACTOR_N 2048
+#define EIGEN_N 1024
+#define LEVEL3_N 1024
+#define BSR_N 2048
+#define SERVE_N 1024
+#define SERVE_ROWS 16
+#define SERVE_CLIENTS (2 * NUM_THREAD)
+#define SERVE_REQUESTS 64
 
-float MAT_A[A_ROW * A_COLUMN];
-float MAT_B[B_ROW * B_COLUMN];
-float transpose_B[B_ROW * B_COLUMN];
-float native_C[C_ROW * C_COLUMN];
-float output_C[C_ROW * C_COLUMN];
+float *MAT_A, *MAT_B;
+float *transpose_B, *output_B;
+float *native_C, *output_C;
 
 bool check_identical(float matA[], float matB[], int size)
 {
@@ -44,6 +76,108 @@ void initialize_matrix(float A[], int size)
 
 using namespace matmul;
 
+// Carve all benchmark matrices out of one 64-byte aligned arena
+bool allocate_matrices(struct arena *a, enum arena_pages pages)
+{
+    size_t size = (2 * (size_t)A_ROW * A_COLUMN + 3 * (size_t)B_ROW * B_COLUMN + 2 * (size_t)C_ROW * C_COLUMN) * sizeof(float);
+    if (!arena_init(a, size + 6 * ARENA_ALIGNMENT, pages))
+        return false;
+    MAT_A = (float *)arena_alloc(a, (size_t)A_ROW * A_COLUMN * sizeof(float));
+    MAT_B = (float *)arena_alloc(a, (size_t)B_ROW * B_COLUMN * sizeof(float));
+    transpose_B = (float *)arena_alloc(a, (size_t)B_ROW * B_COLUMN * sizeof(float));
+    output_B = (float *)arena_alloc(a, (size_t)B_ROW * B_COLUMN * sizeof(float));
+    native_C = (float *)arena_alloc(a, (size_t)C_ROW * C_COLUMN * sizeof(float));
+    output_C = (float *)arena_alloc(a, (size_t)C_ROW * C_COLUMN * sizeof(float));
+    return true;
+}
+
+// dTLB load misses of this process and the threads it spawns, -1 when perf events are unavailable
+int open_dtlb_counter()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+long long read_counter(int fd)
+{
+    long long count = -1;
+#ifdef __linux__
+    if (fd >= 0 && read(fd, &count, sizeof(count)) != sizeof(count))
+        count = -1;
+#endif
+    return count;
+}
+
+// One request thread of the serving benchmark: SERVE_REQUESTS products of its own rows of A with the
+// shared B, either on its own packed GEMM or through the server
+struct serving_client
+{
+    struct gemm_server *server;
+    const float *A, *B;
+    float *C;
+    double latency_ms[SERVE_REQUESTS];
+};
+
+void *serving_client_func(void *args)
+{
+    struct serving_client *c = (struct serving_client *)args;
+    for (int i = 0; i < SERVE_REQUESTS; i++)
+    {
+        struct timeval start, end;
+        gettimeofday(&start, NULL);
+        if (c->server)
+        {
+            struct gemm_request r = {};
+            r.A = c->A;
+            r.lda = SERVE_N;
+            r.B = c->B;
+            r.ldb = SERVE_N;
+            r.C = c->C;
+            r.ldc = SERVE_N;
+            r.m = SERVE_ROWS;
+            r.n = r.k = SERVE_N;
+            while (!gemm_server_submit(c->server, &r))
+                sched_yield();
+            if (!gemm_server_wait(&r))
+                printf("gemm_server request failed\n");
+        }
+        else
+        {
+            struct gemm_params gemm = {};
+            gemm.M = SERVE_ROWS;
+            gemm.N = gemm.K = SERVE_N;
+            gemm.alpha = 1.0f;
+            gemm.A.data = c->A;
+            gemm.A.rs = SERVE_N;
+            gemm.A.cs = 1;
+            gemm.B.data = c->B;
+            gemm.B.rs = SERVE_N;
+            gemm.B.cs = 1;
+            gemm.C = c->C;
+            gemm.rs_c = SERVE_N;
+            gemm.cs_c = 1;
+            gemm.num_thread = NUM_THREAD;
+            if (!packed_gemm(&gemm))
+                printf("packed_gemm request failed\n");
+        }
+        gettimeofday(&end, NULL);
+        c->latency_ms[i] = interval_to_ms(&start, &end);
+    }
+    return NULL;
+}
+
 bool runSwitch(std::string target, std::string type){
     if (target == "ALL" || target == type)
         return true;
@@ -57,6 +191,10 @@ int main(int argc, char* argv[])
         target = argv[1];
     }
 
+    struct arena matrix_arena;
+    if (!allocate_matrices(&matrix_arena, HUGE_PAGES))
+        return 1;
+
     // initialize
     initialize_matrix(MAT_A, A_ROW * A_COLUMN);
     initialize_matrix(MAT_B, B_ROW * B_COLUMN);
@@ -73,6 +211,8 @@ int main(int argc, char* argv[])
     //Baseline
     params.C.data_ptr = native_C;
     matmul_op.evaluate(MatmulOperator::NAIVE, &params);
+    // Only the sections below go into the trace
+    trace_reset();
 
     params.C.data_ptr = output_C;
     // unrolling
@@ -109,6 +249,657 @@ int main(int argc, char* argv[])
         if (!check_identical(native_C, output_C, C_ROW * C_COLUMN))
             printf("incorrect output of mat_mul_transpose_simd\n");
     }
+    // packed GEMM, packing B between compute phases vs. on a helper thread
+    if (runSwitch(target, "pipelined")){
+        struct gemm_stats stats;
+        params.opt_params.stats = &stats;
+        const MatmulOperator::IMP_TYPE types[2] = {MatmulOperator::PACKED, MatmulOperator::PIPELINED};
+        for (int t = 0; t < 2; t++){
+            matmul_op.evaluate(types[t], &params);
+            if (!check_identical(native_C, output_C, C_ROW * C_COLUMN))
+                printf("incorrect output of %s\n", t ? "mat_mul_pipelined" : "mat_mul_packed");
+            printf("  %d B panels, packing %.2f ms, exposed %.2f ms, overlap fraction %.2f\n", stats.panels,
+                   stats.pack_ms, stats.exposed_ms, stats.pack_ms > 0 ? 1 - stats.exposed_ms / stats.pack_ms : 0);
+        }
+        params.opt_params.stats = NULL;
+    }
+
+    // out-of-core GEMM over tile files on disk
+    if (runSwitch(target, "out_of_core")){
+        struct tiled_matrix tA = {-1}, tB = {-1}, tC = {-1};
+        struct ooc_stats stats;
+        bool ok = tiled_matrix_create("ooc_A.bin", A_ROW, A_COLUMN, OOC_TILE, &tA) &&
+                  tiled_matrix_create("ooc_B.bin", B_ROW, B_COLUMN, OOC_TILE, &tB) &&
+                  tiled_matrix_create("ooc_C.bin", C_ROW, C_COLUMN, OOC_TILE, &tC);
+        if (ok){
+            tiled_matrix_from_dense(&tA, MAT_A);
+            tiled_matrix_from_dense(&tB, MAT_B);
+            // Start from a cold mapping so tiles are streamed from the files
+            tiled_matrix_close(&tA);
+            tiled_matrix_close(&tB);
+            ok = tiled_matrix_open("ooc_A.bin", false, &tA) && tiled_matrix_open("ooc_B.bin", false, &tB) &&
+                 ooc_gemm(&tA, &tB, &tC, OOC_MEMORY_BUDGET, NUM_THREAD, &stats);
+        }
+        if (ok){
+            std::cout << "ooc_gemm: " << stats.ms << " ms" << std::endl;
+            printf("  %d MB budget, %dx%d C tiles per block, %ld A/B tiles read\n", OOC_MEMORY_BUDGET >> 20,
+                   stats.block_rows, stats.block_cols, stats.tiles_read);
+            tiled_matrix_to_dense(&tC, output_C);
+            if (!check_identical(native_C, output_C, C_ROW * C_COLUMN))
+                printf("incorrect output of ooc_gemm\n");
+        }
+        else
+            printf("ooc_gemm failed\n");
+        tiled_matrix_close(&tA);
+        tiled_matrix_close(&tB);
+        tiled_matrix_close(&tC);
+        remove("ooc_A.bin");
+        remove("ooc_B.bin");
+        remove("ooc_C.bin");
+    }
+
+    // matrices and packing scratch on 4 KB pages vs. 2 MB huge pages, large-K shape
+    if (runSwitch(target, "hugepage")){
+        const enum arena_pages modes[2] = {SMALL_PAGES, HUGE_PAGES};
+        const char *names[2] = {"4 KB pages", "2 MB huge pages"};
+        float ms[2];
+        long long misses[2];
+        for (int m = 0; m < 2; m++){
+            struct arena a;
+            if (!arena_init(&a, ((size_t)A_ROW * A_COLUMN + (size_t)B_ROW * B_COLUMN + (size_t)C_ROW * C_COLUMN) * sizeof(float) + 3 * ARENA_ALIGNMENT, modes[m]))
+                return 1;
+            struct matmul_params page_params = params;
+            page_params.A.data_ptr = (float *)arena_alloc(&a, (size_t)A_ROW * A_COLUMN * sizeof(float));
+            page_params.B.data_ptr = (float *)arena_alloc(&a, (size_t)B_ROW * B_COLUMN * sizeof(float));
+            page_params.C.data_ptr = (float *)arena_alloc(&a, (size_t)C_ROW * C_COLUMN * sizeof(float));
+            memcpy(page_params.A.data_ptr, MAT_A, (size_t)A_ROW * A_COLUMN * sizeof(float));
+            memcpy(page_params.B.data_ptr, MAT_B, (size_t)B_ROW * B_COLUMN * sizeof(float));
+            gemm_set_scratch_pages(modes[m]);
+            // The first call faults in C and the packing scratch
+            matmul_op.mat_mul_packed(&page_params);
+
+            struct timeval start, end;
+            int fd = open_dtlb_counter();
+#ifdef __linux__
+            if (fd >= 0)
+                ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+            gettimeofday(&start, NULL);
+            matmul_op.mat_mul_packed(&page_params);
+            gettimeofday(&end, NULL);
+            misses[m] = read_counter(fd);
+            if (fd >= 0)
+                close(fd);
+            ms[m] = interval_to_ms(&start, &end);
+
+            std::cout << "mat_mul_packed (" << names[m] << "): " << ms[m] << " ms";
+            if (misses[m] >= 0)
+                std::cout << ", " << misses[m] << " dTLB load misses";
+            std::cout << std::endl;
+            if (!check_identical(native_C, page_params.C.data_ptr, C_ROW * C_COLUMN))
+                printf("incorrect output of mat_mul_packed on %s\n", names[m]);
+            arena_destroy(&a);
+        }
+        gemm_set_scratch_pages(HUGE_PAGES);
+        printf("  huge page speedup %.2fx", ms[0] / ms[1]);
+        if (misses[0] > 0 && misses[1] >= 0)
+            printf(", dTLB misses reduced by %.1f%%", 100.0 * (misses[0] - misses[1]) / misses[0]);
+        else
+            printf(", dTLB misses n/a (perf events unavailable)");
+        printf("\n");
+    }
+
+    // convolution through im2col + packed GEMM vs. implicit GEMM
+    if (runSwitch(target, "conv")){
+        // batch, C_in, H, W, C_out, KH, KW, stride_h, stride_w, pad_h, pad_w, threads
+        const struct conv_params layers[2] = {{1, 64, 56, 56, 64, 3, 3, 1, 1, 1, 1, NUM_THREAD},
+                                              {2, 32, 112, 112, 64, 5, 5, 2, 2, 2, 2, NUM_THREAD}};
+        const enum conv_algo algos[3] = {CONV_DIRECT, CONV_IM2COL, CONV_IMPLICIT_GEMM};
+        const char *names[3] = {"conv_direct", "conv_im2col", "conv_implicit_gemm"};
+        for (int l = 0; l < 2; l++){
+            const struct conv_params *p = &layers[l];
+            size_t in_size = (size_t)p->batch * p->in_channels * p->height * p->width;
+            size_t w_size = (size_t)p->out_channels * p->in_channels * p->kernel_h * p->kernel_w;
+            size_t out_size = (size_t)p->batch * p->out_channels * conv_out_height(p) * conv_out_width(p);
+            struct arena a;
+            if (!arena_init(&a, (in_size + w_size + 2 * out_size) * sizeof(float) + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+                return 1;
+            float *input = (float *)arena_alloc(&a, in_size * sizeof(float));
+            float *weights = (float *)arena_alloc(&a, w_size * sizeof(float));
+            float *native_out = (float *)arena_alloc(&a, out_size * sizeof(float));
+            float *out = (float *)arena_alloc(&a, out_size * sizeof(float));
+            initialize_matrix(input, in_size);
+            initialize_matrix(weights, w_size);
+
+            printf("conv %dx%dx%dx%d, %d filters %dx%d, stride %d, pad %d\n", p->batch, p->in_channels, p->height,
+                   p->width, p->out_channels, p->kernel_h, p->kernel_w, p->stride_h, p->pad_h);
+            for (int t = 0; t < 3; t++){
+                struct timeval start, end;
+                // Warm-up call so scratch buffers are faulted in before timing
+                if (algos[t] != CONV_DIRECT)
+                    conv2d(p, algos[t], input, weights, out);
+                gettimeofday(&start, NULL);
+                bool ok = conv2d(p, algos[t], input, weights, t == 0 ? native_out : out);
+                gettimeofday(&end, NULL);
+                if (!ok){
+                    printf("%s failed\n", names[t]);
+                    continue;
+                }
+                std::cout << names[t] << ": " << interval_to_ms(&start, &end) << " ms, "
+                          << conv_scratch_size(p, algos[t]) / 1024 << " KB scratch" << std::endl;
+                if (t > 0 && !check_identical(native_out, out, out_size))
+                    printf("incorrect output of %s\n", names[t]);
+            }
+            arena_destroy(&a);
+        }
+    }
+
+    // attention with a materialized score matrix vs. the fused online-softmax kernel
+    if (runSwitch(target, "attention")){
+        // heads, seq_q, seq_kv, head_dim, scale, causal, threads
+        const struct attention_params shapes[2] = {{4, 2048, 2048, 64, 0, false, NUM_THREAD},
+                                                   {2, 4096, 4096, 64, 0, true, NUM_THREAD}};
+        const enum attention_algo algos[2] = {ATTENTION_UNFUSED, ATTENTION_FUSED};
+        const char *names[2] = {"attention_unfused", "attention_fused"};
+        for (int s = 0; s < 2; s++){
+            const struct attention_params *p = &shapes[s];
+            size_t q_size = (size_t)p->heads * p->seq_q * p->head_dim, kv_size = (size_t)p->heads * p->seq_kv * p->head_dim;
+            struct arena a;
+            if (!arena_init(&a, (3 * q_size + 2 * kv_size) * sizeof(float) + 5 * ARENA_ALIGNMENT, HUGE_PAGES))
+                return 1;
+            float *Q = (float *)arena_alloc(&a, q_size * sizeof(float));
+            float *K = (float *)arena_alloc(&a, kv_size * sizeof(float));
+            float *V = (float *)arena_alloc(&a, kv_size * sizeof(float));
+            float *O[2];
+            O[0] = (float *)arena_alloc(&a, q_size * sizeof(float));
+            O[1] = (float *)arena_alloc(&a, q_size * sizeof(float));
+            initialize_matrix(Q, q_size);
+            initialize_matrix(K, kv_size);
+            initialize_matrix(V, kv_size);
+
+            printf("attention %d heads, seq %d, head_dim %d%s\n", p->heads, p->seq_q, p->head_dim, p->causal ? ", causal" : "");
+            bool ok = true;
+            for (int t = 0; t < 2; t++){
+                struct timeval start, end;
+                // Warm-up call so scratch buffers are faulted in before timing
+                attention(p, algos[t], Q, K, V, O[t]);
+                gettimeofday(&start, NULL);
+                if (!attention(p, algos[t], Q, K, V, O[t])){
+                    printf("%s failed\n", names[t]);
+                    ok = false;
+                    continue;
+                }
+                gettimeofday(&end, NULL);
+                std::cout << names[t] << ": " << interval_to_ms(&start, &end) << " ms, "
+                          << attention_scratch_size(p, algos[t]) / 1024 << " KB scratch" << std::endl;
+            }
+            if (ok && !check_identical(O[0], O[1], q_size))
+                printf("incorrect output of attention_fused\n");
+            arena_destroy(&a);
+        }
+    }
+
+    // latency of tiny products: generic paths vs. the fixed-size kernels they are routed to
+    if (runSwitch(target, "small_gemm")){
+        alignas(64) float A[SMALL_GEMM_MAX * SMALL_GEMM_MAX], B[SMALL_GEMM_MAX * SMALL_GEMM_MAX];
+        alignas(64) float Bt[SMALL_GEMM_MAX * SMALL_GEMM_MAX], ref[SMALL_GEMM_MAX * SMALL_GEMM_MAX];
+        alignas(64) float C[SMALL_GEMM_MAX * SMALL_GEMM_MAX];
+        initialize_matrix(A, SMALL_GEMM_MAX * SMALL_GEMM_MAX);
+        initialize_matrix(B, SMALL_GEMM_MAX * SMALL_GEMM_MAX);
+        const int sizes[] = {4, 6, 8, 12, 16, 24, 32};
+        for (int n : sizes){
+            int iters = (1 << 16) / (n * n);
+            struct matmul_params small;
+            small.A.row = n; small.A.column = n; small.A.data_ptr = A;
+            small.B.row = n; small.B.column = n; small.B.data_ptr = B;
+            small.C.row = n; small.C.column = n; small.C.data_ptr = ref;
+            small.opt_params.blk_size = 4; small.opt_params.num_thread = NUM_THREAD;
+            transpose(B, Bt, n, n);
+
+            // The packed engine with beta = 1 (on a zeroed C) skips the small-shape routing
+            struct gemm_params gemm = {};
+            gemm.M = gemm.N = gemm.K = n;
+            gemm.alpha = gemm.beta = 1.0f;
+            gemm.A.data = A; gemm.A.rs = n; gemm.A.cs = 1;
+            gemm.B.data = B; gemm.B.rs = n; gemm.B.cs = 1;
+            gemm.C = C; gemm.rs_c = n; gemm.cs_c = 1;
+            gemm.num_thread = NUM_THREAD;
+
+            const char *names[4] = {"naive_mat_mul", "packed_gemm (generic)", "mat_mul_fast (routed)", "small_gemm"};
+            double ns[4];
+            bool ok = true;
+            for (int t = 0; t < 4; t++){
+                struct timespec start, end;
+                if (t == 1)
+                    memset(C, 0, sizeof(C));
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                for (int it = 0; it < iters; it++){
+                    if (t == 0)
+                        matmul_op.naive_mat_mul(&small);
+                    else if (t == 1)
+                        ok = packed_gemm(&gemm) && ok;
+                    else if (t == 2){
+                        struct matmul_params fast = small;
+                        fast.B.data_ptr = Bt;
+                        fast.C.data_ptr = C;
+                        matmul_op.mat_mul_fast(&fast);
+                    }
+                    else
+                        small_gemm_dispatch(n, n, n, A, B, C);
+                    // The generic engine accumulates into C; only its first result is checked
+                    if (t == 1 && it == 0 && (!ok || !check_identical(ref, C, n * n)))
+                        printf("incorrect output of packed_gemm\n");
+                }
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                ns[t] = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / iters;
+                if (t >= 2 && !check_identical(ref, C, n * n))
+                    printf("incorrect output of %s\n", names[t]);
+            }
+            printf("%dx%dx%d:", n, n, n);
+            for (int t = 0; t < 4; t++)
+                printf(" %s %.0f ns%s", names[t], ns[t], t < 3 ? "," : "\n");
+        }
+    }
+
+    // tensor contractions: explicit permute + GEMM vs. permutations folded into packing
+    if (runSwitch(target, "einsum")){
+        struct contraction
+        {
+            const char *spec;
+            int shape_A[4], shape_B[4];
+        };
+        const struct contraction patterns[5] = {
+            {"bij,bjk->bik", {64, 128, 128}, {64, 128, 128}},        // batched matmul
+            {"bhqd,bhkd->bhqk", {2, 8, 256, 64}, {2, 8, 256, 64}},   // attention scores
+            {"bqhd,bkhd->bhqk", {2, 256, 8, 64}, {2, 256, 8, 64}},   // attention scores, heads interleaved
+            {"ikj,jlk->il", {256, 32, 32}, {32, 256, 32}},          // two contracted labels in different orders
+            {"abc,cd->dba", {64, 64, 256}, {256, 256}},             // permuted output
+        };
+        const enum einsum_algo algos[2] = {EINSUM_PERMUTE, EINSUM_FUSED};
+        const char *names[2] = {"einsum (permute + GEMM)", "einsum (fused packing)"};
+        for (int c = 0; c < 5; c++){
+            struct einsum_plan plan;
+            if (!einsum_plan_create(patterns[c].spec, patterns[c].shape_A, patterns[c].shape_B, &plan))
+                return 1;
+            struct arena a;
+            if (!arena_init(&a, (plan.size_A + plan.size_B + 2 * plan.size_C) * sizeof(float) + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+                return 1;
+            float *A = (float *)arena_alloc(&a, plan.size_A * sizeof(float));
+            float *B = (float *)arena_alloc(&a, plan.size_B * sizeof(float));
+            float *ref = (float *)arena_alloc(&a, plan.size_C * sizeof(float));
+            float *C = (float *)arena_alloc(&a, plan.size_C * sizeof(float));
+            initialize_matrix(A, plan.size_A);
+            initialize_matrix(B, plan.size_B);
+            einsum_execute(&plan, EINSUM_REFERENCE, A, B, ref);
+
+            printf("%s: %ld GEMMs of %dx%dx%d%s%s\n", patterns[c].spec, plan.batch_count, plan.M, plan.N, plan.K,
+                   plan.gather_A ? ", A gathered" : "", plan.gather_B ? ", B gathered" : "");
+            for (int t = 0; t < 2; t++){
+                struct timeval start, end;
+                // Warm-up call so scratch buffers are faulted in before timing
+                bool ok = einsum_execute(&plan, algos[t], A, B, C, NUM_THREAD);
+                gettimeofday(&start, NULL);
+                ok = ok && einsum_execute(&plan, algos[t], A, B, C, NUM_THREAD);
+                gettimeofday(&end, NULL);
+                std::cout << "  " << names[t] << ": " << interval_to_ms(&start, &end) << " ms" << std::endl;
+                if (!ok || !check_identical(ref, C, plan.size_C))
+                    printf("incorrect output of %s\n", names[t]);
+            }
+            arena_destroy(&a);
+        }
+    }
+
+    // blocked LU / Cholesky with GEMM trailing updates vs. their unblocked versions
+    if (runSwitch(target, "factorize")){
+        const int n = FACTOR_N;
+        struct arena a;
+        if (!arena_init(&a, (2 * (size_t)n * n + 2 * n) * sizeof(float) + n * sizeof(int) + 5 * ARENA_ALIGNMENT, HUGE_PAGES))
+            return 1;
+        float *A0 = (float *)arena_alloc(&a, (size_t)n * n * sizeof(float));
+        float *F = (float *)arena_alloc(&a, (size_t)n * n * sizeof(float));
+        float *b = (float *)arena_alloc(&a, n * sizeof(float));
+        float *x = (float *)arena_alloc(&a, n * sizeof(float));
+        int *ipiv = (int *)arena_alloc(&a, n * sizeof(int));
+
+        for (int spd = 0; spd < 2; spd++){
+            // A general matrix for LU; a symmetric, diagonally dominant (so positive definite) one for Cholesky
+            initialize_matrix(A0, n * n);
+            if (spd)
+                for (int i = 0; i < n; i++){
+                    for (int j = 0; j < i; j++)
+                        A0[(size_t)j * n + i] = A0[(size_t)i * n + j];
+                    A0[(size_t)i * n + i] += n;
+                }
+            // b = A * ones
+            for (int i = 0; i < n; i++){
+                double sum = 0;
+                for (int j = 0; j < n; j++)
+                    sum += A0[(size_t)i * n + j];
+                b[i] = (float)sum;
+            }
+
+            const int block_sizes[2] = {n, FACTOR_BLOCK};
+            for (int t = 0; t < 2; t++){
+                struct timeval start, end;
+                memcpy(F, A0, (size_t)n * n * sizeof(float));
+                memcpy(x, b, n * sizeof(float));
+                gettimeofday(&start, NULL);
+                int info = spd ? cholesky_factor(F, n, n, block_sizes[t], NUM_THREAD) : lu_factor(F, n, n, ipiv, block_sizes[t], NUM_THREAD);
+                gettimeofday(&end, NULL);
+                bool solved = info == 0 && (spd ? cholesky_solve(F, n, n, x, 1, 1, NUM_THREAD)
+                                                : lu_solve(F, n, n, ipiv, x, 1, 1, NUM_THREAD));
+
+                // HPL-style scaled residual ||A x - b|| / (||A|| ||x|| n eps), infinity norms
+                double r = 0, norm_A = 0, norm_x = 0;
+                for (int i = 0; i < n; i++){
+                    double sum = 0, row = 0;
+                    for (int j = 0; j < n; j++){
+                        sum += (double)A0[(size_t)i * n + j] * x[j];
+                        row += fabs(A0[(size_t)i * n + j]);
+                    }
+                    r = fmax(r, fabs(sum - b[i]));
+                    norm_A = fmax(norm_A, row);
+                    norm_x = fmax(norm_x, fabs(x[i]));
+                }
+                double scaled = r / (norm_A * norm_x * n * FLT_EPSILON);
+
+                float ms = interval_to_ms(&start, &end);
+                double flops = (spd ? 1.0 / 3 : 2.0 / 3) * n * (double)n * n;
+                printf("%s (%s, n = %d): %.1f ms, %.2f GFLOP/s, scaled residual %.3f\n", spd ? "cholesky_factor" : "lu_factor",
+                       t ? "blocked" : "unblocked", n, ms, flops / ms / 1e6, scaled);
+                if (!solved || !(scaled < 16))
+                    printf("incorrect output of %s\n", spd ? "cholesky_factor" : "lu_factor");
+            }
+        }
+        arena_destroy(&a);
+    }
+
+    // Hermitian eigenvalues: blocked Householder tridiagonalization vs. the unblocked reduction
+    if (runSwitch(target, "eigensolver")){
+        const int n = EIGEN_N;
+        struct arena a;
+        if (!arena_init(&a, 2 * (size_t)n * n * sizeof(std::complex<float>) + 2 * n * sizeof(float) + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+            return 1;
+        std::complex<float> *H = (std::complex<float> *)arena_alloc(&a, (size_t)n * n * sizeof(std::complex<float>));
+        std::complex<float> *work = (std::complex<float> *)arena_alloc(&a, (size_t)n * n * sizeof(std::complex<float>));
+        float *w[2] = {(float *)arena_alloc(&a, n * sizeof(float)), (float *)arena_alloc(&a, n * sizeof(float))};
+
+        // Random Hermitian matrix, lower triangle only, with its trace and squared Frobenius norm
+        double trace = 0, frobenius2 = 0;
+        for (int i = 0; i < n; i++)
+            for (int j = 0; j <= i; j++){
+                float re = 2.0f * rand() / RAND_MAX - 1, im = j < i ? 2.0f * rand() / RAND_MAX - 1 : 0;
+                H[(size_t)i * n + j] = std::complex<float>(re, im);
+                trace += j == i ? re : 0;
+                frobenius2 += (j == i ? 1 : 2) * ((double)re * re + (double)im * im);
+            }
+
+        const enum eigen_algo algos[2] = {EIGEN_UNBLOCKED, EIGEN_BLOCKED};
+        for (int t = 0; t < 2; t++){
+            struct timeval start, end;
+            memcpy(work, H, (size_t)n * n * sizeof(std::complex<float>));
+            gettimeofday(&start, NULL);
+            int info = hermitian_eigenvalues(work, n, n, w[t], algos[t], NUM_THREAD);
+            gettimeofday(&end, NULL);
+
+            // The eigenvalues must reproduce the trace and the Frobenius norm of H
+            double sum = 0, sum2 = 0;
+            for (int i = 0; i < n; i++){
+                sum += w[t][i];
+                sum2 += (double)w[t][i] * w[t][i];
+            }
+            float ms = interval_to_ms(&start, &end);
+            printf("hermitian_eigenvalues (%s, n = %d): %.1f ms, %.2f GFLOP/s in the reduction\n", t ? "blocked" : "unblocked",
+                   n, ms, 16.0 / 3 * n * (double)n * n / ms / 1e6);
+            printf("  eigenvalues in [%.3f, %.3f], trace error %.2e, Frobenius error %.2e\n", w[t][0], w[t][n - 1],
+                   fabs(sum - trace) / sqrt(frobenius2), fabs(sqrt(sum2) - sqrt(frobenius2)) / sqrt(frobenius2));
+            if (info != 0 || !(fabs(sqrt(sum2) - sqrt(frobenius2)) < 1e-4 * sqrt(frobenius2)))
+                printf("incorrect output of hermitian_eigenvalues\n");
+        }
+        float diff = 0;
+        for (int i = 0; i < n; i++)
+            diff = fmaxf(diff, fabsf(w[0][i] - w[1][i]));
+        if (!(diff < 1e-4 * sqrt(frobenius2)))
+            printf("blocked and unblocked eigenvalues differ by %f\n", diff);
+        arena_destroy(&a);
+    }
+
+    // SYRK / TRMM / TRSM computing one triangle vs. a full GEMM and the naive loops
+    if (runSwitch(target, "level3")){
+        const int n = LEVEL3_N;
+        const size_t size = (size_t)n * n;
+        struct arena a;
+        if (!arena_init(&a, 4 * size * sizeof(float) + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+            return 1;
+        float *A = (float *)arena_alloc(&a, size * sizeof(float));
+        float *B = (float *)arena_alloc(&a, size * sizeof(float));
+        float *ref = (float *)arena_alloc(&a, size * sizeof(float));
+        float *out = (float *)arena_alloc(&a, size * sizeof(float));
+        initialize_matrix(A, size);
+        initialize_matrix(B, size);
+        struct timeval start, end;
+
+        // Gram matrix A^T * A: the lower triangle with syrk, all of it with the packed GEMM
+        memcpy(ref, B, size * sizeof(float));
+        gettimeofday(&start, NULL);
+        syrk_reference(true, true, n, n, 1.0f, A, n, 0.0f, ref, n);
+        gettimeofday(&end, NULL);
+        std::cout << "syrk_reference: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        memcpy(out, B, size * sizeof(float));
+        bool ok = syrk(true, true, n, n, 1.0f, A, n, 0.0f, out, n, NUM_THREAD);
+        gettimeofday(&start, NULL);
+        ok = ok && syrk(true, true, n, n, 1.0f, A, n, 0.0f, out, n, NUM_THREAD);
+        gettimeofday(&end, NULL);
+        std::cout << "syrk: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        if (!ok || !check_identical(ref, out, size))
+            printf("incorrect output of syrk\n");
+
+        struct gemm_params gemm = {};
+        gemm.M = gemm.N = gemm.K = n;
+        gemm.alpha = 1.0f;
+        gemm.A.data = gemm.B.data = A;
+        gemm.A.rs = 1;
+        gemm.A.cs = n;
+        gemm.B.rs = n;
+        gemm.B.cs = 1;
+        gemm.C = out;
+        gemm.rs_c = n;
+        gemm.cs_c = 1;
+        gemm.num_thread = NUM_THREAD;
+        gettimeofday(&start, NULL);
+        if (!packed_gemm(&gemm))
+            printf("packed_gemm failed\n");
+        gettimeofday(&end, NULL);
+        std::cout << "packed_gemm (A^T * A): " << interval_to_ms(&start, &end) << " ms" << std::endl;
+
+        // Lower-triangular T (A with its upper triangle zeroed) times B
+        for (int i = 0; i < n; i++)
+            for (int j = i + 1; j < n; j++)
+                A[(size_t)i * n + j] = 0;
+        gettimeofday(&start, NULL);
+        trmm_reference(true, false, n, n, 1.0f, A, n, B, n, ref, n);
+        gettimeofday(&end, NULL);
+        std::cout << "trmm_reference: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        ok = trmm(true, false, n, n, 1.0f, A, n, B, n, out, n, NUM_THREAD);
+        gettimeofday(&start, NULL);
+        ok = ok && trmm(true, false, n, n, 1.0f, A, n, B, n, out, n, NUM_THREAD);
+        gettimeofday(&end, NULL);
+        std::cout << "trmm: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        if (!ok || !check_identical(ref, out, size))
+            printf("incorrect output of trmm\n");
+        gemm.A.rs = n;
+        gemm.A.cs = 1;
+        gemm.B.data = B;
+        gettimeofday(&start, NULL);
+        if (!packed_gemm(&gemm))
+            printf("packed_gemm failed\n");
+        gettimeofday(&end, NULL);
+        std::cout << "packed_gemm (dense T * B): " << interval_to_ms(&start, &end) << " ms" << std::endl;
+
+        // T * X = B with a diagonally dominant T
+        for (int i = 0; i < n; i++)
+            A[(size_t)i * n + i] += n;
+        memcpy(ref, B, size * sizeof(float));
+        gettimeofday(&start, NULL);
+        trsm_reference(true, true, false, false, n, n, 1.0f, A, n, ref, n);
+        gettimeofday(&end, NULL);
+        std::cout << "trsm_reference: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        memcpy(out, B, size * sizeof(float));
+        gettimeofday(&start, NULL);
+        ok = trsm(true, true, false, false, n, n, 1.0f, A, n, out, n, NUM_THREAD);
+        gettimeofday(&end, NULL);
+        // X has entries near zero, so compare normwise: max |out - ref| / (max |ref| n eps)
+        double diff = 0, norm_ref = 0;
+        for (size_t i = 0; i < size; i++){
+            diff = fmax(diff, fabs((double)out[i] - ref[i]));
+            norm_ref = fmax(norm_ref, fabs(ref[i]));
+        }
+        double scaled = diff / (norm_ref * n * FLT_EPSILON);
+        printf("trsm: %g ms, scaled difference to trsm_reference %.3f\n", interval_to_ms(&start, &end), scaled);
+        if (!ok || !(scaled < 16))
+            printf("incorrect output of trsm\n");
+        arena_destroy(&a);
+    }
+
+    if (runSwitch(target, "block_sparse")){
+        const int n = BSR_N;
+        const size_t size = (size_t)n * n;
+        struct arena a;
+        if (!arena_init(&a, 4 * size * sizeof(float) + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+            return 1;
+        float *A = (float *)arena_alloc(&a, size * sizeof(float));
+        float *B = (float *)arena_alloc(&a, size * sizeof(float));
+        float *ref = (float *)arena_alloc(&a, size * sizeof(float));
+        float *out = (float *)arena_alloc(&a, size * sizeof(float));
+        initialize_matrix(B, size);
+        struct timeval start, end;
+
+        struct gemm_params gemm = {};
+        gemm.M = gemm.N = gemm.K = n;
+        gemm.alpha = 1.0f;
+        gemm.A.data = A;
+        gemm.A.rs = n;
+        gemm.A.cs = 1;
+        gemm.B.data = B;
+        gemm.B.rs = n;
+        gemm.B.cs = 1;
+        gemm.C = ref;
+        gemm.rs_c = n;
+        gemm.cs_c = 1;
+        gemm.num_thread = NUM_THREAD;
+
+        // The same matrix with a random fraction of its BSR_BLOCK tiles kept, dense GEMM against BSR
+        const float densities[] = {1.0f, 0.5f, 0.25f, 0.1f, 0.05f};
+        for (float density : densities)
+        {
+            initialize_matrix(A, size);
+            for (int bi = 0; bi < n; bi += BSR_BLOCK)
+                for (int bj = 0; bj < n; bj += BSR_BLOCK)
+                    if ((float)rand() / (float)RAND_MAX >= density)
+                        for (int i = bi; i < bi + BSR_BLOCK; i++)
+                            memset(&A[(size_t)i * n + bj], 0, BSR_BLOCK * sizeof(float));
+            struct bsr_matrix S;
+            if (!bsr_from_dense(A, n, n, n, BSR_BLOCK, &S))
+                return 1;
+
+            gettimeofday(&start, NULL);
+            if (!packed_gemm(&gemm))
+                printf("packed_gemm failed at density %f\n", density);
+            gettimeofday(&end, NULL);
+            float dense_ms = interval_to_ms(&start, &end);
+            gettimeofday(&start, NULL);
+            bool ok = bsr_gemm(&S, B, n, n, 1.0f, 0.0f, out, n, NUM_THREAD);
+            gettimeofday(&end, NULL);
+            if (!ok){
+                printf("bsr_gemm failed at density %f\n", density);
+                bsr_destroy(&S);
+                continue;
+            }
+            std::cout << "density " << density << " (" << S.nnz_blocks << " of " << S.block_rows * S.block_cols
+                      << " tiles): packed_gemm " << dense_ms << " ms, bsr_gemm " << interval_to_ms(&start, &end) << " ms"
+                      << std::endl;
+            if (!check_identical(ref, out, size))
+                printf("incorrect output of bsr_gemm at density %f\n", density);
+            bsr_destroy(&S);
+        }
+        arena_destroy(&a);
+    }
+
+    if (runSwitch(target, "serving")){
+        const size_t rows = (size_t)SERVE_CLIENTS * SERVE_ROWS;
+        struct arena a;
+        if (!arena_init(&a, (3 * rows + SERVE_N) * SERVE_N * sizeof(float) + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+            return 1;
+        float *A = (float *)arena_alloc(&a, rows * SERVE_N * sizeof(float));
+        float *B = (float *)arena_alloc(&a, (size_t)SERVE_N * SERVE_N * sizeof(float));
+        float *ref = (float *)arena_alloc(&a, rows * SERVE_N * sizeof(float));
+        float *out = (float *)arena_alloc(&a, rows * SERVE_N * sizeof(float));
+        initialize_matrix(A, rows * SERVE_N);
+        initialize_matrix(B, SERVE_N * SERVE_N);
+
+        struct gemm_params gemm = {};
+        gemm.M = rows;
+        gemm.N = gemm.K = SERVE_N;
+        gemm.alpha = 1.0f;
+        gemm.A.data = A;
+        gemm.A.rs = SERVE_N;
+        gemm.A.cs = 1;
+        gemm.B.data = B;
+        gemm.B.rs = SERVE_N;
+        gemm.B.cs = 1;
+        gemm.C = ref;
+        gemm.rs_c = SERVE_N;
+        gemm.cs_c = 1;
+        gemm.num_thread = NUM_THREAD;
+        if (!packed_gemm(&gemm))
+            return 1;
+
+        // SERVE_CLIENTS threads each multiplying their own rows of A by the shared B: first every call on its
+        // own packed GEMM, then through the server at growing batch windows (-1)
+        const float windows_us[] = {-1, 0, 100, 500, 2000};
+        for (float window : windows_us)
+        {
+            struct gemm_server server;
+            struct gemm_server_config config = {NUM_THREAD, window, 16 * SERVE_ROWS};
+            if (window >= 0 && !gemm_server_start(&server, &config))
+                return 1;
+            struct serving_client clients[SERVE_CLIENTS];
+            pthread_t thread_pool[SERVE_CLIENTS];
+            struct timeval start, end;
+            memset(out, 0, rows * SERVE_N * sizeof(float));
+            gettimeofday(&start, NULL);
+            for (int j = 0; j < SERVE_CLIENTS; j++)
+            {
+                clients[j].server = window >= 0 ? &server : NULL;
+                clients[j].A = &A[(size_t)j * SERVE_ROWS * SERVE_N];
+                clients[j].B = B;
+                clients[j].C = &out[(size_t)j * SERVE_ROWS * SERVE_N];
+                pthread_create(&thread_pool[j], NULL, serving_client_func, &clients[j]);
+            }
+            for (int j = 0; j < SERVE_CLIENTS; j++)
+                pthread_join(thread_pool[j], NULL);
+            gettimeofday(&end, NULL);
+            if (window >= 0)
+                gemm_server_stop(&server);
+
+            double latency[SERVE_CLIENTS * SERVE_REQUESTS];
+            for (int j = 0; j < SERVE_CLIENTS; j++)
+                memcpy(&latency[j * SERVE_REQUESTS], clients[j].latency_ms, sizeof(clients[j].latency_ms));
+            std::sort(latency, latency + SERVE_CLIENTS * SERVE_REQUESTS);
+            float ms = interval_to_ms(&start, &end);
+            if (window < 0)
+                std::cout << "independent calls: ";
+            else
+                std::cout << "server, window " << window << " us (" << (float)server.stats.rows / server.stats.batches
+                          << " rows per batch): ";
+            std::cout << SERVE_CLIENTS * SERVE_REQUESTS * 1000.0f / ms << " requests/s, p99 latency "
+                      << latency[SERVE_CLIENTS * SERVE_REQUESTS * 99 / 100] << " ms" << std::endl;
+            if (!check_identical(ref, out, rows * SERVE_N))
+                printf("incorrect output of the GEMM server\n");
+        }
+        arena_destroy(&a);
+    }
+
 #ifdef CUDA_ENABLE
     // cuda
     if (runSwitch(target, "CUDA")){
@@ -117,10 +908,46 @@ int main(int argc, char* argv[])
             printf("incorrect output of mat_mul_cuda\n");
     }
 #endif
+    // transpose
+    if (runSwitch(target, "transpose")){
+        struct timeval start, end;
+
+        gettimeofday(&start, NULL);
+        for (int i = 0; i < B_COLUMN; i++)
+            for (int j = 0; j < B_ROW; j++)
+                transpose_B[i * B_ROW + j] = MAT_B[j * B_COLUMN + i];
+        gettimeofday(&end, NULL);
+        std::cout << "naive_transpose: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+
+        gettimeofday(&start, NULL);
+        transpose(MAT_B, output_B, B_ROW, B_COLUMN);
+        gettimeofday(&end, NULL);
+        std::cout << "transpose (1 thread): " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        if (memcmp(transpose_B, output_B, (size_t)B_ROW * B_COLUMN * sizeof(float)) != 0)
+            printf("incorrect output of transpose\n");
+
+        gettimeofday(&start, NULL);
+        transpose(MAT_B, output_B, B_ROW, B_COLUMN, NUM_THREAD);
+        gettimeofday(&end, NULL);
+        std::cout << "transpose (" << NUM_THREAD << " threads): " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        if (memcmp(transpose_B, output_B, (size_t)B_ROW * B_COLUMN * sizeof(float)) != 0)
+            printf("incorrect output of multithreaded transpose\n");
+
+        // In-place on a non-square matrix, then back again
+        memcpy(output_B, MAT_B, (size_t)B_ROW * B_COLUMN * sizeof(float));
+        gettimeofday(&start, NULL);
+        bool ok = transpose_inplace(output_B, B_ROW, B_COLUMN);
+        gettimeofday(&end, NULL);
+        std::cout << "transpose_inplace: " << interval_to_ms(&start, &end) << " ms" << std::endl;
+        if (!ok || memcmp(transpose_B, output_B, (size_t)B_ROW * B_COLUMN * sizeof(float)) != 0)
+            printf("incorrect output of transpose_inplace\n");
+        ok = transpose_inplace(output_B, B_COLUMN, B_ROW);
+        if (!ok || memcmp(MAT_B, output_B, (size_t)B_ROW * B_COLUMN * sizeof(float)) != 0)
+            printf("incorrect output of transpose_inplace (inverse)\n");
+    }
+
     // For fast, we need to transpose B first
-    for (int i = 0; i < B_COLUMN; i++)
-        for (int j = 0; j < B_ROW; j++)
-            transpose_B[i * B_ROW + j] = MAT_B[j * B_COLUMN + i];
+    transpose(MAT_B, transpose_B, B_ROW, B_COLUMN, NUM_THREAD);
     params.B.column = B_ROW;
     params.B.row = B_COLUMN;
     params.B.data_ptr = transpose_B;
@@ -134,5 +961,9 @@ int main(int argc, char* argv[])
             printf("incorrect output of mat_mul_fast\n");
     }
 
+#ifdef MATMUL_TRACE
+    trace_dump("matmul_trace.json");
+#endif
+    arena_destroy(&matrix_arena);
     return 0;
 }
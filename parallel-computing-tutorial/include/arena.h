@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+
+#define ARENA_ALIGNMENT 64
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+namespace matmul
+{
+    enum arena_pages
+    {
+        SMALL_PAGES,   // base pages only, transparent huge pages disabled
+        HUGE_PAGES,    // 2 MB transparent huge pages through madvise(MADV_HUGEPAGE)
+        HUGETLB_PAGES, // pre-reserved hugetlbfs pages, falling back to HUGE_PAGES
+    };
+
+    // Bump allocator over one anonymous mapping. A zero-initialized arena is empty
+    // and can be grown with arena_reserve.
+    struct arena
+    {
+        char *base;
+        size_t size, used;
+        enum arena_pages pages;
+    };
+
+    bool arena_init(struct arena *a, size_t size, enum arena_pages pages);
+    void arena_destroy(struct arena *a);
+    // ARENA_ALIGNMENT-aligned allocation, NULL when the arena is full
+    void *arena_alloc(struct arena *a, size_t bytes);
+    void arena_reset(struct arena *a);
+    // Make room for size bytes of scratch, discarding previous allocations. The mapping
+    // is only replaced when it is too small, so repeated calls reuse the same pages.
+    bool arena_reserve(struct arena *a, size_t size, enum arena_pages pages);
+}
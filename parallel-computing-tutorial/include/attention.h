@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stddef.h>
+
+// Tile of the fused kernel: ATTN_BR query rows against ATTN_BC keys at a time, sized so that
+// the Q rows, the transposed K tile, the score tile and the output accumulator stay in L2
+#define ATTN_BR 64
+#define ATTN_BC 64
+
+namespace matmul
+{
+    // O = softmax(scale * Q * K^T) * V for every head. Q and O are heads x seq_q x head_dim,
+    // K and V are heads x seq_kv x head_dim, all row-major.
+    struct attention_params
+    {
+        int heads, seq_q, seq_kv, head_dim;
+        float scale; // 0 selects 1 / sqrt(head_dim)
+        // Query i only attends to keys j <= i + seq_kv - seq_q
+        bool causal;
+        int num_thread;
+    };
+
+    enum attention_algo
+    {
+        ATTENTION_UNFUSED, // packed GEMM for Q * K^T, a softmax pass, packed GEMM for P * V
+        ATTENTION_FUSED,   // one pass over K/V tiles with an online (running max / sum) softmax
+    };
+
+    // Returns false when the scratch of the algorithm or the packing buffers of the GEMM cannot be allocated;
+    // the heads not yet computed are then not written to O
+    bool attention(const struct attention_params *p, enum attention_algo algo, const float *Q, const float *K,
+                   const float *V, float *O);
+    // Bytes of scratch an algorithm needs on top of the GEMM packing buffers
+    size_t attention_scratch_size(const struct attention_params *p, enum attention_algo algo);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include "arena.h"
+
+// Default block edge: pruning granularity of the models this targets
+#define BSR_BLOCK 32
+
+namespace matmul
+{
+    // Block sparse row matrix: rows x cols split into block x block tiles (edge tiles zero-padded),
+    // of which only the nonzero ones are stored. Block row bi holds the tiles row_ptr[bi] .. row_ptr[bi + 1],
+    // at block columns col_idx[...]. Bit bi * block_cols + bj of the bitmap is set when tile (bi, bj) is stored.
+    // The tiles of a block row are packed side by side in GEMM_MR-row slivers, ready for the GEMM micro-kernel.
+    struct bsr_matrix
+    {
+        int rows, cols, block;
+        int block_rows, block_cols;
+        int nnz_blocks;
+        int *row_ptr;
+        int *col_idx;
+        uint64_t *bitmap;
+        float *values;
+        size_t tile_size; // floats per packed tile
+        struct arena storage;
+    };
+
+    // Keeps the tiles of a dense row-major matrix that have any nonzero element
+    bool bsr_from_dense(const float *A, int rows, int cols, int lda, int block, struct bsr_matrix *S);
+    void bsr_to_dense(const struct bsr_matrix *S, float *A, int lda);
+    void bsr_destroy(struct bsr_matrix *S);
+    inline bool bsr_block_nonzero(const struct bsr_matrix *S, int bi, int bj)
+    {
+        long bit = (long)bi * S->block_cols + bj;
+        return (S->bitmap[bit >> 6] >> (bit & 63)) & 1;
+    }
+
+    // C (rows x N) = alpha * S * B + beta * C for a dense B (cols x N). Zero tiles are skipped; block rows are
+    // split across the threads so that each gets about the same number of nonzero tiles. Returns false, with C
+    // unchanged, when the packed copy of B cannot be allocated.
+    bool bsr_gemm(const struct bsr_matrix *S, const float *B, int ldb, int N, float alpha, float beta, float *C, int ldc,
+                  int num_thread = 1);
+}
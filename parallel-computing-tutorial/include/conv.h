@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace matmul
+{
+    // 2D convolution (cross-correlation, as in deep learning frameworks) of a batch of
+    // NCHW images with OIHW weights into an NCHW output.
+    struct conv_params
+    {
+        int batch, in_channels, height, width;
+        int out_channels, kernel_h, kernel_w;
+        int stride_h, stride_w, pad_h, pad_w;
+        int num_thread;
+    };
+
+    enum conv_algo
+    {
+        CONV_DIRECT,        // reference loop nest
+        CONV_IM2COL,        // unfold each image into a (C_in * KH * KW) x (OH * OW) matrix, then packed GEMM
+        CONV_IMPLICIT_GEMM, // packed GEMM whose B panels are gathered straight from the image
+    };
+
+    inline int conv_out_height(const struct conv_params *p)
+    {
+        return (p->height + 2 * p->pad_h - p->kernel_h) / p->stride_h + 1;
+    }
+
+    inline int conv_out_width(const struct conv_params *p)
+    {
+        return (p->width + 2 * p->pad_w - p->kernel_w) / p->stride_w + 1;
+    }
+
+    // output (N x C_out x OH x OW) = conv(input (N x C_in x H x W), weights (C_out x C_in x KH x KW)).
+    // Returns false when the scratch of the algorithm or the packing buffers of the GEMM cannot be allocated;
+    // the output of the images not yet computed is then not written.
+    bool conv2d(const struct conv_params *p, enum conv_algo algo, const float *input, const float *weights, float *output);
+    // Bytes of scratch an algorithm needs on top of the GEMM packing buffers
+    size_t conv_scratch_size(const struct conv_params *p, enum conv_algo algo);
+}
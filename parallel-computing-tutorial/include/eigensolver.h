@@ -0,0 +1,31 @@
+#pragma once
+
+#include <complex>
+
+// Reflectors per panel of the blocked reduction: the trailing update is a real GEMM with K = 4 * EIGEN_BLOCK
+#define EIGEN_BLOCK 32
+
+namespace matmul
+{
+    enum eigen_algo
+    {
+        EIGEN_UNBLOCKED, // one reflector at a time, each followed by a rank-2 update of the trailing matrix
+        EIGEN_BLOCKED,   // EIGEN_BLOCK reflectors per panel, then one rank-2k update as real packed GEMMs
+    };
+
+    // Q^H * A * Q = T for a Hermitian n x n matrix A (row-major, leading dimension lda, lower triangle
+    // referenced) with Householder reflectors; T is real symmetric tridiagonal with diagonal d (n entries)
+    // and subdiagonal e (n - 1 entries). A is overwritten. Returns false when the work buffers cannot be
+    // allocated, with A, d and e untouched, or when the GEMM packing buffers of the blocked reduction cannot,
+    // with A partially reduced.
+    bool hermitian_tridiagonalize(std::complex<float> *A, int n, int lda, float *d, float *e,
+                                  enum eigen_algo algo = EIGEN_BLOCKED, int num_thread = 1);
+    // Eigenvalues of the tridiagonal (d, e) by implicit QL with Wilkinson shifts, ascending in d; e needs
+    // room for n entries and is destroyed. Returns 0, or i + 1 if eigenvalue i did not converge.
+    int tridiagonal_eigenvalues(float *d, float *e, int n);
+    // Ascending eigenvalues w of a Hermitian matrix, as cusolverDnZheevd with CUSOLVER_EIG_MODE_NOVECTOR
+    // and CUBLAS_FILL_MODE_LOWER computes them. A is overwritten. Returns 0, the info of the QL stage, or -1
+    // when hermitian_tridiagonalize would return false.
+    int hermitian_eigenvalues(std::complex<float> *A, int n, int lda, float *w, enum eigen_algo algo = EIGEN_BLOCKED,
+                              int num_thread = 1);
+}
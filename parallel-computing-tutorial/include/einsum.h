@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+
+// Most labels an operand or the output may have
+#define EINSUM_MAX_DIMS 8
+
+namespace matmul
+{
+    // One index label of a contraction and its element stride in A, B and C (0 where absent)
+    struct einsum_dim
+    {
+        char label;
+        int size;
+        long stride[3];
+    };
+
+    // A two-operand contraction lowered to a loop of GEMMs: the batch labels index the GEMMs,
+    // the M labels (A and C only) become rows, the N labels (B and C only) columns and the
+    // K labels (A and B only) the reduction. Groups of labels that are not one uniform stride in
+    // an operand are gathered by the packing routine, so no permuted copy is made.
+    struct einsum_plan
+    {
+        int num_dims;
+        struct einsum_dim dims[3 * EINSUM_MAX_DIMS];
+        // Indices into dims of each group, outermost first
+        int batch[EINSUM_MAX_DIMS], m[EINSUM_MAX_DIMS], n[EINSUM_MAX_DIMS], k[EINSUM_MAX_DIMS];
+        int num_batch, num_m, num_n, num_k;
+        long batch_count;
+        int M, N, K;
+        // Strides of the GEMM views; only meaningful for an operand that is not gathered
+        long rs_a, cs_a, rs_b, cs_b, rs_c, cs_c;
+        bool gather_A, gather_B;
+        size_t size_A, size_B, size_C;
+    };
+
+    enum einsum_algo
+    {
+        EINSUM_REFERENCE, // one loop over every label
+        EINSUM_PERMUTE,   // transpose A, B into dense batch x M x K / K x N copies, GEMM, scatter C back
+        EINSUM_FUSED,     // GEMMs straight on the operands, permutations folded into packing
+    };
+
+    // Parses a spec such as "bij,bjk->bik". shape_A / shape_B give the size of each label of A / B in order.
+    // All tensors are dense row-major, C in the order of the output labels. Reports and returns false
+    // for malformed specs, mismatched sizes, repeated labels and labels summed in one operand only.
+    bool einsum_plan_create(const char *spec, const int *shape_A, const int *shape_B, struct einsum_plan *plan);
+    // Returns false, with C incomplete, when the permuted copies or the GEMM packing buffers cannot be allocated.
+    // einsum plans and executes in one call and returns false on either failure.
+    bool einsum_execute(const struct einsum_plan *plan, enum einsum_algo algo, const float *A, const float *B, float *C,
+                        int num_thread = 1);
+    bool einsum(const char *spec, const float *A, const int *shape_A, const float *B, const int *shape_B, float *C,
+                int num_thread = 1);
+}
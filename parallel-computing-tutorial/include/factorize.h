@@ -0,0 +1,27 @@
+#pragma once
+
+// Panel width of the blocked factorizations: the trailing updates are GEMMs with K = FACTOR_BLOCK
+#define FACTOR_BLOCK 128
+
+namespace matmul
+{
+    // Dense factorizations of row-major n x n matrices with leading dimension lda. They are right-looking and
+    // blocked: each panel of block_size columns is factored unblocked, then the trailing matrix is updated
+    // with the threaded packed GEMM. A block_size of n or more gives the unblocked algorithm. When the packing
+    // buffers of the GEMM cannot be allocated, the factorizations return -1 and the solves false, with the
+    // matrix partially updated.
+
+    // P * A = L * U with partial pivoting, in place: L (unit diagonal) below the diagonal, U on and above.
+    // ipiv[i] is the row swapped with row i at step i. Returns 0, i + 1 if U(i, i) is exactly zero, or -1.
+    int lu_factor(float *A, int n, int lda, int *ipiv, int block_size = FACTOR_BLOCK, int num_thread = 1);
+    // A = L * L^T for symmetric positive definite A, using and overwriting the lower triangle only.
+    // Returns 0, i + 1 if the leading minor of order i + 1 is not positive definite, or -1.
+    int cholesky_factor(float *A, int n, int lda, int block_size = FACTOR_BLOCK, int num_thread = 1);
+
+    // B (n x nrhs, leading dimension ldb) = op(T)^-1 * B for triangular T; op(T) = T^T when transpose is set
+    bool triangular_solve(const float *T, int n, int ldt, bool lower, bool transpose, bool unit_diagonal, float *B,
+                          int nrhs, int ldb, int num_thread = 1);
+    // Solve A * X = B in place of B from the factors above
+    bool lu_solve(const float *LU, int n, int lda, const int *ipiv, float *B, int nrhs, int ldb, int num_thread = 1);
+    bool cholesky_solve(const float *L, int n, int lda, float *B, int nrhs, int ldb, int num_thread = 1);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include "matmul.h"
+#include "arena.h"
+
+// Register block of the micro-kernel for the ISA being compiled
+#if defined(__AVX__) && defined(__FMA__)
+#define GEMM_MR 6
+#define GEMM_NR 16
+#elif defined(__SSE__) || defined(__ARM_NEON)
+#define GEMM_MR 4
+#define GEMM_NR 8
+#else
+#define GEMM_MR 4
+#define GEMM_NR 4
+#endif
+
+// Cache blocking: an MC x KC block of A stays in L2, a KC x NC panel of B in L3
+#define GEMM_MC 96
+#define GEMM_KC 256
+#define GEMM_NC 2048
+
+namespace matmul
+{
+    // Custom packing of an operand straight into micro-kernel slivers. x runs over M for A and
+    // over N for B; the callback fills dst[s * r * kc + k * r + i] with element (x0 + s * r + i, k0 + k)
+    // of A, or (k0 + k, x0 + s * r + i) of B, zero-padding past x0 + nx.
+    typedef void (*gemm_pack_func)(const void *ctx, int k0, int kc, int x0, int nx, int r, float *dst);
+
+    // Strided view of a matrix: element (i, j) lives at data[i * rs + j * cs],
+    // unless pack is set, in which case the operand is only ever read through pack(ctx, ...)
+    struct gemm_view
+    {
+        const float *data;
+        long rs, cs;
+        gemm_pack_func pack;
+        const void *ctx;
+    };
+
+    // Timing of the B-packing phase, filled in when gemm_params::stats is set
+    struct gemm_stats
+    {
+        int panels;        // number of KC x NC panels of B
+        double pack_ms;    // time spent packing B
+        double exposed_ms; // part of pack_ms that compute did not hide
+    };
+
+    // Triangular structure the engine exploits. With GEMM_C_LOWER / GEMM_C_UPPER, C is square and only
+    // that triangle (diagonal included) is computed and written. With GEMM_A_LOWER / GEMM_A_UPPER, A is
+    // square and read as that triangle, zero elsewhere; products with its zero part are skipped.
+    enum gemm_triangle
+    {
+        GEMM_FULL,
+        GEMM_C_LOWER,
+        GEMM_C_UPPER,
+        GEMM_A_LOWER,
+        GEMM_A_UPPER,
+    };
+
+    // C = alpha * A * B + beta * C with A (M x K), B (K x N), C (M x N)
+    struct gemm_params
+    {
+        int M, N, K;
+        float alpha, beta;
+        struct gemm_view A, B;
+        float *C;
+        long rs_c, cs_c;
+        int num_thread;
+        // Pack the next panel of B on a helper thread while the workers compute on the current one
+        bool pipeline;
+        struct gemm_stats *stats;
+        enum gemm_triangle triangle;
+    };
+
+    inline struct gemm_view gemm_view_of(const struct matrix *mat)
+    {
+        struct gemm_view view = {mat->data_ptr, mat->column, 1, NULL, NULL};
+        return view;
+    }
+
+    inline struct gemm_view gemm_view_transposed(const struct matrix *mat)
+    {
+        struct gemm_view view = {mat->data_ptr, 1, mat->column, NULL, NULL};
+        return view;
+    }
+
+    // Pack rows x kc of a view into slivers of r rows: sliver s holds dst[s * r * kc + k * r + i].
+    // Rows past the end of the last sliver are zero-filled.
+    void gemm_pack(const float *src, long rs, long cs, int rows, int kc, int r, float *dst);
+    // ab (GEMM_MR x GEMM_NR, row-major) = packed A sliver * packed B sliver
+    void gemm_micro_kernel(int kc, const float *a, const float *b, float *ab);
+    // C[0:m, 0:n] = alpha * ab + beta * C, with beta == 0 never reading C
+    void gemm_update_tile(int m, int n, float alpha, const float *ab, float beta, float *C, long rs_c, long cs_c);
+
+    // Returns false, with C left unchanged, when the packing buffers cannot be allocated
+    bool packed_gemm(const struct gemm_params *params);
+    // Bytes of packing buffers packed_gemm reserves for an M x N product on num_thread threads
+    size_t packed_gemm_scratch_size(int M, int N, int num_thread, bool pipeline);
+    // Page size backing the packing scratch (HUGE_PAGES by default); releases the calling thread's scratch
+    void gemm_set_scratch_pages(enum arena_pages pages);
+}
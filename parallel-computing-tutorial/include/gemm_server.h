@@ -0,0 +1,80 @@
+#pragma once
+
+#include <atomic>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stddef.h>
+
+// Capacity of the submission queue, a power of two
+#define SERVER_QUEUE_SIZE 1024
+// Batches (distinct B operands) being collected at once
+#define SERVER_MAX_OPEN 16
+
+namespace matmul
+{
+    // C (m x n) = A (m x k) * B (k x n), all row-major. The request is also its own future: the server sets
+    // done once C is written, and the caller must keep the request alive until then.
+    struct gemm_request
+    {
+        const float *A;
+        int lda;
+        const float *B;
+        int ldb;
+        float *C;
+        int ldc;
+        int m, n, k;
+        float deadline_us; // latency budget from submission, 0 for just the batch window
+
+        std::atomic<bool> done;
+        bool ok;           // C was written; false when even the request on its own could not be run
+        double latency_ms; // submission to completion
+        // Owned by the server
+        struct gemm_server *server;
+        double submit_ns;
+        struct gemm_request *next;
+    };
+
+    struct gemm_server_config
+    {
+        int num_thread;        // threads packed_gemm starts for each batch; only one batch runs at a time
+        float batch_window_us; // how long the first request of a batch waits for others sharing its B
+        int max_batch_rows;    // a batch reaching this many rows of A runs right away
+    };
+
+    struct gemm_server_stats
+    {
+        long requests, batches, rows;
+    };
+
+    struct gemm_queue_cell
+    {
+        std::atomic<size_t> sequence;
+        struct gemm_request *request;
+    };
+
+    // Requests are taken from any number of threads through a bounded lock-free queue. A dispatcher thread
+    // groups those with the same B, n, k and ldb into one GEMM of the summed rows, runs it on the packed
+    // engine once the batch is full or its window or a member's deadline expires, and completes the requests.
+    // A batch whose stacked GEMM cannot be allocated runs its requests one at a time instead.
+    struct gemm_server
+    {
+        struct gemm_server_config config;
+        struct gemm_queue_cell cells[SERVER_QUEUE_SIZE];
+        alignas(64) std::atomic<size_t> enqueue_pos;
+        alignas(64) std::atomic<size_t> dequeue_pos;
+        alignas(64) std::atomic<bool> running;
+        sem_t pending; // posted per submission, wakes the dispatcher
+        pthread_mutex_t lock;
+        pthread_cond_t completed;
+        pthread_t dispatcher;
+        struct gemm_server_stats stats;
+    };
+
+    bool gemm_server_start(struct gemm_server *server, const struct gemm_server_config *config);
+    // False when the queue is full; the request is left untouched and may be submitted again
+    bool gemm_server_submit(struct gemm_server *server, struct gemm_request *request);
+    // Blocks until the request is complete; returns its ok
+    bool gemm_server_wait(struct gemm_request *request);
+    // Runs everything already submitted, then stops the dispatcher
+    void gemm_server_stop(struct gemm_server *server);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+// Rows of the diagonal blocks that trsm solves by substitution; the rest of B is updated with GEMMs
+#define TRSM_BLOCK 128
+
+namespace matmul
+{
+    // Level-3 routines for row-major matrices with leading dimensions ld*, on the packed GEMM engine.
+    // They compute only the triangle they need and split the work across num_thread threads. Each returns
+    // false when the packing buffers of the GEMM cannot be allocated; the output is then incomplete.
+
+    // C = alpha * A * A^T + beta * C for A (n x k), or C = alpha * A^T * A + beta * C for A (k x n) when
+    // transpose is set. Only the lower or the upper triangle of C is read and written.
+    bool syrk(bool lower, bool transpose, int n, int k, float alpha, const float *A, int lda, float beta, float *C,
+              int ldc, int num_thread = 1);
+    // C = alpha * op(T) * B for triangular T (m x m) and B (m x n), with op(T) = T^T when transpose is set.
+    // Only the lower or the upper triangle of T is read; C must not overlap B.
+    bool trmm(bool lower, bool transpose, int m, int n, float alpha, const float *T, int ldt, const float *B, int ldb,
+              float *C, int ldc, int num_thread = 1);
+    // Solves op(T) * X = alpha * B (left) or X * op(T) = alpha * B (right) for triangular T, overwriting
+    // B (m x n) with X. T is m x m on the left and n x n on the right; a unit diagonal is not read.
+    bool trsm(bool left, bool lower, bool transpose, bool unit_diagonal, int m, int n, float alpha, const float *T,
+              int ldt, float *B, int ldb, int num_thread = 1);
+
+    // Straightforward loops over every element, to validate the routines above
+    void syrk_reference(bool lower, bool transpose, int n, int k, float alpha, const float *A, int lda, float beta,
+                        float *C, int ldc);
+    void trmm_reference(bool lower, bool transpose, int m, int n, float alpha, const float *T, int ldt, const float *B,
+                        int ldb, float *C, int ldc);
+    void trsm_reference(bool left, bool lower, bool transpose, bool unit_diagonal, int m, int n, float alpha,
+                        const float *T, int ldt, float *B, int ldb);
+}
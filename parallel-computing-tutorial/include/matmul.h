@@ -1,3 +1,8 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/time.h>
+
 // Data structures
 struct matrix
 {
@@ -14,10 +19,16 @@ struct thread_args
     int start_i, end_i, blk_size;
 };
 
+namespace matmul
+{
+    struct gemm_stats;
+}
+
 struct optimization_params
 {
     int blk_size;
     int num_thread = 8;
+    struct matmul::gemm_stats *stats = NULL; // optional packing statistics of the packed engines
 };
 
 struct matmul_params
@@ -41,6 +52,8 @@ namespace matmul
             TRANSPOSE_SIMD,
             FAST,
 	        CUDA,
+            PACKED,
+            PIPELINED,
         };
         void naive_mat_mul(const struct matmul_params *params);
         void mat_mul_unrolling(const struct matmul_params *params);
@@ -51,8 +64,12 @@ namespace matmul
         void mat_mul_transpose_simd(const struct matmul_params *params);
         void mat_mul_fast(const struct matmul_params *params);
 	    void mat_mul_cuda(const struct matmul_params *params);
+        void mat_mul_packed(const struct matmul_params *params);
+        void mat_mul_pipelined(const struct matmul_params *params);
         void evaluate(IMP_TYPE type, const struct matmul_params *params);
     private:
         void CHECK_MATRICES(const struct matrix *A, const struct matrix *B, const struct matrix *C);
     };
+
+    float interval_to_ms(struct timeval *start, struct timeval *end);
 }
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+
+namespace matmul
+{
+    // Tile file format: a 4 KB header followed by the tiles in row-major tile order.
+    // Every tile is stored as a full tile x tile row-major block (edge tiles are
+    // zero-padded) and starts on a page boundary, so tiles can be mapped, prefetched
+    // and released independently.
+    #define TILE_FILE_MAGIC "MATTILE1"
+    #define TILE_FILE_HEADER_SIZE 4096
+
+    struct tile_file_header
+    {
+        char magic[8];
+        int rows, cols, tile;
+    };
+
+    struct tiled_matrix
+    {
+        int fd;
+        int rows, cols, tile;
+        int tile_rows, tile_cols; // number of tiles along each dimension
+        size_t tile_stride;       // bytes between consecutive tiles
+        char *map;
+        size_t map_size;
+    };
+
+    // Create (or truncate) a tile file and map it read-write
+    bool tiled_matrix_create(const char *path, int rows, int cols, int tile, struct tiled_matrix *mat);
+    // Map an existing tile file
+    bool tiled_matrix_open(const char *path, bool writable, struct tiled_matrix *mat);
+    // Does nothing for a matrix that is not open: one whose create or open failed, or one
+    // initialized with fd = -1 and map = NULL
+    void tiled_matrix_close(struct tiled_matrix *mat);
+    float *tiled_matrix_tile(const struct tiled_matrix *mat, int ti, int tj);
+
+    // Conversions between a dense row-major matrix and the tile layout
+    void tiled_matrix_from_dense(struct tiled_matrix *mat, const float *data);
+    void tiled_matrix_to_dense(const struct tiled_matrix *mat, float *data);
+
+    struct ooc_stats
+    {
+        int block_rows, block_cols; // C tiles kept resident per block
+        long tiles_read;            // A and B tiles streamed in
+        double ms;
+    };
+
+    // C = A * B over tile files, keeping at most memory_budget bytes of tiles and packing buffers resident.
+    // All three matrices must share the same tile size.
+    bool ooc_gemm(const struct tiled_matrix *A, const struct tiled_matrix *B, struct tiled_matrix *C,
+                  size_t memory_budget, int num_thread, struct ooc_stats *stats);
+}
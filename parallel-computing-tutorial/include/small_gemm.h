@@ -0,0 +1,134 @@
+#pragma once
+
+#include <type_traits>
+#ifdef __SSE__
+#include <immintrin.h> // intel SSE/AVX intrinsic
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+// Shapes routed to the fixed-size kernels by small_gemm_dispatch: M in [4, 32], N and K even and in [4, 32]
+#define SMALL_GEMM_MIN 4
+#define SMALL_GEMM_MAX 32
+
+namespace matmul
+{
+    // One SIMD register of floats per ISA: load / store / broadcast / multiply-add
+#if defined(__AVX__)
+    struct small_vec
+    {
+        typedef __m256 type;
+        static const int width = 8;
+        static inline type zero() { return _mm256_setzero_ps(); }
+        static inline type load(const float *p) { return _mm256_loadu_ps(p); }
+        static inline void store(float *p, type v) { _mm256_storeu_ps(p, v); }
+        static inline type set1(float x) { return _mm256_set1_ps(x); }
+#ifdef __FMA__
+        static inline type fma(type a, type b, type c) { return _mm256_fmadd_ps(a, b, c); }
+#else
+        static inline type fma(type a, type b, type c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+#endif
+    };
+#elif defined(__SSE__)
+    struct small_vec
+    {
+        typedef __m128 type;
+        static const int width = 4;
+        static inline type zero() { return _mm_setzero_ps(); }
+        static inline type load(const float *p) { return _mm_loadu_ps(p); }
+        static inline void store(float *p, type v) { _mm_storeu_ps(p, v); }
+        static inline type set1(float x) { return _mm_set1_ps(x); }
+        static inline type fma(type a, type b, type c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    };
+#elif defined(__ARM_NEON)
+    struct small_vec
+    {
+        typedef float32x4_t type;
+        static const int width = 4;
+        static inline type zero() { return vdupq_n_f32(0); }
+        static inline type load(const float *p) { return vld1q_f32(p); }
+        static inline void store(float *p, type v) { vst1q_f32(p, v); }
+        static inline type set1(float x) { return vdupq_n_f32(x); }
+        static inline type fma(type a, type b, type c) { return vmlaq_f32(c, a, b); }
+    };
+#endif
+
+    // R rows of C starting at row i, accumulated in R * N / width registers
+    template <int R, int N, int K, typename V>
+    inline void small_gemm_rows(const float *A, const float *B, float *C)
+    {
+        const int NV = N / V::width;
+        typename V::type acc[R][NV];
+#pragma GCC unroll 32
+        for (int r = 0; r < R; r++)
+#pragma GCC unroll 32
+            for (int j = 0; j < NV; j++)
+                acc[r][j] = V::zero();
+#pragma GCC unroll 32
+        for (int k = 0; k < K; k++)
+#pragma GCC unroll 32
+            for (int r = 0; r < R; r++)
+            {
+                typename V::type a = V::set1(A[r * K + k]);
+#pragma GCC unroll 32
+                for (int j = 0; j < NV; j++)
+                    acc[r][j] = V::fma(a, V::load(&B[k * N + j * V::width]), acc[r][j]);
+            }
+#pragma GCC unroll 32
+        for (int r = 0; r < R; r++)
+#pragma GCC unroll 32
+            for (int j = 0; j < NV; j++)
+                V::store(&C[r * N + j * V::width], acc[r][j]);
+    }
+
+    template <int R, int N, int K, typename T>
+    inline void small_gemm_rows_scalar(const T *A, const T *B, T *C)
+    {
+        T acc[R][N] = {};
+#pragma GCC unroll 32
+        for (int k = 0; k < K; k++)
+#pragma GCC unroll 32
+            for (int r = 0; r < R; r++)
+#pragma GCC unroll 32
+                for (int j = 0; j < N; j++)
+                    acc[r][j] += A[r * K + k] * B[k * N + j];
+#pragma GCC unroll 32
+        for (int r = 0; r < R; r++)
+#pragma GCC unroll 32
+            for (int j = 0; j < N; j++)
+                C[r * N + j] = acc[r][j];
+    }
+
+    // C (M x N) = A (M x K) * B (K x N), all dense row-major. Sizes are compile-time constants, so every
+    // loop is unrolled and C is built in registers, a block of rows at a time; nothing is allocated and
+    // no thread is started. float with N a multiple of the SIMD width uses the vector registers of the
+    // ISA being compiled, everything else the scalar kernel.
+    template <int M, int N, int K, typename T>
+    inline void small_gemm(const T *A, const T *B, T *C)
+    {
+        static_assert(M > 0 && N > 0 && K > 0, "small_gemm needs positive sizes");
+#if defined(__AVX__) || defined(__SSE__) || defined(__ARM_NEON)
+        if constexpr (std::is_same<T, float>::value && N % small_vec::width == 0)
+        {
+            // About 12 accumulators: leaves registers for the broadcast of A and the load of B
+            const int NV = N / small_vec::width;
+            const int R = NV >= 12 ? 1 : (12 / NV < M ? 12 / NV : M);
+            int i = 0;
+            for (; i + R <= M; i += R)
+                small_gemm_rows<R, N, K, small_vec>(&A[i * K], B, &C[i * N]);
+            if constexpr (M % R != 0)
+                small_gemm_rows<M % R, N, K, small_vec>(&A[i * K], B, &C[i * N]);
+            return;
+        }
+#endif
+        for (int i = 0; i < M; i++)
+            small_gemm_rows_scalar<1, N, K, T>(&A[i * K], B, &C[i * N]);
+    }
+
+    // Whether small_gemm_dispatch has a kernel for the M x N x K shape
+    bool small_gemm_routable(int M, int N, int K);
+    // Runs the fixed-size kernel matching a dense row-major M x N x K float product, if there is one.
+    // Returns false (and leaves C untouched) for shapes outside the instantiated set.
+    bool small_gemm_dispatch(int M, int N, int K, const float *A, const float *B, float *C);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <mpi.h>
+
+namespace matmul
+{
+    // 2D process grid: rank (r, c) sits in row communicator r (rank c) and column communicator c (rank r)
+    struct summa_grid
+    {
+        MPI_Comm comm, row_comm, col_comm;
+        int rows, cols;
+        int my_row, my_col;
+    };
+
+    // rows * cols must equal the size of comm; rows == 0 picks the most square grid
+    bool summa_grid_create(MPI_Comm comm, int rows, int cols, struct summa_grid *grid);
+    void summa_grid_free(struct summa_grid *grid);
+
+    // Block distribution of n items over parts: part idx owns [*start, *start + *len)
+    void summa_block_range(int n, int parts, int idx, int *start, int *len);
+
+    struct summa_params
+    {
+        int M, N, K;
+        int block_size; // width of the broadcast panels along K
+        int num_thread; // threads of the local GEMM
+        // Broadcast the next pair of panels while the local GEMM runs on the current one
+        bool overlap;
+    };
+
+    struct summa_stats
+    {
+        int panels;
+        double total_ms;
+        double wait_ms; // time blocked on panel broadcasts
+    };
+
+    // C = A * B with A, B and C block-distributed over the grid. Every rank passes its local
+    // blocks as dense row-major matrices: A (M rows of its grid row x K columns of its grid
+    // column), B (K rows of its grid row x N columns of its grid column) and C likewise.
+    // Returns false on every rank, with C incomplete, when any rank cannot allocate its GEMM packing buffers.
+    bool summa_gemm(const struct summa_grid *grid, const struct summa_params *params,
+                    const float *A_local, const float *B_local, float *C_local, struct summa_stats *stats);
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stdint.h>
+#ifdef MATMUL_TRACE
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+#endif
+
+// Events kept per lane, a power of two; older ones are overwritten
+#define TRACE_RING_SIZE 4096
+// Threads recording at the same time; a lane is handed to a new thread once its owner exits
+#define TRACE_MAX_LANES 256
+
+namespace matmul
+{
+    // Hot-path tracing of the threaded engines, compiled in with -DMATMUL_TRACE (make TRACE=1) and to
+    // nothing otherwise. Every thread stamps the begin and end of each phase with the cycle counter into
+    // its own ring buffer, so recording takes no lock.
+    enum trace_phase
+    {
+        TRACE_PACK,   // copying operands into packed slivers
+        TRACE_KERNEL, // multiply-adds
+        TRACE_REDUCE, // combining partial results, such as softmax row statistics
+        TRACE_WAIT,   // barriers, joins and idle waits
+    };
+
+    // Drops the events recorded so far; not to be called while an engine is running
+    void trace_reset();
+    // Writes the events since trace_reset as Chrome trace JSON, for chrome://tracing or Perfetto
+    bool trace_dump(const char *path);
+
+#ifdef MATMUL_TRACE
+    inline uint64_t trace_clock()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#elif defined(__aarch64__)
+        uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+    }
+
+    void trace_record(enum trace_phase phase, uint64_t begin, uint64_t end);
+
+    // Records its phase from construction to the end of the enclosing block
+    struct trace_scope
+    {
+        enum trace_phase phase;
+        uint64_t begin;
+        trace_scope(enum trace_phase p) : phase(p), begin(trace_clock()) {}
+        ~trace_scope() { trace_record(phase, begin, trace_clock()); }
+    };
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(phase) struct matmul::trace_scope TRACE_CONCAT(trace_scope_, __LINE__)(phase)
+#else
+#define TRACE_SCOPE(phase) ((void)0)
+#endif
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+namespace matmul
+{
+    // Out-of-place transpose: dst (cols x rows) = src (rows x cols) ^ T.
+    // ld_src / ld_dst are the row strides (in elements) of src and dst.
+    void transpose(const float *src, int ld_src, float *dst, int ld_dst, int rows, int cols, int num_thread = 1);
+    void transpose(const float *src, float *dst, int rows, int cols, int num_thread = 1);
+
+    // In-place transpose of a dense rows x cols matrix. Square matrices are
+    // transposed by blocked swaps, non-square ones by following the cycles of
+    // the permutation k -> k * rows mod (rows * cols - 1). Returns false, with
+    // data unchanged, when the bitmap of visited elements cannot be allocated.
+    bool transpose_inplace(float *data, int rows, int cols);
+}
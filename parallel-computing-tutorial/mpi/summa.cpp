@@ -0,0 +1,198 @@
+#include "summa.h"
+#include "gemm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <vector>
+
+// Rows of local C updated between two progress polls of the pending broadcasts
+#define SUMMA_POLL_ROWS 128
+
+namespace matmul
+{
+    bool summa_grid_create(MPI_Comm comm, int rows, int cols, struct summa_grid *grid)
+    {
+        int size, rank;
+        MPI_Comm_size(comm, &size);
+        MPI_Comm_rank(comm, &rank);
+
+        if (rows == 0)
+        {
+            rows = (int)sqrt((double)size);
+            while (size % rows != 0)
+                rows--;
+            cols = size / rows;
+        }
+        if (rows * cols != size)
+        {
+            if (rank == 0)
+                fprintf(stderr, "summa: a %d x %d grid does not match %d ranks\n", rows, cols, size);
+            return false;
+        }
+
+        grid->comm = comm;
+        grid->rows = rows;
+        grid->cols = cols;
+        grid->my_row = rank / cols;
+        grid->my_col = rank % cols;
+        MPI_Comm_split(comm, grid->my_row, grid->my_col, &grid->row_comm);
+        MPI_Comm_split(comm, grid->my_col, grid->my_row, &grid->col_comm);
+        return true;
+    }
+
+    void summa_grid_free(struct summa_grid *grid)
+    {
+        MPI_Comm_free(&grid->row_comm);
+        MPI_Comm_free(&grid->col_comm);
+    }
+
+    void summa_block_range(int n, int parts, int idx, int *start, int *len)
+    {
+        *start = (int)((long)n * idx / parts);
+        *len = (int)((long)n * (idx + 1) / parts) - *start;
+    }
+
+    // A K-panel lies inside one column block of A and one row block of B
+    struct summa_panel
+    {
+        int k0, width;
+        int a_owner, b_owner; // grid column owning the A columns, grid row owning the B rows
+    };
+
+    static std::vector<struct summa_panel> plan_panels(const struct summa_grid *grid, int K, int block_size)
+    {
+        std::vector<struct summa_panel> panels;
+        int a_owner = 0, b_owner = 0, a_start, a_len, b_start, b_len;
+        summa_block_range(K, grid->cols, 0, &a_start, &a_len);
+        summa_block_range(K, grid->rows, 0, &b_start, &b_len);
+
+        for (int k = 0; k < K;)
+        {
+            while (k >= a_start + a_len)
+                summa_block_range(K, grid->cols, ++a_owner, &a_start, &a_len);
+            while (k >= b_start + b_len)
+                summa_block_range(K, grid->rows, ++b_owner, &b_start, &b_len);
+            int end = k + block_size;
+            if (end > a_start + a_len)
+                end = a_start + a_len;
+            if (end > b_start + b_len)
+                end = b_start + b_len;
+            struct summa_panel panel = {k, end - k, a_owner, b_owner};
+            panels.push_back(panel);
+            k = end;
+        }
+        return panels;
+    }
+
+    struct summa_buffers
+    {
+        float *A, *B;
+        MPI_Request requests[2];
+    };
+
+    // Owners copy their slice of the panel into the buffers, then everyone joins the broadcasts
+    static void post_panel(const struct summa_grid *grid, const struct summa_panel *panel, int m, int n,
+                           const float *A_local, int lda, int a_col0, const float *B_local, int b_row0, struct summa_buffers *buf)
+    {
+        if (grid->my_col == panel->a_owner)
+            for (int i = 0; i < m; i++)
+                memcpy(&buf->A[i * panel->width], &A_local[(long)i * lda + panel->k0 - a_col0], panel->width * sizeof(float));
+        if (grid->my_row == panel->b_owner)
+            memcpy(buf->B, &B_local[(long)(panel->k0 - b_row0) * n], (size_t)panel->width * n * sizeof(float));
+
+        MPI_Ibcast(buf->A, m * panel->width, MPI_FLOAT, panel->a_owner, grid->row_comm, &buf->requests[0]);
+        MPI_Ibcast(buf->B, panel->width * n, MPI_FLOAT, panel->b_owner, grid->col_comm, &buf->requests[1]);
+    }
+
+    bool summa_gemm(const struct summa_grid *grid, const struct summa_params *params,
+                    const float *A_local, const float *B_local, float *C_local, struct summa_stats *stats)
+    {
+        assert(params->block_size > 0);
+        int m_start, m, n_start, n, a_col0, lda, b_row0, b_len;
+        summa_block_range(params->M, grid->rows, grid->my_row, &m_start, &m);
+        summa_block_range(params->N, grid->cols, grid->my_col, &n_start, &n);
+        summa_block_range(params->K, grid->cols, grid->my_col, &a_col0, &lda);
+        summa_block_range(params->K, grid->rows, grid->my_row, &b_row0, &b_len);
+
+        double start = MPI_Wtime(), wait = 0;
+        std::vector<struct summa_panel> panels = plan_panels(grid, params->K, params->block_size);
+        int num_panel = (int)panels.size();
+
+        // Double-buffered panels: panel t + 1 is in flight while panel t is multiplied
+        std::vector<float> storage(2 * ((size_t)m + n) * params->block_size);
+        struct summa_buffers buf[2];
+        for (int j = 0; j < 2; j++)
+        {
+            buf[j].A = storage.data() + j * ((size_t)m + n) * params->block_size;
+            buf[j].B = buf[j].A + (size_t)m * params->block_size;
+        }
+
+        struct gemm_params gemm = {};
+        gemm.N = n;
+        gemm.alpha = 1.0f;
+        gemm.B.cs = 1;
+        gemm.A.cs = 1;
+        gemm.rs_c = n;
+        gemm.cs_c = 1;
+        gemm.num_thread = params->num_thread;
+        gemm.pipeline = false;
+        gemm.stats = NULL;
+
+        // A rank whose local GEMM fails keeps joining the broadcasts so that the others do not hang
+        int ok = 1;
+        if (num_panel == 0)
+            memset(C_local, 0, (size_t)m * n * sizeof(float));
+        if (params->overlap && num_panel > 0)
+            post_panel(grid, &panels[0], m, n, A_local, lda, a_col0, B_local, b_row0, &buf[0]);
+
+        for (int t = 0; t < num_panel; t++)
+        {
+            struct summa_buffers *cur = &buf[t & 1];
+            if (!params->overlap)
+                post_panel(grid, &panels[t], m, n, A_local, lda, a_col0, B_local, b_row0, cur);
+
+            double wait_start = MPI_Wtime();
+            MPI_Waitall(2, cur->requests, MPI_STATUSES_IGNORE);
+            wait += MPI_Wtime() - wait_start;
+
+            struct summa_buffers *next = NULL;
+            if (params->overlap && t + 1 < num_panel)
+            {
+                next = &buf[(t + 1) & 1];
+                post_panel(grid, &panels[t + 1], m, n, A_local, lda, a_col0, B_local, b_row0, next);
+            }
+
+            // Local C += A panel * B panel, polling the next broadcasts between row blocks
+            // so that MPI can progress them while the GEMM runs
+            gemm.K = panels[t].width;
+            gemm.beta = t == 0 ? 0.0f : 1.0f;
+            gemm.A.rs = panels[t].width;
+            gemm.B.rs = n;
+            gemm.B.data = cur->B;
+            for (int i = 0; i < m; i += SUMMA_POLL_ROWS)
+            {
+                gemm.M = m - i < SUMMA_POLL_ROWS ? m - i : SUMMA_POLL_ROWS;
+                gemm.A.data = &cur->A[(long)i * panels[t].width];
+                gemm.C = &C_local[(long)i * n];
+                if (ok && !packed_gemm(&gemm))
+                    ok = 0;
+                if (next)
+                {
+                    int done;
+                    MPI_Testall(2, next->requests, &done, MPI_STATUSES_IGNORE);
+                }
+            }
+        }
+
+        if (stats)
+        {
+            stats->panels = num_panel;
+            stats->total_ms = (MPI_Wtime() - start) * 1e3;
+            stats->wait_ms = wait * 1e3;
+        }
+        MPI_Allreduce(MPI_IN_PLACE, &ok, 1, MPI_INT, MPI_LAND, grid->comm);
+        return ok;
+    }
+}
@@ -0,0 +1,137 @@
+#include "summa.h"
+#include "gemm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+
+#define MAX_PRECISION_ERROR 0.01
+#define NUM_THREAD 1
+
+using namespace matmul;
+
+// Every rank generates its own blocks of the global matrices from the element index
+static float element(int i, int j, uint32_t seed)
+{
+    uint32_t h = (uint32_t)i * 2654435761u ^ ((uint32_t)j + seed) * 2246822519u;
+    h ^= h >> 15;
+    h *= 2654435761u;
+    h ^= h >> 13;
+    return (h & 0xffffff) / (float)0x1000000;
+}
+
+static void fill_block(std::vector<float> &block, int row0, int rows, int col0, int cols, uint32_t seed)
+{
+    block.resize((size_t)rows * cols);
+    for (int i = 0; i < rows; i++)
+        for (int j = 0; j < cols; j++)
+            block[(size_t)i * cols + j] = element(row0 + i, col0 + j, seed);
+}
+
+int main(int argc, char *argv[])
+{
+    MPI_Init(&argc, &argv);
+    int rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    struct summa_params params;
+    params.M = params.N = params.K = 1024;
+    params.block_size = 128;
+    params.num_thread = NUM_THREAD;
+    int grid_rows = 0, grid_cols = 0;
+    if (argc >= 5)
+    {
+        params.M = atoi(argv[1]);
+        params.N = atoi(argv[2]);
+        params.K = atoi(argv[3]);
+        params.block_size = atoi(argv[4]);
+    }
+    if (argc >= 7)
+    {
+        grid_rows = atoi(argv[5]);
+        grid_cols = atoi(argv[6]);
+    }
+    if ((argc != 1 && argc != 5 && argc != 7) || params.block_size <= 0)
+    {
+        if (rank == 0)
+            printf("Usage: mpirun -np P %s [M N K block_size [grid_rows grid_cols]]\n", argv[0]);
+        MPI_Finalize();
+        return 1;
+    }
+
+    struct summa_grid grid;
+    if (!summa_grid_create(MPI_COMM_WORLD, grid_rows, grid_cols, &grid))
+    {
+        MPI_Finalize();
+        return 1;
+    }
+
+    int m0, m, n0, n, ka0, ka, kb0, kb;
+    summa_block_range(params.M, grid.rows, grid.my_row, &m0, &m);
+    summa_block_range(params.N, grid.cols, grid.my_col, &n0, &n);
+    summa_block_range(params.K, grid.cols, grid.my_col, &ka0, &ka);
+    summa_block_range(params.K, grid.rows, grid.my_row, &kb0, &kb);
+
+    std::vector<float> A_local, B_local, C_local((size_t)m * n), A_strip, B_strip, C_ref((size_t)m * n);
+    fill_block(A_local, m0, m, ka0, ka, 1);
+    fill_block(B_local, kb0, kb, n0, n, 2);
+
+    // Reference for this rank's block of C: its full row strip of A times its full column strip of B
+    fill_block(A_strip, m0, m, 0, params.K, 1);
+    fill_block(B_strip, 0, params.K, n0, n, 2);
+    struct gemm_params ref = {};
+    ref.M = m; ref.N = n; ref.K = params.K;
+    ref.alpha = 1.0f; ref.beta = 0.0f;
+    ref.A.data = A_strip.data(); ref.A.rs = params.K; ref.A.cs = 1;
+    ref.B.data = B_strip.data(); ref.B.rs = n; ref.B.cs = 1;
+    ref.C = C_ref.data(); ref.rs_c = n; ref.cs_c = 1;
+    ref.num_thread = NUM_THREAD; ref.pipeline = false; ref.stats = NULL;
+    // The other ranks are already in collectives, so a local failure takes the job down
+    if (!packed_gemm(&ref))
+        MPI_Abort(MPI_COMM_WORLD, 1);
+
+    if (rank == 0)
+        printf("SUMMA %d x %d x %d on a %d x %d grid, block size %d\n", params.M, params.N, params.K, grid.rows, grid.cols, params.block_size);
+
+    for (int overlap = 0; overlap < 2; overlap++)
+    {
+        struct summa_stats stats;
+        params.overlap = overlap;
+        bool ok = summa_gemm(&grid, &params, A_local.data(), B_local.data(), C_local.data(), &stats); // warm-up
+        MPI_Barrier(MPI_COMM_WORLD);
+        ok = summa_gemm(&grid, &params, A_local.data(), B_local.data(), C_local.data(), &stats) && ok;
+        if (!ok)
+        {
+            // The status is agreed on by all ranks, so they all skip the reductions below
+            if (rank == 0)
+                printf("summa_gemm (%s) failed\n", overlap ? "overlapped" : "blocking");
+            continue;
+        }
+
+        float error = 0;
+        for (size_t i = 0; i < C_ref.size(); i++)
+        {
+            float e = fabs((C_local[i] - C_ref[i]) / C_ref[i]);
+            if (e > error)
+                error = e;
+        }
+        double times[2] = {stats.total_ms, stats.wait_ms}, max_times[2];
+        float max_error;
+        MPI_Reduce(times, max_times, 2, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+        MPI_Reduce(&error, &max_error, 1, MPI_FLOAT, MPI_MAX, 0, MPI_COMM_WORLD);
+        if (rank == 0)
+        {
+            printf("summa_gemm (%s): %.2f ms, %.2f GFLOP/s, %d panels, max broadcast wait %.2f ms\n",
+                   overlap ? "overlapped" : "blocking", max_times[0], 2.0 * params.M * params.N * params.K / max_times[0] / 1e6,
+                   stats.panels, max_times[1]);
+            if (max_error > MAX_PRECISION_ERROR)
+                printf("incorrect output of summa_gemm (max relative error %g)\n", max_error);
+        }
+    }
+
+    summa_grid_free(&grid);
+    MPI_Finalize();
+    return 0;
+}
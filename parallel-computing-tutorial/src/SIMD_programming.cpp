@@ -1,6 +1,7 @@
 #include "matmul.h"
+#include "transpose.h"
+#include "arena.h"
 #include <stdio.h>
-#include <assert.h>
 #ifdef __SSE__
 #include <xmmintrin.h> // intel SSE intrinsic
 #endif
@@ -8,8 +9,8 @@
 #include <arm_neon.h>
 #endif
 
-#define MAX_TRANSPOSE_BUFFER 10 * 1024 * 1024
-float transpose_tmp[MAX_TRANSPOSE_BUFFER];
+// Scratch for the transposed B, reused across calls
+static matmul::arena transpose_scratch;
 
 namespace matmul
 {
@@ -35,10 +36,22 @@ namespace matmul
         float *data_A = A->data_ptr, *data_B = B->data_ptr, *data_C = C->data_ptr;
         CHECK_MATRICES(A, B, C);
 
-        // transpose the B
-        for (i = 0; i < B->column; i++)
-            for (j = 0; j < B->row; j++)
-                transpose_tmp[i * B->row + j] = data_B[j * B->column + i];
+        // transpose the B; without room for the copy, fall back to reading B by column
+        if (!arena_reserve(&transpose_scratch, (size_t)B->row * B->column * sizeof(float), HUGE_PAGES))
+        {
+            fprintf(stderr, "mat_mul_transpose_simd: cannot allocate the transposed B, using the scalar loop\n");
+            for (i = 0; i < C->row; i++)
+                for (j = 0; j < C->column; j++)
+                {
+                    float acc = 0;
+                    for (k = 0; k < A->column; k++)
+                        acc += data_A[i * A->column + k] * data_B[k * B->column + j];
+                    data_C[i * C->column + j] = acc;
+                }
+            return;
+        }
+        float *transpose_tmp = (float *)arena_alloc(&transpose_scratch, (size_t)B->row * B->column * sizeof(float));
+        transpose(data_B, transpose_tmp, B->row, B->column);
 
         for (i = 0; i < C->row; i++)
             for (j = 0; j < C->column; j++)
@@ -0,0 +1,104 @@
+#include "arena.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#define SMALL_PAGE_SIZE 4096
+
+namespace matmul
+{
+    static char *map_anonymous(size_t size, int extra_flags)
+    {
+        void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | extra_flags, -1, 0);
+        return p == MAP_FAILED ? NULL : (char *)p;
+    }
+
+    bool arena_init(struct arena *a, size_t size, enum arena_pages pages)
+    {
+        a->base = NULL;
+        a->size = a->used = 0;
+        a->pages = pages;
+
+#ifdef MAP_HUGETLB
+        if (pages == HUGETLB_PAGES)
+        {
+            size_t huge_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            a->base = map_anonymous(huge_size, MAP_HUGETLB);
+            if (a->base)
+            {
+                a->size = huge_size;
+                return true;
+            }
+        }
+#endif
+        if (pages != SMALL_PAGES)
+        {
+            // Over-allocate by one huge page and trim, so the arena starts on a 2 MB boundary
+            size_t huge_size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+            char *raw = map_anonymous(huge_size + HUGE_PAGE_SIZE, 0);
+            if (raw == NULL)
+            {
+                perror("mmap");
+                return false;
+            }
+            char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+            if (aligned > raw)
+                munmap(raw, aligned - raw);
+            munmap(aligned + huge_size, raw + HUGE_PAGE_SIZE - aligned);
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, huge_size, MADV_HUGEPAGE);
+#endif
+            a->base = aligned;
+            a->size = huge_size;
+            a->pages = HUGE_PAGES;
+            return true;
+        }
+
+        size = (size + SMALL_PAGE_SIZE - 1) / SMALL_PAGE_SIZE * SMALL_PAGE_SIZE;
+        a->base = map_anonymous(size, 0);
+        if (a->base == NULL)
+        {
+            perror("mmap");
+            return false;
+        }
+#ifdef MADV_NOHUGEPAGE
+        madvise(a->base, size, MADV_NOHUGEPAGE);
+#endif
+        a->size = size;
+        return true;
+    }
+
+    void arena_destroy(struct arena *a)
+    {
+        if (a->base)
+            munmap(a->base, a->size);
+        a->base = NULL;
+        a->size = a->used = 0;
+    }
+
+    void *arena_alloc(struct arena *a, size_t bytes)
+    {
+        size_t offset = (a->used + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+        if (a->base == NULL || offset + bytes > a->size)
+            return NULL;
+        a->used = offset + bytes;
+        return a->base + offset;
+    }
+
+    void arena_reset(struct arena *a)
+    {
+        a->used = 0;
+    }
+
+    bool arena_reserve(struct arena *a, size_t size, enum arena_pages pages)
+    {
+        if (a->base && a->size >= size)
+        {
+            arena_reset(a);
+            return true;
+        }
+        arena_destroy(a);
+        return arena_init(a, size, pages);
+    }
+}
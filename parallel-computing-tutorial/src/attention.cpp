@@ -0,0 +1,309 @@
+#include "attention.h"
+#include "gemm.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+namespace matmul
+{
+    // Score matrix of the unfused path, or the per-worker tiles of the fused one
+    struct attention_scratch
+    {
+        struct arena buffers = {};
+        ~attention_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct attention_scratch scratch;
+
+    // Working set of one fused worker: packed Q rows, packed K / V / P tiles for the micro-kernel,
+    // the score tile, and the running max, sum and unnormalized output of its ATTN_BR query rows
+    struct attention_tile
+    {
+        float *Qp, *Kp, *Vp, *Pp, *S, *acc, *m, *l;
+    };
+
+    static inline size_t round_up(size_t n, size_t r)
+    {
+        return (n + r - 1) / r * r;
+    }
+
+    // Sizes in floats of the tile buffers, in the order of struct attention_tile
+    static void tile_sizes(int head_dim, size_t sizes[8])
+    {
+        sizes[0] = round_up(ATTN_BR, GEMM_MR) * head_dim;
+        sizes[1] = round_up(ATTN_BC, GEMM_NR) * head_dim;
+        sizes[2] = round_up(head_dim, GEMM_NR) * ATTN_BC;
+        sizes[3] = round_up(ATTN_BR, GEMM_MR) * ATTN_BC;
+        sizes[4] = ATTN_BR * ATTN_BC;
+        sizes[5] = (size_t)ATTN_BR * head_dim;
+        sizes[6] = sizes[7] = ATTN_BR;
+    }
+
+    static size_t tile_bytes(int head_dim)
+    {
+        size_t sizes[8], bytes = 0;
+        tile_sizes(head_dim, sizes);
+        for (int j = 0; j < 8; j++)
+            bytes += round_up(sizes[j] * sizeof(float), ARENA_ALIGNMENT);
+        return bytes;
+    }
+
+    static inline float scale_of(const struct attention_params *p)
+    {
+        return p->scale != 0 ? p->scale : 1.0f / sqrtf((float)p->head_dim);
+    }
+
+    // Number of keys query row i may attend to
+    static inline int visible_keys(const struct attention_params *p, int i)
+    {
+        if (!p->causal)
+            return p->seq_kv;
+        int n = i + p->seq_kv - p->seq_q + 1;
+        return n < 0 ? 0 : (n > p->seq_kv ? p->seq_kv : n);
+    }
+
+    // C (m x n, leading dimension ldc) = alpha * packed A * packed B + beta * C, tile by tile
+    static void tile_product(int m, int n, int kc, float alpha, const float *Ap, const float *Bp, float beta, float *C, int ldc)
+    {
+        TRACE_SCOPE(TRACE_KERNEL);
+        alignas(64) float ab[GEMM_MR * GEMM_NR];
+        for (int jr = 0; jr < n; jr += GEMM_NR)
+            for (int ir = 0; ir < m; ir += GEMM_MR)
+            {
+                gemm_micro_kernel(kc, &Ap[ir * kc], &Bp[jr * kc], ab);
+                gemm_update_tile(m - ir < GEMM_MR ? m - ir : GEMM_MR, n - jr < GEMM_NR ? n - jr : GEMM_NR, alpha, ab,
+                                 beta, &C[ir * ldc + jr], ldc, 1);
+            }
+    }
+
+    // Turns the scores of one K/V tile into probabilities under the running row maxima, rescaling the rows'
+    // sums and accumulators to the new maxima
+    static void online_softmax(const struct attention_params *p, int q0, int rows, int k0, int cols,
+                               const struct attention_tile *t)
+    {
+        TRACE_SCOPE(TRACE_REDUCE);
+        int d = p->head_dim;
+        for (int i = 0; i < rows; i++)
+        {
+            float *s = &t->S[i * ATTN_BC];
+            int limit = visible_keys(p, q0 + i) - k0;
+            limit = limit < 0 ? 0 : (limit > cols ? cols : limit);
+            for (int j = limit; j < cols; j++)
+                s[j] = 0;
+            if (limit == 0)
+                continue;
+
+            // Online softmax: rescale what was accumulated under the old maximum
+            float m = t->m[i];
+            for (int j = 0; j < limit; j++)
+                m = s[j] > m ? s[j] : m;
+            float correction = expf(t->m[i] - m), sum = 0;
+            for (int j = 0; j < limit; j++)
+            {
+                s[j] = expf(s[j] - m);
+                sum += s[j];
+            }
+            t->m[i] = m;
+            t->l[i] = t->l[i] * correction + sum;
+            float *acc = &t->acc[i * d];
+            for (int c = 0; c < d; c++)
+                acc[c] *= correction;
+        }
+    }
+
+    // Query rows q0 .. q0 + rows of one head against all its keys, one K/V tile at a time
+    static void attend_rows(const struct attention_params *p, const float *Q, const float *K, const float *V, float *O,
+                            int q0, int rows, const struct attention_tile *t)
+    {
+        int d = p->head_dim;
+        for (int i = 0; i < rows; i++)
+        {
+            t->m[i] = -INFINITY;
+            t->l[i] = 0;
+        }
+        memset(t->acc, 0, (size_t)rows * d * sizeof(float));
+        gemm_pack(&Q[(long)q0 * d], d, 1, rows, d, GEMM_MR, t->Qp);
+
+        int kv_end = visible_keys(p, q0 + rows - 1);
+        for (int k0 = 0; k0 < kv_end; k0 += ATTN_BC)
+        {
+            int cols = kv_end - k0 < ATTN_BC ? kv_end - k0 : ATTN_BC;
+            // S = scale * Q_rows * K_tile^T
+            gemm_pack(&K[(long)k0 * d], d, 1, cols, d, GEMM_NR, t->Kp);
+            tile_product(rows, cols, d, scale_of(p), t->Qp, t->Kp, 0.0f, t->S, ATTN_BC);
+
+            online_softmax(p, q0, rows, k0, cols, t);
+
+            // acc += P * V_tile
+            gemm_pack(t->S, ATTN_BC, 1, rows, cols, GEMM_MR, t->Pp);
+            gemm_pack(&V[(long)k0 * d], 1, d, d, cols, GEMM_NR, t->Vp);
+            tile_product(rows, d, cols, 1.0f, t->Pp, t->Vp, 1.0f, t->acc, d);
+        }
+
+        for (int i = 0; i < rows; i++)
+        {
+            float inv = t->l[i] > 0 ? 1.0f / t->l[i] : 0.0f;
+            for (int c = 0; c < d; c++)
+                O[(long)(q0 + i) * d + c] = t->acc[i * d + c] * inv;
+        }
+    }
+
+    struct attention_thread_args
+    {
+        const struct attention_params *p;
+        const float *Q, *K, *V;
+        float *O;
+        int tid, num_thread;
+        struct attention_tile tile;
+    };
+
+    static void *attention_thread_func(void *args)
+    {
+        struct attention_thread_args *a = (struct attention_thread_args *)args;
+        const struct attention_params *p = a->p;
+        int q_blocks = (p->seq_q + ATTN_BR - 1) / ATTN_BR;
+        long q_size = (long)p->seq_q * p->head_dim, kv_size = (long)p->seq_kv * p->head_dim;
+
+        // Round-robin over (head, query block) so causal blocks of every length are spread out
+        for (int item = a->tid; item < p->heads * q_blocks; item += a->num_thread)
+        {
+            int h = item / q_blocks, q0 = item % q_blocks * ATTN_BR;
+            int rows = p->seq_q - q0 < ATTN_BR ? p->seq_q - q0 : ATTN_BR;
+            attend_rows(p, &a->Q[h * q_size], &a->K[h * kv_size], &a->V[h * kv_size], &a->O[h * q_size], q0, rows,
+                        &a->tile);
+        }
+        return NULL;
+    }
+
+    static bool attention_fused(const struct attention_params *p, const float *Q, const float *K, const float *V,
+                                float *O)
+    {
+        int j, num_thread = p->num_thread;
+        size_t bytes = tile_bytes(p->head_dim), sizes[8];
+        tile_sizes(p->head_dim, sizes);
+        if (!arena_reserve(&scratch.buffers, bytes * num_thread, HUGE_PAGES))
+        {
+            fprintf(stderr, "attention: cannot allocate %zu bytes of tiles\n", bytes * num_thread);
+            return false;
+        }
+
+        pthread_t thread_pool[num_thread];
+        struct attention_thread_args threads_args[num_thread];
+        for (j = 0; j < num_thread; j++)
+        {
+            float **buffers[8] = {&threads_args[j].tile.Qp, &threads_args[j].tile.Kp, &threads_args[j].tile.Vp,
+                                  &threads_args[j].tile.Pp, &threads_args[j].tile.S, &threads_args[j].tile.acc,
+                                  &threads_args[j].tile.m, &threads_args[j].tile.l};
+            for (int b = 0; b < 8; b++)
+                *buffers[b] = (float *)arena_alloc(&scratch.buffers, sizes[b] * sizeof(float));
+            threads_args[j].p = p;
+            threads_args[j].Q = Q;
+            threads_args[j].K = K;
+            threads_args[j].V = V;
+            threads_args[j].O = O;
+            threads_args[j].tid = j;
+            threads_args[j].num_thread = num_thread;
+            pthread_create(&thread_pool[j], NULL, attention_thread_func, &threads_args[j]);
+        }
+        TRACE_SCOPE(TRACE_WAIT);
+        for (j = 0; j < num_thread; j++)
+            pthread_join(thread_pool[j], NULL);
+        return true;
+    }
+
+    // softmaxCPU-style pass over each score row, masked entries set to zero
+    static void softmax_rows(const struct attention_params *p, float *S)
+    {
+        for (int i = 0; i < p->seq_q; i++)
+        {
+            float *s = &S[(long)i * p->seq_kv];
+            int n = visible_keys(p, i);
+            float m = -INFINITY, sum = 0;
+            for (int j = 0; j < n; j++)
+                m = s[j] > m ? s[j] : m;
+            for (int j = 0; j < n; j++)
+            {
+                s[j] = expf(s[j] - m);
+                sum += s[j];
+            }
+            for (int j = 0; j < n; j++)
+                s[j] /= sum;
+            for (int j = n; j < p->seq_kv; j++)
+                s[j] = 0;
+        }
+    }
+
+    static bool attention_unfused(const struct attention_params *p, const float *Q, const float *K, const float *V,
+                                  float *O)
+    {
+        size_t bytes = attention_scratch_size(p, ATTENTION_UNFUSED);
+        if (!arena_reserve(&scratch.buffers, bytes + ARENA_ALIGNMENT, HUGE_PAGES))
+        {
+            fprintf(stderr, "attention: cannot allocate %zu bytes of scores\n", bytes);
+            return false;
+        }
+        float *S = (float *)arena_alloc(&scratch.buffers, bytes);
+        long q_size = (long)p->seq_q * p->head_dim, kv_size = (long)p->seq_kv * p->head_dim;
+
+        struct gemm_params gemm = {};
+        gemm.alpha = 1.0f;
+        gemm.beta = 0.0f;
+        gemm.cs_c = 1;
+        gemm.num_thread = p->num_thread;
+        gemm.pipeline = false;
+        gemm.stats = NULL;
+        for (int h = 0; h < p->heads; h++)
+        {
+            // S = scale * Q * K^T, read K through a transposed view
+            gemm.M = p->seq_q;
+            gemm.N = p->seq_kv;
+            gemm.K = p->head_dim;
+            gemm.alpha = scale_of(p);
+            gemm.A.data = &Q[h * q_size];
+            gemm.A.rs = p->head_dim;
+            gemm.A.cs = 1;
+            gemm.B.data = &K[h * kv_size];
+            gemm.B.rs = 1;
+            gemm.B.cs = p->head_dim;
+            gemm.C = S;
+            gemm.rs_c = p->seq_kv;
+            if (!packed_gemm(&gemm))
+                return false;
+
+            softmax_rows(p, S);
+
+            // O = P * V
+            gemm.N = p->head_dim;
+            gemm.K = p->seq_kv;
+            gemm.alpha = 1.0f;
+            gemm.A.data = S;
+            gemm.A.rs = p->seq_kv;
+            gemm.B.data = &V[h * kv_size];
+            gemm.B.rs = p->head_dim;
+            gemm.B.cs = 1;
+            gemm.C = &O[h * q_size];
+            gemm.rs_c = p->head_dim;
+            if (!packed_gemm(&gemm))
+                return false;
+        }
+        return true;
+    }
+
+    size_t attention_scratch_size(const struct attention_params *p, enum attention_algo algo)
+    {
+        if (algo == ATTENTION_UNFUSED)
+            return (size_t)p->seq_q * p->seq_kv * sizeof(float);
+        return tile_bytes(p->head_dim) * p->num_thread;
+    }
+
+    bool attention(const struct attention_params *p, enum attention_algo algo, const float *Q, const float *K,
+                   const float *V, float *O)
+    {
+        assert(p->heads > 0 && p->seq_q > 0 && p->seq_kv > 0 && p->head_dim > 0 && p->num_thread > 0);
+        if (algo == ATTENTION_FUSED)
+            return attention_fused(p, Q, K, V, O);
+        return attention_unfused(p, Q, K, V, O);
+    }
+}
@@ -0,0 +1,241 @@
+#include "bsr.h"
+#include "gemm.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+namespace matmul
+{
+    // B packed into micro-kernel slivers
+    struct bsr_scratch
+    {
+        struct arena buffers = {};
+        ~bsr_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct bsr_scratch scratch;
+
+    static inline int min_int(int a, int b)
+    {
+        return a < b ? a : b;
+    }
+
+    // Element (i, k) of a block row whose tiles span length columns once packed
+    static inline long tile_offset(int i, long k, long length)
+    {
+        return i / GEMM_MR * GEMM_MR * length + k * GEMM_MR + i % GEMM_MR;
+    }
+
+    static bool tile_nonzero(const float *A, int lda, int m, int n)
+    {
+        for (int i = 0; i < m; i++)
+            for (int j = 0; j < n; j++)
+                if (A[(long)i * lda + j] != 0)
+                    return true;
+        return false;
+    }
+
+    bool bsr_from_dense(const float *A, int rows, int cols, int lda, int block, struct bsr_matrix *S)
+    {
+        memset(S, 0, sizeof(*S));
+        S->rows = rows;
+        S->cols = cols;
+        S->block = block;
+        S->block_rows = (rows + block - 1) / block;
+        S->block_cols = (cols + block - 1) / block;
+        S->tile_size = (size_t)(block + GEMM_MR - 1) / GEMM_MR * GEMM_MR * block;
+
+        for (int bi = 0; bi < S->block_rows; bi++)
+            for (int bj = 0; bj < S->block_cols; bj++)
+                S->nnz_blocks += tile_nonzero(&A[(long)bi * block * lda + bj * block], lda, min_int(block, rows - bi * block),
+                                              min_int(block, cols - bj * block));
+
+        size_t bitmap_words = ((size_t)S->block_rows * S->block_cols + 63) / 64;
+        size_t sizes[4] = {(S->block_rows + 1) * sizeof(int), S->nnz_blocks * sizeof(int), bitmap_words * sizeof(uint64_t),
+                           S->nnz_blocks * S->tile_size * sizeof(float)};
+        if (!arena_init(&S->storage, sizes[0] + sizes[1] + sizes[2] + sizes[3] + 4 * ARENA_ALIGNMENT, HUGE_PAGES))
+        {
+            fprintf(stderr, "bsr_from_dense: cannot allocate %d tiles\n", S->nnz_blocks);
+            return false;
+        }
+        S->row_ptr = (int *)arena_alloc(&S->storage, sizes[0]);
+        S->col_idx = (int *)arena_alloc(&S->storage, sizes[1]);
+        S->bitmap = (uint64_t *)arena_alloc(&S->storage, sizes[2]);
+        S->values = (float *)arena_alloc(&S->storage, sizes[3]);
+        memset(S->bitmap, 0, sizes[2]);
+
+        int t = 0;
+        for (int bi = 0; bi < S->block_rows; bi++)
+        {
+            S->row_ptr[bi] = t;
+            int m = min_int(block, rows - bi * block);
+            for (int bj = 0; bj < S->block_cols; bj++)
+                if (tile_nonzero(&A[(long)bi * block * lda + bj * block], lda, m, min_int(block, cols - bj * block)))
+                {
+                    long bit = (long)bi * S->block_cols + bj;
+                    S->bitmap[bit >> 6] |= (uint64_t)1 << (bit & 63);
+                    S->col_idx[t++] = bj;
+                }
+
+            // Padding rows and the columns past cols stay zero
+            float *dst = &S->values[S->row_ptr[bi] * S->tile_size];
+            memset(dst, 0, (t - S->row_ptr[bi]) * S->tile_size * sizeof(float));
+            long length = (long)(t - S->row_ptr[bi]) * block;
+            for (int p = 0; p < t - S->row_ptr[bi]; p++)
+            {
+                int bj = S->col_idx[S->row_ptr[bi] + p];
+                const float *src = &A[(long)bi * block * lda + bj * block];
+                for (int i = 0; i < m; i++)
+                    for (int k = 0; k < min_int(block, cols - bj * block); k++)
+                        dst[tile_offset(i, p * block + k, length)] = src[(long)i * lda + k];
+            }
+        }
+        S->row_ptr[S->block_rows] = t;
+        return true;
+    }
+
+    void bsr_to_dense(const struct bsr_matrix *S, float *A, int lda)
+    {
+        int block = S->block;
+        for (int i = 0; i < S->rows; i++)
+            memset(&A[(long)i * lda], 0, S->cols * sizeof(float));
+        for (int bi = 0; bi < S->block_rows; bi++)
+        {
+            const float *src = &S->values[S->row_ptr[bi] * S->tile_size];
+            long length = (long)(S->row_ptr[bi + 1] - S->row_ptr[bi]) * block;
+            for (int p = 0; p < S->row_ptr[bi + 1] - S->row_ptr[bi]; p++)
+            {
+                int bj = S->col_idx[S->row_ptr[bi] + p];
+                int m = min_int(block, S->rows - bi * block), n = min_int(block, S->cols - bj * block);
+                for (int i = 0; i < m; i++)
+                    for (int k = 0; k < n; k++)
+                        A[(long)(bi * block + i) * lda + bj * block + k] = src[tile_offset(i, p * block + k, length)];
+            }
+        }
+    }
+
+    void bsr_destroy(struct bsr_matrix *S)
+    {
+        arena_destroy(&S->storage);
+        memset(S, 0, sizeof(*S));
+    }
+
+    struct bsr_thread_args
+    {
+        const struct bsr_matrix *S;
+        const float *B;
+        int ldb, N;
+        float alpha, beta;
+        float *C;
+        int ldc;
+        float *packed_B; // slivers of GEMM_NR columns over all of K
+        int start, end;  // slivers of B to pack, or block rows of S to multiply
+    };
+
+    static void *bsr_pack_func(void *args)
+    {
+        struct bsr_thread_args *a = (struct bsr_thread_args *)args;
+        TRACE_SCOPE(TRACE_PACK);
+        int x0 = a->start * GEMM_NR, x1 = min_int(a->N, a->end * GEMM_NR);
+        if (x0 < x1)
+            gemm_pack(&a->B[x0], 1, a->ldb, x1 - x0, a->S->cols, GEMM_NR, &a->packed_B[(long)x0 * a->S->cols]);
+        return NULL;
+    }
+
+    static void *bsr_compute_func(void *args)
+    {
+        struct bsr_thread_args *a = (struct bsr_thread_args *)args;
+        const struct bsr_matrix *S = a->S;
+        int block = S->block, K = S->cols;
+        // Runs of adjacent tiles are contiguous in both packed operands: one micro-kernel call per run,
+        // capped at GEMM_KC so that the slivers stay in L1
+        int max_run = GEMM_KC / block > 1 ? GEMM_KC / block : 1;
+        alignas(64) float ab[GEMM_MR * GEMM_NR];
+        alignas(64) float acc[GEMM_MR * GEMM_NR];
+
+        for (int bi = a->start; bi < a->end; bi++)
+        {
+            TRACE_SCOPE(TRACE_KERNEL);
+            int rows = min_int(block, S->rows - bi * block);
+            int first = S->row_ptr[bi], last = S->row_ptr[bi + 1];
+            const float *packed_A = &S->values[first * S->tile_size];
+            long length = (long)(last - first) * block;
+            for (int jr = 0; jr < a->N; jr += GEMM_NR)
+                for (int ir = 0; ir < rows; ir += GEMM_MR)
+                {
+                    if (first == last)
+                        memset(acc, 0, sizeof(acc));
+                    for (int t = first; t < last;)
+                    {
+                        int run = 1;
+                        while (t + run < last && run < max_run && S->col_idx[t + run] == S->col_idx[t] + run)
+                            run++;
+                        int k0 = S->col_idx[t] * block, kc = min_int(run * block, K - k0);
+                        gemm_micro_kernel(kc, &packed_A[tile_offset(ir, (long)(t - first) * block, length)],
+                                          &a->packed_B[(long)jr * K + (long)k0 * GEMM_NR], t == first ? acc : ab);
+                        if (t != first)
+                            for (int e = 0; e < GEMM_MR * GEMM_NR; e++)
+                                acc[e] += ab[e];
+                        t += run;
+                    }
+                    gemm_update_tile(min_int(GEMM_MR, rows - ir), min_int(GEMM_NR, a->N - jr), a->alpha, acc, a->beta,
+                                     &a->C[(long)(bi * block + ir) * a->ldc + jr], a->ldc, 1);
+                }
+        }
+        return NULL;
+    }
+
+    static void run_threads(void *(*func)(void *), struct bsr_thread_args *threads_args, int num_thread)
+    {
+        if (num_thread == 1)
+        {
+            func(&threads_args[0]);
+            return;
+        }
+        pthread_t thread_pool[num_thread];
+        for (int j = 0; j < num_thread; j++)
+            pthread_create(&thread_pool[j], NULL, func, &threads_args[j]);
+        TRACE_SCOPE(TRACE_WAIT);
+        for (int j = 0; j < num_thread; j++)
+            pthread_join(thread_pool[j], NULL);
+    }
+
+    bool bsr_gemm(const struct bsr_matrix *S, const float *B, int ldb, int N, float alpha, float beta, float *C, int ldc,
+                  int num_thread)
+    {
+        if (S->rows == 0 || N == 0)
+            return true;
+        int slivers = (N + GEMM_NR - 1) / GEMM_NR;
+        size_t bytes = (size_t)slivers * GEMM_NR * S->cols * sizeof(float);
+        if (!arena_reserve(&scratch.buffers, bytes + ARENA_ALIGNMENT, HUGE_PAGES))
+        {
+            fprintf(stderr, "bsr_gemm: cannot allocate %zu bytes of packed B\n", bytes);
+            return false;
+        }
+        float *packed_B = (float *)arena_alloc(&scratch.buffers, bytes);
+
+        struct bsr_thread_args threads_args[num_thread];
+        for (int j = 0; j < num_thread; j++)
+        {
+            struct bsr_thread_args args = {S, B, ldb, N, alpha, beta, C, ldc, packed_B, 0, 0};
+            threads_args[j] = args;
+            threads_args[j].start = (long)slivers * j / num_thread;
+            threads_args[j].end = (long)slivers * (j + 1) / num_thread;
+        }
+        run_threads(bsr_pack_func, threads_args, num_thread);
+
+        // Each block row costs its nonzero tiles plus one for writing C: split the running total of
+        // row_ptr[bi] + bi into equal parts
+        long total = S->nnz_blocks + S->block_rows;
+        int bi = 0;
+        for (int j = 0; j < num_thread; j++)
+        {
+            threads_args[j].start = bi;
+            while (bi < S->block_rows && (long)(S->row_ptr[bi + 1] + bi + 1) * num_thread <= total * (j + 1))
+                bi++;
+            threads_args[j].end = j == num_thread - 1 ? S->block_rows : bi;
+        }
+        run_threads(bsr_compute_func, threads_args, num_thread);
+        return true;
+    }
+}
@@ -0,0 +1,204 @@
+#include "conv.h"
+#include "gemm.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+namespace matmul
+{
+    // im2col matrix of the calling thread, kept across calls like the GEMM packing buffers
+    struct conv_scratch
+    {
+        struct arena buffers = {};
+        ~conv_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct conv_scratch scratch;
+
+    // Image being convolved, seen as the K x N operand B of the GEMM
+    struct conv_image
+    {
+        const struct conv_params *p;
+        const float *data;
+        int out_w;
+    };
+
+    static void conv_direct(const struct conv_params *p, const float *image, const float *weights, float *out)
+    {
+        int OH = conv_out_height(p), OW = conv_out_width(p);
+        int KH = p->kernel_h, KW = p->kernel_w, H = p->height, W = p->width;
+        for (int co = 0; co < p->out_channels; co++)
+            for (int oh = 0; oh < OH; oh++)
+                for (int ow = 0; ow < OW; ow++)
+                {
+                    float acc = 0;
+                    for (int c = 0; c < p->in_channels; c++)
+                        for (int kh = 0; kh < KH; kh++)
+                        {
+                            int ih = oh * p->stride_h - p->pad_h + kh;
+                            if (ih < 0 || ih >= H)
+                                continue;
+                            for (int kw = 0; kw < KW; kw++)
+                            {
+                                int iw = ow * p->stride_w - p->pad_w + kw;
+                                if (iw < 0 || iw >= W)
+                                    continue;
+                                acc += weights[((co * p->in_channels + c) * KH + kh) * KW + kw] * image[(c * H + ih) * W + iw];
+                            }
+                        }
+                    out[(co * OH + oh) * OW + ow] = acc;
+                }
+    }
+
+    // col[(c * KH + kh) * KW + kw][oh * OW + ow] = image[c][oh * stride - pad + kh][ow * stride - pad + kw]
+    static void im2col(const struct conv_params *p, const float *image, float *col)
+    {
+        int OH = conv_out_height(p), OW = conv_out_width(p), H = p->height, W = p->width;
+        for (int c = 0; c < p->in_channels; c++)
+            for (int kh = 0; kh < p->kernel_h; kh++)
+                for (int kw = 0; kw < p->kernel_w; kw++, col += OH * OW)
+                    for (int oh = 0; oh < OH; oh++)
+                    {
+                        float *dst = &col[oh * OW];
+                        int ih = oh * p->stride_h - p->pad_h + kh;
+                        if (ih < 0 || ih >= H)
+                        {
+                            memset(dst, 0, OW * sizeof(float));
+                            continue;
+                        }
+                        const float *row = &image[(c * H + ih) * W];
+                        for (int ow = 0; ow < OW; ow++)
+                        {
+                            int iw = ow * p->stride_w - p->pad_w + kw;
+                            dst[ow] = iw >= 0 && iw < W ? row[iw] : 0.0f;
+                        }
+                    }
+    }
+
+    // gemm_pack_func for the implicit im2col matrix: gathers kc rows starting at k0 for the
+    // output pixels x0 .. x0 + nx directly from the image, r pixels per sliver
+    static void pack_patches(const void *ctx, int k0, int kc, int x0, int nx, int r, float *dst)
+    {
+        const struct conv_image *img = (const struct conv_image *)ctx;
+        const struct conv_params *p = img->p;
+        int H = p->height, W = p->width, KH = p->kernel_h, KW = p->kernel_w;
+        int ih0[GEMM_NR], iw0[GEMM_NR];
+        assert(r <= GEMM_NR);
+
+        for (int s = 0; s < nx; s += r, dst += r * kc)
+        {
+            int rem = nx - s < r ? nx - s : r;
+            // Top-left input coordinate of each pixel's patch; padding pixels read nothing
+            for (int i = 0; i < r; i++)
+            {
+                if (i < rem)
+                {
+                    int pix = x0 + s + i;
+                    ih0[i] = pix / img->out_w * p->stride_h - p->pad_h;
+                    iw0[i] = pix % img->out_w * p->stride_w - p->pad_w;
+                }
+                else
+                {
+                    ih0[i] = -H - KH;
+                    iw0[i] = 0;
+                }
+            }
+
+            int c = k0 / (KH * KW), kh = k0 / KW % KH, kw = k0 % KW;
+            for (int k = 0; k < kc; k++)
+            {
+                const float *channel = &img->data[c * H * W];
+                for (int i = 0; i < r; i++)
+                {
+                    int ih = ih0[i] + kh, iw = iw0[i] + kw;
+                    dst[k * r + i] = (unsigned)ih < (unsigned)H && (unsigned)iw < (unsigned)W ? channel[ih * W + iw] : 0.0f;
+                }
+                if (++kw == KW)
+                {
+                    kw = 0;
+                    if (++kh == KH)
+                    {
+                        kh = 0;
+                        c++;
+                    }
+                }
+            }
+        }
+    }
+
+    size_t conv_scratch_size(const struct conv_params *p, enum conv_algo algo)
+    {
+        if (algo != CONV_IM2COL)
+            return 0;
+        return (size_t)p->in_channels * p->kernel_h * p->kernel_w * conv_out_height(p) * conv_out_width(p) * sizeof(float);
+    }
+
+    bool conv2d(const struct conv_params *p, enum conv_algo algo, const float *input, const float *weights, float *output)
+    {
+        assert(p->stride_h > 0 && p->stride_w > 0 && p->pad_h >= 0 && p->pad_w >= 0);
+        int OH = conv_out_height(p), OW = conv_out_width(p);
+        assert(OH > 0 && OW > 0);
+        int K = p->in_channels * p->kernel_h * p->kernel_w;
+        long image_size = (long)p->in_channels * p->height * p->width;
+        long out_size = (long)p->out_channels * OH * OW;
+
+        // One GEMM per image: output (C_out x OH * OW) = weights (C_out x K) * patches (K x OH * OW)
+        struct gemm_params gemm = {};
+        gemm.M = p->out_channels;
+        gemm.N = OH * OW;
+        gemm.K = K;
+        gemm.alpha = 1.0f;
+        gemm.beta = 0.0f;
+        gemm.A.data = weights;
+        gemm.A.rs = K;
+        gemm.A.cs = 1;
+        gemm.rs_c = OH * OW;
+        gemm.cs_c = 1;
+        gemm.num_thread = p->num_thread;
+        gemm.pipeline = false;
+        gemm.stats = NULL;
+
+        float *col = NULL;
+        if (algo == CONV_IM2COL)
+        {
+            if (!arena_reserve(&scratch.buffers, conv_scratch_size(p, algo) + ARENA_ALIGNMENT, HUGE_PAGES))
+            {
+                fprintf(stderr, "conv2d: cannot allocate %zu bytes of im2col scratch\n", conv_scratch_size(p, algo));
+                return false;
+            }
+            col = (float *)arena_alloc(&scratch.buffers, conv_scratch_size(p, algo));
+            gemm.B.data = col;
+            gemm.B.rs = OH * OW;
+            gemm.B.cs = 1;
+        }
+
+        struct conv_image img = {p, NULL, OW};
+        if (algo == CONV_IMPLICIT_GEMM)
+        {
+            gemm.B.pack = pack_patches;
+            gemm.B.ctx = &img;
+        }
+
+        for (int n = 0; n < p->batch; n++)
+        {
+            const float *image = &input[n * image_size];
+            gemm.C = &output[n * out_size];
+            switch (algo)
+            {
+            case CONV_DIRECT:
+                conv_direct(p, image, weights, gemm.C);
+                break;
+            case CONV_IM2COL:
+                im2col(p, image, col);
+                if (!packed_gemm(&gemm))
+                    return false;
+                break;
+            case CONV_IMPLICIT_GEMM:
+                img.data = image;
+                if (!packed_gemm(&gemm))
+                    return false;
+                break;
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,514 @@
+#include "eigensolver.h"
+#include "gemm.h"
+#include "small_gemm.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <pthread.h>
+
+// Row loops with less work than this (in complex elements) run on the calling thread
+#define EIGEN_MIN_PARALLEL (64 * 1024)
+// Tile of the transpose that mirrors the lower-triangular trailing update
+#define EIGEN_MIRROR_TILE 32
+
+namespace matmul
+{
+    typedef std::complex<float> cfloat;
+
+    // Reflector vectors, the panel's W and the real GEMM operands of the trailing update
+    struct eigen_scratch
+    {
+        struct arena buffers = {};
+        ~eigen_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct eigen_scratch scratch;
+
+    struct eigen_work
+    {
+        cfloat *v, *y, *t, *W;
+        float *x_re, *x_im;
+        float *L_re, *L_im, *R;
+    };
+
+    // Spelled out so that no NaN/Inf special-casing (__mulsc3) ends up in the inner loops
+    static inline cfloat cmul(cfloat a, cfloat b)
+    {
+        return cfloat(a.real() * b.real() - a.imag() * b.imag(), a.real() * b.imag() + a.imag() * b.real());
+    }
+
+    // a * conj(b)
+    static inline cfloat cmulc(cfloat a, cfloat b)
+    {
+        return cfloat(a.real() * b.real() + a.imag() * b.imag(), a.imag() * b.real() - a.real() * b.imag());
+    }
+
+    typedef void (*rows_func)(const void *ctx, int r0, int r1);
+
+    struct rows_thread_args
+    {
+        rows_func func;
+        const void *ctx;
+        int r0, r1;
+    };
+
+    static void *rows_thread_func(void *args)
+    {
+        struct rows_thread_args *a = (struct rows_thread_args *)args;
+        TRACE_SCOPE(TRACE_KERNEL);
+        a->func(a->ctx, a->r0, a->r1);
+        return NULL;
+    }
+
+    // func over rows 0 .. rows split evenly across the threads
+    static void parallel_rows(rows_func func, const void *ctx, int rows, long work, int num_thread)
+    {
+        if (num_thread > rows)
+            num_thread = rows;
+        if (num_thread <= 1 || work < EIGEN_MIN_PARALLEL)
+        {
+            TRACE_SCOPE(TRACE_KERNEL);
+            func(ctx, 0, rows);
+            return;
+        }
+        pthread_t thread_pool[num_thread];
+        struct rows_thread_args threads_args[num_thread];
+        for (int j = 0; j < num_thread; j++)
+        {
+            threads_args[j].func = func;
+            threads_args[j].ctx = ctx;
+            threads_args[j].r0 = (long)rows * j / num_thread;
+            threads_args[j].r1 = (long)rows * (j + 1) / num_thread;
+            pthread_create(&thread_pool[j], NULL, rows_thread_func, &threads_args[j]);
+        }
+        TRACE_SCOPE(TRACE_WAIT);
+        for (int j = 0; j < num_thread; j++)
+            pthread_join(thread_pool[j], NULL);
+    }
+
+    // y = A * x for an n x n block of a full Hermitian matrix. With a row read as 2n interleaved floats,
+    // Re(y) and Im(y) are plain real dot products with x_re = (xr, -xi, ...) and x_im = (xi, xr, ...).
+    struct matvec_args
+    {
+        const cfloat *A;
+        long lda;
+        int n;
+        const float *x_re, *x_im;
+        cfloat *y;
+    };
+
+    static void matvec_rows(const void *ctx, int r0, int r1)
+    {
+        const struct matvec_args *p = (const struct matvec_args *)ctx;
+        int len = 2 * p->n;
+        for (int r = r0; r < r1; r++)
+        {
+            const float *a = (const float *)&p->A[r * p->lda];
+            float re = 0, im = 0;
+            int c = 0;
+#if defined(__AVX__) || defined(__SSE__) || defined(__ARM_NEON)
+            // Two registers per component so consecutive multiply-adds do not wait on each other
+            const int w = small_vec::width;
+            small_vec::type acc[4] = {small_vec::zero(), small_vec::zero(), small_vec::zero(), small_vec::zero()};
+            for (; c + 2 * w <= len; c += 2 * w)
+            {
+                small_vec::type a0 = small_vec::load(&a[c]), a1 = small_vec::load(&a[c + w]);
+                acc[0] = small_vec::fma(a0, small_vec::load(&p->x_re[c]), acc[0]);
+                acc[1] = small_vec::fma(a1, small_vec::load(&p->x_re[c + w]), acc[1]);
+                acc[2] = small_vec::fma(a0, small_vec::load(&p->x_im[c]), acc[2]);
+                acc[3] = small_vec::fma(a1, small_vec::load(&p->x_im[c + w]), acc[3]);
+            }
+            float lanes[4][small_vec::width];
+            for (int u = 0; u < 4; u++)
+                small_vec::store(lanes[u], acc[u]);
+            for (int l = 0; l < w; l++)
+            {
+                re += lanes[0][l] + lanes[1][l];
+                im += lanes[2][l] + lanes[3][l];
+            }
+#endif
+            for (; c < len; c++)
+            {
+                re += a[c] * p->x_re[c];
+                im += a[c] * p->x_im[c];
+            }
+            p->y[r] = cfloat(re, im);
+        }
+    }
+
+    // y = A * v over the m x m block at A, v taken from work->v
+    static void matvec(const cfloat *A, long lda, int m, cfloat *y, int num_thread, struct eigen_work *work)
+    {
+        for (int c = 0; c < m; c++)
+        {
+            float vr = work->v[c].real(), vi = work->v[c].imag();
+            work->x_re[2 * c] = vr, work->x_re[2 * c + 1] = -vi;
+            work->x_im[2 * c] = vi, work->x_im[2 * c + 1] = vr;
+        }
+        struct matvec_args mv = {A, lda, m, work->x_re, work->x_im, y};
+        parallel_rows(matvec_rows, &mv, m, (long)m * m, num_thread);
+    }
+
+    // A -= v * w^H + w * v^H on an n x n block
+    struct rank2_args
+    {
+        cfloat *A;
+        long lda;
+        int n;
+        const cfloat *v, *w;
+    };
+
+    static void rank2_rows(const void *ctx, int r0, int r1)
+    {
+        const struct rank2_args *p = (const struct rank2_args *)ctx;
+        for (int r = r0; r < r1; r++)
+        {
+            cfloat *a = &p->A[r * p->lda];
+            cfloat vr = p->v[r], wr = p->w[r];
+            for (int c = 0; c < p->n; c++)
+                a[c] -= cmulc(vr, p->w[c]) + cmulc(wr, p->v[c]);
+        }
+    }
+
+    // Householder reflector H = I - tau * v * v^H with H^H * (alpha, x) = (beta, 0) and real beta (zlarfg).
+    // x (stride incx) is overwritten with v[1:], v[0] = 1 is implicit; returns beta.
+    static float make_reflector(cfloat alpha, cfloat *x, long incx, int m, cfloat *tau)
+    {
+        float xnorm2 = 0;
+        for (int i = 0; i < m; i++)
+            xnorm2 += std::norm(x[i * incx]);
+        float ar = alpha.real(), ai = alpha.imag();
+        if (xnorm2 == 0 && ai == 0)
+        {
+            *tau = 0;
+            return ar;
+        }
+        float beta = -copysignf(sqrtf(ar * ar + ai * ai + xnorm2), ar);
+        *tau = cfloat((beta - ar) / beta, -ai / beta);
+        // x /= alpha - beta
+        float dr = ar - beta, inv = 1.0f / (dr * dr + ai * ai);
+        cfloat scale(dr * inv, -ai * inv);
+        for (int i = 0; i < m; i++)
+            x[i * incx] = cmul(x[i * incx], scale);
+        return beta;
+    }
+
+    // Reflector of column j: zeroes A[j + 2 :, j], leaving beta in e[j] and v (v[0] = 1) in work->v
+    static cfloat reflect_column(cfloat *A, long lda, int n, int j, float *e, struct eigen_work *work)
+    {
+        cfloat tau;
+        int m = n - j - 1;
+        e[j] = make_reflector(A[(j + 1) * lda + j], &A[(j + 2) * lda + j], lda, m - 1, &tau);
+        A[(j + 1) * lda + j] = 1;
+        for (int r = 0; r < m; r++)
+            work->v[r] = A[(j + 1 + r) * lda + j];
+        return tau;
+    }
+
+    // y += alpha * v with alpha = -tau / 2 * (y^H v), so that A - v y^H - y v^H applies H from both sides
+    static void symmetrize_update(cfloat tau, const cfloat *v, cfloat *y, long incy, int m)
+    {
+        cfloat dot = 0;
+        for (int r = 0; r < m; r++)
+            dot += cmulc(v[r], y[r * incy]);
+        cfloat alpha = cmul(-0.5f * tau, dot);
+        for (int r = 0; r < m; r++)
+            y[r * incy] += cmul(alpha, v[r]);
+    }
+
+    // zhetd2: each reflector is applied to the whole trailing matrix at once
+    static void tridiagonalize_unblocked(cfloat *A, long lda, int n, float *d, float *e, int num_thread,
+                                         struct eigen_work *work)
+    {
+        for (int j = 0; j < n - 1; j++)
+        {
+            d[j] = A[j * lda + j].real();
+            cfloat tau = reflect_column(A, lda, n, j, e, work);
+            int m = n - j - 1;
+            cfloat *A22 = &A[(j + 1) * lda + j + 1];
+
+            matvec(A22, lda, m, work->y, num_thread, work);
+            for (int r = 0; r < m; r++)
+                work->y[r] = cmul(tau, work->y[r]);
+            symmetrize_update(tau, work->v, work->y, 1, m);
+
+            struct rank2_args r2 = {A22, lda, m, work->v, work->y};
+            parallel_rows(rank2_rows, &r2, m, (long)m * m, num_thread);
+        }
+        d[n - 1] = A[(n - 1) * lda + n - 1].real();
+    }
+
+    // zlatrd: reduces columns k .. k + nb, keeping the reflectors V (in A) and W such that the trailing
+    // matrix is A - V * W^H - W * V^H. Element (r, p) of V is A[k + r, k + p] for r > p; W is m x nb.
+    static void reduce_panel(cfloat *A, long lda, int n, int k, int nb, float *d, float *e, int num_thread,
+                             struct eigen_work *work)
+    {
+        int m = n - k;
+        cfloat *W = work->W;
+        cfloat *V = &A[k * lda + k];
+        for (int i = 0; i < nb; i++)
+        {
+            int j = k + i;
+            // Column j of the trailing matrix, updated with the reflectors before it in this panel
+            for (int r = i; r < m; r++)
+            {
+                cfloat a = V[r * lda + i];
+                for (int p = 0; p < i; p++)
+                    a -= cmulc(V[r * lda + p], W[i * nb + p]) + cmulc(W[r * nb + p], V[i * lda + p]);
+                V[r * lda + i] = a;
+            }
+            d[j] = V[i * lda + i].real();
+            if (j == n - 1)
+                break;
+
+            cfloat tau = reflect_column(A, lda, n, j, e, work);
+            int mv_rows = m - i - 1;
+            matvec(&A[(j + 1) * lda + j + 1], lda, mv_rows, work->y, num_thread, work);
+
+            // y -= V * (W^H v) + W * (V^H v) over rows i + 1 .. m
+            cfloat *t1 = work->t, *t2 = &work->t[nb];
+            for (int p = 0; p < i; p++)
+                t1[p] = t2[p] = 0;
+            for (int r = i + 1; r < m; r++)
+            {
+                cfloat v = work->v[r - i - 1];
+                for (int p = 0; p < i; p++)
+                {
+                    t1[p] += cmulc(v, W[r * nb + p]);
+                    t2[p] += cmulc(v, V[r * lda + p]);
+                }
+            }
+            for (int r = i + 1; r < m; r++)
+            {
+                cfloat y = work->y[r - i - 1];
+                for (int p = 0; p < i; p++)
+                    y -= cmul(V[r * lda + p], t1[p]) + cmul(W[r * nb + p], t2[p]);
+                W[r * nb + i] = cmul(tau, y);
+            }
+            for (int r = 0; r <= i; r++)
+                W[r * nb + i] = 0;
+            symmetrize_update(tau, work->v, &W[(i + 1) * nb + i], nb, mv_rows);
+        }
+    }
+
+    // Upper triangle = conjugate transpose of the lower one, in square tiles so both sides stay in cache
+    struct mirror_args
+    {
+        cfloat *A;
+        long lda;
+        int n;
+    };
+
+    static void mirror_rows(const void *ctx, int r0, int r1)
+    {
+        const struct mirror_args *p = (const struct mirror_args *)ctx;
+        for (int cb = 0; cb < r1; cb += EIGEN_MIRROR_TILE)
+            for (int rb = r0 > cb ? r0 : cb; rb < r1; rb += EIGEN_MIRROR_TILE)
+            {
+                int r_end = rb + EIGEN_MIRROR_TILE < r1 ? rb + EIGEN_MIRROR_TILE : r1;
+                for (int r = rb; r < r_end; r++)
+                {
+                    int c_end = cb + EIGEN_MIRROR_TILE < r ? cb + EIGEN_MIRROR_TILE : r;
+                    for (int c = cb; c < c_end; c++)
+                        p->A[c * p->lda + r] = std::conj(p->A[r * p->lda + c]);
+                }
+            }
+    }
+
+    // A22 -= V * W^H + W * V^H as two real GEMMs with K = 4 * nb on the interleaved real and imaginary parts:
+    // Re -= [Vr Vi Wr Wi] * [Wr Wi Vr Vi]^T and Im -= [Vi -Vr Wi -Wr] * [Wr Wi Vr Vi]^T. Only the lower triangle
+    // is computed, then mirrored into the upper one.
+    static bool update_trailing(cfloat *A, long lda, int n, int k, int nb, int num_thread, struct eigen_work *work)
+    {
+        int mt = n - k - nb, kk = 4 * nb;
+        const cfloat *V = &A[(k + nb) * lda + k], *W = &work->W[nb * nb];
+        for (int r = 0; r < mt; r++)
+        {
+            float *l_re = &work->L_re[r * kk], *l_im = &work->L_im[r * kk], *rt = &work->R[r * kk];
+            for (int p = 0; p < nb; p++)
+            {
+                float vr = V[r * lda + p].real(), vi = V[r * lda + p].imag();
+                float wr = W[r * nb + p].real(), wi = W[r * nb + p].imag();
+                l_re[p] = vr, l_re[nb + p] = vi, l_re[2 * nb + p] = wr, l_re[3 * nb + p] = wi;
+                l_im[p] = vi, l_im[nb + p] = -vr, l_im[2 * nb + p] = wi, l_im[3 * nb + p] = -wr;
+                rt[p] = wr, rt[nb + p] = wi, rt[2 * nb + p] = vr, rt[3 * nb + p] = vi;
+            }
+        }
+
+        struct gemm_params gemm = {};
+        gemm.M = gemm.N = mt;
+        gemm.K = kk;
+        gemm.alpha = -1.0f;
+        gemm.beta = 1.0f;
+        gemm.B.data = work->R;
+        gemm.B.rs = 1;
+        gemm.B.cs = kk;
+        gemm.A.rs = kk;
+        gemm.A.cs = 1;
+        gemm.rs_c = 2 * lda;
+        gemm.cs_c = 2;
+        gemm.num_thread = num_thread;
+        gemm.triangle = GEMM_C_LOWER;
+        cfloat *A22 = &A[(k + nb) * lda + k + nb];
+        for (int part = 0; part < 2; part++)
+        {
+            gemm.A.data = part ? work->L_im : work->L_re;
+            gemm.C = (float *)A22 + part;
+            if (!packed_gemm(&gemm))
+                return false;
+        }
+
+        struct mirror_args mirror = {A22, lda, mt};
+        parallel_rows(mirror_rows, &mirror, mt, (long)mt * mt / 2, num_thread);
+        return true;
+    }
+
+    static bool tridiagonalize_blocked(cfloat *A, long lda, int n, float *d, float *e, int num_thread,
+                                       struct eigen_work *work)
+    {
+        for (int k = 0; k < n; k += EIGEN_BLOCK)
+        {
+            int nb = n - k < EIGEN_BLOCK ? n - k : EIGEN_BLOCK;
+            reduce_panel(A, lda, n, k, nb, d, e, num_thread, work);
+            if (k + nb < n && !update_trailing(A, lda, n, k, nb, num_thread, work))
+                return false;
+        }
+        return true;
+    }
+
+    static size_t round_up(size_t n, size_t r)
+    {
+        return (n + r - 1) / r * r;
+    }
+
+    // Carves the work buffers for an n x n reduction, plus extra floats at the end
+    static bool reserve_work(int n, enum eigen_algo algo, size_t extra, struct eigen_work *work, float **extra_ptr)
+    {
+        size_t complex_sizes[4] = {(size_t)n, (size_t)n, 2 * EIGEN_BLOCK, (size_t)n * EIGEN_BLOCK};
+        size_t real_size = algo == EIGEN_BLOCKED ? (size_t)n * 4 * EIGEN_BLOCK : 0, bytes = 0;
+        int num_complex = algo == EIGEN_BLOCKED ? 4 : 2;
+        for (int b = 0; b < num_complex; b++)
+            bytes += round_up(complex_sizes[b] * sizeof(cfloat), ARENA_ALIGNMENT);
+        bytes += 2 * round_up(2 * (size_t)n * sizeof(float), ARENA_ALIGNMENT);
+        bytes += 3 * round_up(real_size * sizeof(float), ARENA_ALIGNMENT) + round_up(extra * sizeof(float), ARENA_ALIGNMENT);
+        if (!arena_reserve(&scratch.buffers, bytes, HUGE_PAGES))
+        {
+            fprintf(stderr, "eigensolver: cannot allocate %zu bytes of work buffers\n", bytes);
+            return false;
+        }
+        cfloat **complex_buffers[4] = {&work->v, &work->y, &work->t, &work->W};
+        for (int b = 0; b < 4; b++)
+            *complex_buffers[b] = b < num_complex ? (cfloat *)arena_alloc(&scratch.buffers, complex_sizes[b] * sizeof(cfloat)) : NULL;
+        work->x_re = (float *)arena_alloc(&scratch.buffers, 2 * (size_t)n * sizeof(float));
+        work->x_im = (float *)arena_alloc(&scratch.buffers, 2 * (size_t)n * sizeof(float));
+        float **real_buffers[3] = {&work->L_re, &work->L_im, &work->R};
+        for (int b = 0; b < 3; b++)
+            *real_buffers[b] = real_size ? (float *)arena_alloc(&scratch.buffers, real_size * sizeof(float)) : NULL;
+        if (extra_ptr)
+            *extra_ptr = (float *)arena_alloc(&scratch.buffers, extra * sizeof(float));
+        return true;
+    }
+
+    static bool tridiagonalize(cfloat *A, int n, int lda, float *d, float *e, enum eigen_algo algo, int num_thread,
+                               struct eigen_work *work)
+    {
+        // Both reductions work on the full matrix, so mirror the lower triangle into the upper one
+        for (int i = 0; i < n; i++)
+        {
+            A[(long)i * lda + i] = A[(long)i * lda + i].real();
+            for (int j = 0; j < i; j++)
+                A[(long)j * lda + i] = std::conj(A[(long)i * lda + j]);
+        }
+        if (algo == EIGEN_BLOCKED)
+            return tridiagonalize_blocked(A, lda, n, d, e, num_thread, work);
+        tridiagonalize_unblocked(A, lda, n, d, e, num_thread, work);
+        return true;
+    }
+
+    bool hermitian_tridiagonalize(cfloat *A, int n, int lda, float *d, float *e, enum eigen_algo algo, int num_thread)
+    {
+        struct eigen_work work;
+        if (n == 0)
+            return true;
+        if (!reserve_work(n, algo, 0, &work, NULL))
+            return false;
+        return tridiagonalize(A, n, lda, d, e, algo, num_thread, &work);
+    }
+
+    int tridiagonal_eigenvalues(float *d, float *e, int n)
+    {
+        if (n == 0)
+            return 0;
+        e[n - 1] = 0;
+        for (int l = 0; l < n; l++)
+        {
+            int iter = 0, m;
+            do
+            {
+                // Split off at the first negligible subdiagonal entry
+                for (m = l; m < n - 1; m++)
+                    if (fabsf(e[m]) <= FLT_EPSILON * (fabsf(d[m]) + fabsf(d[m + 1])))
+                        break;
+                if (m == l)
+                    break;
+                if (iter++ == 30)
+                    return l + 1;
+
+                // Wilkinson shift from the leading 2 x 2 block, then chase the bulge up from m
+                float g = (d[l + 1] - d[l]) / (2 * e[l]);
+                float r = hypotf(g, 1);
+                g = d[m] - d[l] + e[l] / (g + copysignf(r, g));
+                float s = 1, c = 1, p = 0;
+                int i;
+                for (i = m - 1; i >= l; i--)
+                {
+                    float f = s * e[i], b = c * e[i];
+                    e[i + 1] = r = hypotf(f, g);
+                    if (r == 0)
+                    {
+                        d[i + 1] -= p;
+                        e[m] = 0;
+                        break;
+                    }
+                    s = f / r;
+                    c = g / r;
+                    g = d[i + 1] - p;
+                    r = (d[i] - g) * s + 2 * c * b;
+                    p = s * r;
+                    d[i + 1] = g + p;
+                    g = c * r - b;
+                }
+                if (r == 0 && i >= l)
+                    continue;
+                d[l] -= p;
+                e[l] = g;
+                e[m] = 0;
+            } while (m != l);
+        }
+
+        // Insertion sort, ascending
+        for (int i = 1; i < n; i++)
+        {
+            float x = d[i];
+            int j = i - 1;
+            for (; j >= 0 && d[j] > x; j--)
+                d[j + 1] = d[j];
+            d[j + 1] = x;
+        }
+        return 0;
+    }
+
+    int hermitian_eigenvalues(cfloat *A, int n, int lda, float *w, enum eigen_algo algo, int num_thread)
+    {
+        struct eigen_work work;
+        float *e;
+        if (n == 0)
+            return 0;
+        if (!reserve_work(n, algo, n, &work, &e))
+            return -1;
+        if (!tridiagonalize(A, n, lda, w, e, algo, num_thread, &work))
+            return -1;
+        return tridiagonal_eigenvalues(w, e, n);
+    }
+}
@@ -0,0 +1,489 @@
+#include "einsum.h"
+#include "gemm.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+#include <pthread.h>
+
+namespace matmul
+{
+    // Dense copies of the EINSUM_PERMUTE path
+    struct einsum_scratch
+    {
+        struct arena buffers = {};
+        ~einsum_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct einsum_scratch scratch;
+
+    static int find_dim(const struct einsum_plan *plan, char label)
+    {
+        for (int d = 0; d < plan->num_dims; d++)
+            if (plan->dims[d].label == label)
+                return d;
+        return -1;
+    }
+
+    // Reads the labels of one operand up to stop or "->", filling its dense row-major strides into dims
+    static const char *parse_operand(const char *s, char stop, int op, const int *shape, struct einsum_plan *plan,
+                                     bool present[][3])
+    {
+        int labels[EINSUM_MAX_DIMS], n = 0;
+        for (; *s && *s != stop && strncmp(s, "->", 2) != 0; s++)
+        {
+            int d = isalpha((unsigned char)*s) ? find_dim(plan, *s) : -2;
+            if (d == -2 || n == EINSUM_MAX_DIMS)
+            {
+                fprintf(stderr, "einsum: %s\n", d == -2 ? "labels must be letters" : "too many labels");
+                return NULL;
+            }
+            if (d < 0)
+            {
+                if (!shape)
+                {
+                    fprintf(stderr, "einsum: output label '%c' is not in any operand\n", *s);
+                    return NULL;
+                }
+                d = plan->num_dims++;
+                memset(&plan->dims[d], 0, sizeof(plan->dims[d]));
+                plan->dims[d].label = *s;
+                plan->dims[d].size = shape[n];
+            }
+            else if (present[d][op])
+            {
+                fprintf(stderr, "einsum: label '%c' repeated in one operand\n", *s);
+                return NULL;
+            }
+            else if (shape && plan->dims[d].size != shape[n])
+            {
+                fprintf(stderr, "einsum: label '%c' has sizes %d and %d\n", *s, plan->dims[d].size, shape[n]);
+                return NULL;
+            }
+            present[d][op] = true;
+            labels[n++] = d;
+        }
+        long stride = 1;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            plan->dims[labels[i]].stride[op] = stride;
+            stride *= plan->dims[labels[i]].size;
+        }
+        return s;
+    }
+
+    // Whether a group of labels, outermost first, is one uniform stride in an operand
+    static bool collapse(const struct einsum_plan *plan, const int *group, int n, int op, long *stride)
+    {
+        long expect = 0;
+        *stride = 0;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            const struct einsum_dim *dim = &plan->dims[group[i]];
+            if (dim->size == 1)
+                continue;
+            if (expect == 0)
+                *stride = dim->stride[op];
+            else if (dim->stride[op] != expect)
+                return false;
+            expect = dim->stride[op] * dim->size;
+        }
+        return true;
+    }
+
+    static long group_size(const struct einsum_plan *plan, const int *group, int n)
+    {
+        long size = 1;
+        for (int i = 0; i < n; i++)
+            size *= plan->dims[group[i]].size;
+        return size;
+    }
+
+    // Fills the GEMM shape and views from the groups and the per-operand strides
+    static void lower(struct einsum_plan *plan)
+    {
+        long unused;
+        // C must see M and N as single strides; peel outer labels into the batch loop until it does
+        while (plan->num_m > 1 && !collapse(plan, plan->m, plan->num_m, 2, &unused))
+        {
+            plan->batch[plan->num_batch++] = plan->m[0];
+            memmove(plan->m, plan->m + 1, --plan->num_m * sizeof(int));
+        }
+        while (plan->num_n > 1 && !collapse(plan, plan->n, plan->num_n, 2, &unused))
+        {
+            plan->batch[plan->num_batch++] = plan->n[0];
+            memmove(plan->n, plan->n + 1, --plan->num_n * sizeof(int));
+        }
+        collapse(plan, plan->m, plan->num_m, 2, &plan->rs_c);
+        collapse(plan, plan->n, plan->num_n, 2, &plan->cs_c);
+
+        bool rows_A = collapse(plan, plan->m, plan->num_m, 0, &plan->rs_a);
+        bool cols_A = collapse(plan, plan->k, plan->num_k, 0, &plan->cs_a);
+        bool rows_B = collapse(plan, plan->k, plan->num_k, 1, &plan->rs_b);
+        bool cols_B = collapse(plan, plan->n, plan->num_n, 1, &plan->cs_b);
+        plan->gather_A = !(rows_A && cols_A);
+        plan->gather_B = !(rows_B && cols_B);
+        plan->batch_count = group_size(plan, plan->batch, plan->num_batch);
+        plan->M = (int)group_size(plan, plan->m, plan->num_m);
+        plan->N = (int)group_size(plan, plan->n, plan->num_n);
+        plan->K = (int)group_size(plan, plan->k, plan->num_k);
+    }
+
+    bool einsum_plan_create(const char *spec, const int *shape_A, const int *shape_B, struct einsum_plan *plan)
+    {
+        bool present[3 * EINSUM_MAX_DIMS][3] = {};
+        memset(plan, 0, sizeof(*plan));
+
+        const char *s = parse_operand(spec, ',', 0, shape_A, plan, present);
+        if (s && *s != ',')
+        {
+            fprintf(stderr, "einsum: \"%s\" needs two operands\n", spec);
+            return false;
+        }
+        if (s)
+            s = parse_operand(s + 1, ',', 1, shape_B, plan, present);
+        if (s && strncmp(s, "->", 2) != 0)
+        {
+            fprintf(stderr, "einsum: \"%s\" needs an explicit output (->)\n", spec);
+            return false;
+        }
+        if (!s || !parse_operand(s + 2, '\0', 2, NULL, plan, present))
+            return false;
+
+        // The output labels fix the order of the batch, M and N groups; A fixes the order of K
+        for (const char *c = s + 2; *c; c++)
+        {
+            int d = find_dim(plan, *c);
+            if (present[d][0] && present[d][1])
+                plan->batch[plan->num_batch++] = d;
+            else if (present[d][0])
+                plan->m[plan->num_m++] = d;
+            else
+                plan->n[plan->num_n++] = d;
+        }
+        for (const char *c = spec; *c != ','; c++)
+        {
+            int d = find_dim(plan, *c);
+            if (present[d][1] && !present[d][2])
+                plan->k[plan->num_k++] = d;
+        }
+        for (int d = 0; d < plan->num_dims; d++)
+            if (!present[d][2] && !(present[d][0] && present[d][1]))
+            {
+                fprintf(stderr, "einsum: label '%c' is summed over in one operand only\n", plan->dims[d].label);
+                return false;
+            }
+
+        for (int op = 0; op < 3; op++)
+        {
+            size_t size = 1;
+            for (int d = 0; d < plan->num_dims; d++)
+                if (present[d][op])
+                    size *= plan->dims[d].size;
+            *(op == 0 ? &plan->size_A : op == 1 ? &plan->size_B : &plan->size_C) = size;
+        }
+        lower(plan);
+        return true;
+    }
+
+    // Calls f(offset in A, offset in B, offset in C) for every index of a group of labels, last label fastest
+    template <typename F>
+    static void walk(const struct einsum_plan *plan, const int *group, int n, F f)
+    {
+        int idx[3 * EINSUM_MAX_DIMS] = {};
+        long off[3] = {0, 0, 0};
+        long total = group_size(plan, group, n);
+        for (long t = 0; t < total; t++)
+        {
+            f(off[0], off[1], off[2]);
+            for (int i = n - 1; i >= 0; i--)
+            {
+                const struct einsum_dim *dim = &plan->dims[group[i]];
+                for (int op = 0; op < 3; op++)
+                    off[op] += dim->stride[op];
+                if (++idx[i] < dim->size)
+                    break;
+                for (int op = 0; op < 3; op++)
+                    off[op] -= dim->stride[op] * dim->size;
+                idx[i] = 0;
+            }
+        }
+    }
+
+    // An operand as the GEMM sees it: rows x (M or N labels) by k (K labels), gathered through strides
+    struct einsum_operand
+    {
+        const float *data;
+        int nx, nk;
+        int x_size[EINSUM_MAX_DIMS], k_size[EINSUM_MAX_DIMS];
+        long x_stride[EINSUM_MAX_DIMS], k_stride[EINSUM_MAX_DIMS];
+    };
+
+    static void operand_of(const struct einsum_plan *plan, const int *x, int nx, int op, struct einsum_operand *operand)
+    {
+        operand->nx = nx;
+        operand->nk = plan->num_k;
+        for (int i = 0; i < nx; i++)
+        {
+            operand->x_size[i] = plan->dims[x[i]].size;
+            operand->x_stride[i] = plan->dims[x[i]].stride[op];
+        }
+        for (int i = 0; i < plan->num_k; i++)
+        {
+            operand->k_size[i] = plan->dims[plan->k[i]].size;
+            operand->k_stride[i] = plan->dims[plan->k[i]].stride[op];
+        }
+    }
+
+    static long offset_of(int n, const int *size, const long *stride, long flat)
+    {
+        long off = 0;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            off += flat % size[i] * stride[i];
+            flat /= size[i];
+        }
+        return off;
+    }
+
+    // gemm_pack_func gathering a permuted operand straight into micro-kernel slivers
+    static void pack_operand(const void *ctx, int k0, int kc, int x0, int nx, int r, float *dst)
+    {
+        const struct einsum_operand *op = (const struct einsum_operand *)ctx;
+        long x_off[GEMM_MR > GEMM_NR ? GEMM_MR : GEMM_NR];
+        int idx[EINSUM_MAX_DIMS];
+        assert(r <= (GEMM_MR > GEMM_NR ? GEMM_MR : GEMM_NR));
+
+        for (int s = 0; s < nx; s += r, dst += r * kc)
+        {
+            int rem = nx - s < r ? nx - s : r;
+            for (int i = 0; i < rem; i++)
+                x_off[i] = offset_of(op->nx, op->x_size, op->x_stride, x0 + s + i);
+            long k_off = 0, flat = k0;
+            for (int i = op->nk - 1; i >= 0; i--)
+            {
+                idx[i] = flat % op->k_size[i];
+                k_off += idx[i] * op->k_stride[i];
+                flat /= op->k_size[i];
+            }
+            for (int k = 0; k < kc; k++)
+            {
+                const float *src = &op->data[k_off];
+                for (int i = 0; i < rem; i++)
+                    dst[k * r + i] = src[x_off[i]];
+                for (int i = rem; i < r; i++)
+                    dst[k * r + i] = 0;
+                for (int i = op->nk - 1; i >= 0; i--)
+                {
+                    k_off += op->k_stride[i];
+                    if (++idx[i] < op->k_size[i])
+                        break;
+                    k_off -= op->k_stride[i] * op->k_size[i];
+                    idx[i] = 0;
+                }
+            }
+        }
+    }
+
+    struct einsum_thread_args
+    {
+        const struct einsum_plan *plan;
+        const float *A, *B;
+        float *C;
+        long start, end;
+        int num_thread;
+        bool ok; // set by the thread: false when a GEMM could not allocate its packing buffers
+    };
+
+    // GEMMs start .. end of the batch loop
+    static void *einsum_thread_func(void *args)
+    {
+        struct einsum_thread_args *a = (struct einsum_thread_args *)args;
+        const struct einsum_plan *plan = a->plan;
+        struct einsum_operand op_A, op_B;
+        operand_of(plan, plan->m, plan->num_m, 0, &op_A);
+        operand_of(plan, plan->n, plan->num_n, 1, &op_B);
+
+        struct gemm_params gemm = {};
+        gemm.M = plan->M;
+        gemm.N = plan->N;
+        gemm.K = plan->K;
+        gemm.alpha = 1.0f;
+        gemm.beta = 0.0f;
+        gemm.A.rs = plan->rs_a;
+        gemm.A.cs = plan->cs_a;
+        gemm.B.rs = plan->rs_b;
+        gemm.B.cs = plan->cs_b;
+        gemm.rs_c = plan->rs_c;
+        gemm.cs_c = plan->cs_c;
+        gemm.num_thread = a->num_thread;
+        gemm.pipeline = false;
+        gemm.stats = NULL;
+        if (plan->gather_A)
+        {
+            gemm.A.pack = pack_operand;
+            gemm.A.ctx = &op_A;
+        }
+        if (plan->gather_B)
+        {
+            gemm.B.pack = pack_operand;
+            gemm.B.ctx = &op_B;
+        }
+
+        const int *batch = plan->batch;
+        int num_batch = plan->num_batch;
+        for (long t = a->start; t < a->end; t++)
+        {
+            long off[3] = {0, 0, 0}, flat = t;
+            for (int i = num_batch - 1; i >= 0; i--)
+            {
+                const struct einsum_dim *dim = &plan->dims[batch[i]];
+                for (int op = 0; op < 3; op++)
+                    off[op] += flat % dim->size * dim->stride[op];
+                flat /= dim->size;
+            }
+            gemm.A.data = op_A.data = &a->A[off[0]];
+            gemm.B.data = op_B.data = &a->B[off[1]];
+            gemm.C = &a->C[off[2]];
+            if (!packed_gemm(&gemm))
+            {
+                a->ok = false;
+                return NULL;
+            }
+        }
+        a->ok = true;
+        return NULL;
+    }
+
+    static bool einsum_fused(const struct einsum_plan *plan, const float *A, const float *B, float *C, int num_thread)
+    {
+        // Enough independent GEMMs: one single-threaded GEMM per batch entry and thread,
+        // otherwise each GEMM is split over the threads
+        int num_worker = plan->batch_count >= num_thread ? num_thread : 1;
+        pthread_t thread_pool[num_worker];
+        struct einsum_thread_args threads_args[num_worker];
+        for (int j = 0; j < num_worker; j++)
+        {
+            threads_args[j].plan = plan;
+            threads_args[j].A = A;
+            threads_args[j].B = B;
+            threads_args[j].C = C;
+            threads_args[j].start = plan->batch_count * j / num_worker;
+            threads_args[j].end = plan->batch_count * (j + 1) / num_worker;
+            threads_args[j].num_thread = num_worker > 1 ? 1 : num_thread;
+        }
+        if (num_worker == 1)
+        {
+            einsum_thread_func(&threads_args[0]);
+            return threads_args[0].ok;
+        }
+        for (int j = 0; j < num_worker; j++)
+            pthread_create(&thread_pool[j], NULL, einsum_thread_func, &threads_args[j]);
+        TRACE_SCOPE(TRACE_WAIT);
+        bool ok = true;
+        for (int j = 0; j < num_worker; j++)
+        {
+            pthread_join(thread_pool[j], NULL);
+            ok = ok && threads_args[j].ok;
+        }
+        return ok;
+    }
+
+    // Copies of A (batch x M x K), B (batch x K x N) and C (batch x M x N) in GEMM order,
+    // then the same batched GEMM on plain views
+    static bool einsum_permute(const struct einsum_plan *plan, const float *A, const float *B, float *C, int num_thread)
+    {
+        size_t batch = plan->batch_count, size_A = batch * plan->M * plan->K;
+        size_t size_B = batch * plan->K * plan->N, size_C = batch * plan->M * plan->N;
+        if (!arena_reserve(&scratch.buffers, (size_A + size_B + size_C) * sizeof(float) + 3 * ARENA_ALIGNMENT, HUGE_PAGES))
+        {
+            fprintf(stderr, "einsum: cannot allocate %zu bytes of permuted copies\n",
+                    (size_A + size_B + size_C) * sizeof(float));
+            return false;
+        }
+        float *dense_A = (float *)arena_alloc(&scratch.buffers, size_A * sizeof(float));
+        float *dense_B = (float *)arena_alloc(&scratch.buffers, size_B * sizeof(float));
+        float *dense_C = (float *)arena_alloc(&scratch.buffers, size_C * sizeof(float));
+
+        // The dense plan: stride[0..2] of every label in the copies
+        struct einsum_plan dense = *plan;
+        const int *groups[3][3] = {{plan->batch, plan->m, plan->k}, {plan->batch, plan->k, plan->n}, {plan->batch, plan->m, plan->n}};
+        const int counts[3][3] = {{plan->num_batch, plan->num_m, plan->num_k}, {plan->num_batch, plan->num_k, plan->num_n},
+                                  {plan->num_batch, plan->num_m, plan->num_n}};
+        for (int op = 0; op < 3; op++)
+        {
+            for (int d = 0; d < dense.num_dims; d++)
+                dense.dims[d].stride[op] = 0;
+            long stride = 1;
+            for (int g = 2; g >= 0; g--)
+                for (int i = counts[op][g] - 1; i >= 0; i--)
+                {
+                    dense.dims[groups[op][g][i]].stride[op] = stride;
+                    stride *= dense.dims[groups[op][g][i]].size;
+                }
+        }
+        lower(&dense);
+
+        // Walk with stride[0] = the original operand, stride[1] = its copy
+        struct einsum_plan copy = *plan;
+        for (int op = 0; op < 3; op++)
+        {
+            int order[3 * EINSUM_MAX_DIMS], n = 0;
+            for (int g = 0; g < 3; g++)
+                for (int i = 0; i < counts[op][g]; i++)
+                    order[n++] = groups[op][g][i];
+            for (int d = 0; d < copy.num_dims; d++)
+            {
+                copy.dims[d].stride[0] = plan->dims[d].stride[op];
+                copy.dims[d].stride[1] = dense.dims[d].stride[op];
+                copy.dims[d].stride[2] = 0;
+            }
+            if (op == 0)
+                walk(&copy, order, n, [&](long src, long dst, long) { dense_A[dst] = A[src]; });
+            else if (op == 1)
+                walk(&copy, order, n, [&](long src, long dst, long) { dense_B[dst] = B[src]; });
+            else
+            {
+                if (!einsum_fused(&dense, dense_A, dense_B, dense_C, num_thread))
+                    return false;
+                walk(&copy, order, n, [&](long dst, long src, long) { C[dst] = dense_C[src]; });
+            }
+        }
+        return true;
+    }
+
+    static void einsum_reference(const struct einsum_plan *plan, const float *A, const float *B, float *C)
+    {
+        int all[3 * EINSUM_MAX_DIMS];
+        for (int d = 0; d < plan->num_dims; d++)
+            all[d] = d;
+        memset(C, 0, plan->size_C * sizeof(float));
+        walk(plan, all, plan->num_dims, [&](long a, long b, long c) { C[c] += A[a] * B[b]; });
+    }
+
+    bool einsum_execute(const struct einsum_plan *plan, enum einsum_algo algo, const float *A, const float *B, float *C,
+                        int num_thread)
+    {
+        assert(num_thread > 0);
+        switch (algo)
+        {
+        case EINSUM_REFERENCE:
+            einsum_reference(plan, A, B, C);
+            break;
+        case EINSUM_PERMUTE:
+            return einsum_permute(plan, A, B, C, num_thread);
+        case EINSUM_FUSED:
+            return einsum_fused(plan, A, B, C, num_thread);
+        }
+        return true;
+    }
+
+    bool einsum(const char *spec, const float *A, const int *shape_A, const float *B, const int *shape_B, float *C,
+                int num_thread)
+    {
+        struct einsum_plan plan;
+        if (!einsum_plan_create(spec, shape_A, shape_B, &plan))
+            return false;
+        return einsum_execute(&plan, EINSUM_FUSED, A, B, C, num_thread);
+    }
+}
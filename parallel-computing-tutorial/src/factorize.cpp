@@ -0,0 +1,156 @@
+#include "factorize.h"
+#include "gemm.h"
+#include "level3.h"
+#include <math.h>
+#include <assert.h>
+
+namespace matmul
+{
+    // C (m x n) -= A (m x k) * B (k x n) on the threaded packed engine
+    static bool gemm_update(int m, int n, int k, const float *A, long rs_a, long cs_a, const float *B, long rs_b, long cs_b,
+                            float *C, long ldc, int num_thread)
+    {
+        if (m == 0 || n == 0 || k == 0)
+            return true;
+        struct gemm_params gemm = {};
+        gemm.M = m;
+        gemm.N = n;
+        gemm.K = k;
+        gemm.alpha = -1.0f;
+        gemm.beta = 1.0f;
+        gemm.A.data = A;
+        gemm.A.rs = rs_a;
+        gemm.A.cs = cs_a;
+        gemm.B.data = B;
+        gemm.B.rs = rs_b;
+        gemm.B.cs = cs_b;
+        gemm.C = C;
+        gemm.rs_c = ldc;
+        gemm.cs_c = 1;
+        gemm.num_thread = num_thread;
+        gemm.pipeline = false;
+        gemm.stats = NULL;
+        return packed_gemm(&gemm);
+    }
+
+    bool triangular_solve(const float *T, int n, int ldt, bool lower, bool transpose, bool unit_diagonal, float *B,
+                          int nrhs, int ldb, int num_thread)
+    {
+        return trsm(true, lower, transpose, unit_diagonal, n, nrhs, 1.0f, T, ldt, B, ldb, num_thread);
+    }
+
+    int lu_factor(float *A, int n, int lda, int *ipiv, int block_size, int num_thread)
+    {
+        assert(block_size > 0);
+        int info = 0;
+        for (int k = 0; k < n; k += block_size)
+        {
+            int b = n - k < block_size ? n - k : block_size;
+
+            // Panel A[k:n, k:k+b], unblocked; row swaps are applied to whole rows
+            for (int j = k; j < k + b; j++)
+            {
+                int p = j;
+                float max = fabsf(A[(long)j * lda + j]);
+                for (int i = j + 1; i < n; i++)
+                    if (fabsf(A[(long)i * lda + j]) > max)
+                    {
+                        max = fabsf(A[(long)i * lda + j]);
+                        p = i;
+                    }
+                ipiv[j] = p;
+                if (max == 0)
+                {
+                    if (info == 0)
+                        info = j + 1;
+                    continue;
+                }
+                if (p != j)
+                    for (int c = 0; c < n; c++)
+                    {
+                        float tmp = A[(long)j * lda + c];
+                        A[(long)j * lda + c] = A[(long)p * lda + c];
+                        A[(long)p * lda + c] = tmp;
+                    }
+
+                const float *pivot_row = &A[(long)j * lda];
+                float inv = 1.0f / pivot_row[j];
+                for (int i = j + 1; i < n; i++)
+                {
+                    float *row = &A[(long)i * lda];
+                    float l = row[j] *= inv;
+                    for (int c = j + 1; c < k + b; c++)
+                        row[c] -= l * pivot_row[c];
+                }
+            }
+            if (k + b == n)
+                break;
+
+            // U12 = L11^-1 * A12, then A22 -= L21 * U12
+            if (!trsm(true, true, false, true, b, n - k - b, 1.0f, &A[(long)k * lda + k], lda, &A[(long)k * lda + k + b],
+                      lda, num_thread) ||
+                !gemm_update(n - k - b, n - k - b, b, &A[(long)(k + b) * lda + k], lda, 1, &A[(long)k * lda + k + b], lda,
+                             1, &A[(long)(k + b) * lda + k + b], lda, num_thread))
+                return -1;
+        }
+        return info;
+    }
+
+    int cholesky_factor(float *A, int n, int lda, int block_size, int num_thread)
+    {
+        assert(block_size > 0);
+        for (int k = 0; k < n; k += block_size)
+        {
+            int b = n - k < block_size ? n - k : block_size;
+
+            // Panel A[k:n, k:k+b] by the left-looking (Crout) recurrence within the panel, which also
+            // produces L21 = A21 * L11^-T; every inner product runs along two contiguous rows
+            for (int j = k; j < k + b; j++)
+            {
+                const float *row_j = &A[(long)j * lda];
+                for (int i = j; i < n; i++)
+                {
+                    float *row_i = &A[(long)i * lda];
+                    float dot = 0;
+                    for (int t = k; t < j; t++)
+                        dot += row_i[t] * row_j[t];
+                    row_i[j] -= dot;
+                }
+                float d = A[(long)j * lda + j];
+                if (!(d > 0))
+                    return j + 1;
+                d = sqrtf(d);
+                A[(long)j * lda + j] = d;
+                float inv = 1.0f / d;
+                for (int i = j + 1; i < n; i++)
+                    A[(long)i * lda + j] *= inv;
+            }
+
+            // A22 -= L21 * L21^T, on the lower triangle only
+            if (!syrk(true, false, n - k - b, b, -1.0f, &A[(long)(k + b) * lda + k], lda, 1.0f,
+                      &A[(long)(k + b) * lda + k + b], lda, num_thread))
+                return -1;
+        }
+        return 0;
+    }
+
+    bool lu_solve(const float *LU, int n, int lda, const int *ipiv, float *B, int nrhs, int ldb, int num_thread)
+    {
+        for (int i = 0; i < n; i++)
+            if (ipiv[i] != i)
+                for (int c = 0; c < nrhs; c++)
+                {
+                    float tmp = B[(long)i * ldb + c];
+                    B[(long)i * ldb + c] = B[(long)ipiv[i] * ldb + c];
+                    B[(long)ipiv[i] * ldb + c] = tmp;
+                }
+        return triangular_solve(LU, n, lda, true, false, true, B, nrhs, ldb, num_thread) &&
+               triangular_solve(LU, n, lda, false, false, false, B, nrhs, ldb, num_thread);
+    }
+
+    bool cholesky_solve(const float *L, int n, int lda, float *B, int nrhs, int ldb, int num_thread)
+    {
+        return triangular_solve(L, n, lda, true, false, false, B, nrhs, ldb, num_thread) &&
+               triangular_solve(L, n, lda, true, true, false, B, nrhs, ldb, num_thread);
+    }
+}
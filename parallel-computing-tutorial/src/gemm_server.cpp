@@ -0,0 +1,347 @@
+#include "gemm_server.h"
+#include "gemm.h"
+#include "trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+namespace matmul
+{
+    // Row pointers of the stacked A and the stacked C of the batch being run, on the dispatcher thread
+    struct server_scratch
+    {
+        struct arena buffers = {};
+        ~server_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct server_scratch scratch;
+
+    // Requests sharing a B, waiting to be run as one GEMM
+    struct open_batch
+    {
+        const float *B;
+        int ldb, n, k;
+        int rows;
+        double flush_ns;
+        struct gemm_request *head, *tail;
+    };
+
+    static inline double now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+    }
+
+    // Bounded MPMC queue with a sequence number per cell (D. Vyukov): a cell is free to write at
+    // position pos when its sequence is pos, and holds a request to read when it is pos + 1
+    static bool queue_push(struct gemm_server *s, struct gemm_request *r)
+    {
+        size_t pos = s->enqueue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            struct gemm_queue_cell *cell = &s->cells[pos & (SERVER_QUEUE_SIZE - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)pos;
+            if (diff == 0)
+            {
+                if (s->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell->request = r;
+                    cell->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = s->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    static struct gemm_request *queue_pop(struct gemm_server *s)
+    {
+        size_t pos = s->dequeue_pos.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            struct gemm_queue_cell *cell = &s->cells[pos & (SERVER_QUEUE_SIZE - 1)];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            long diff = (long)seq - (long)(pos + 1);
+            if (diff == 0)
+            {
+                if (s->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    struct gemm_request *r = cell->request;
+                    cell->sequence.store(pos + SERVER_QUEUE_SIZE, std::memory_order_release);
+                    return r;
+                }
+            }
+            else if (diff < 0)
+                return NULL;
+            else
+                pos = s->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // gemm_pack_func over the stacked rows of A, ctx being one row pointer per row
+    static void pack_rows(const void *ctx, int k0, int kc, int x0, int nx, int r, float *dst)
+    {
+        const float *const *rows = (const float *const *)ctx;
+        for (int s = 0; s < nx; s += r, dst += r * kc)
+        {
+            int rem = nx - s < r ? nx - s : r;
+            for (int i = 0; i < rem; i++)
+            {
+                const float *src = &rows[x0 + s + i][k0];
+                for (int k = 0; k < kc; k++)
+                    dst[k * r + i] = src[k];
+            }
+            for (int k = 0; k < kc; k++)
+                for (int i = rem; i < r; i++)
+                    dst[k * r + i] = 0;
+        }
+    }
+
+    // One request as its own GEMM, straight into its C
+    static bool run_request(struct gemm_server *s, struct gemm_request *r)
+    {
+        struct gemm_params gemm = {};
+        gemm.M = r->m;
+        gemm.N = r->n;
+        gemm.K = r->k;
+        gemm.alpha = 1.0f;
+        gemm.A.data = r->A;
+        gemm.A.rs = r->lda;
+        gemm.A.cs = 1;
+        gemm.B.data = r->B;
+        gemm.B.rs = r->ldb;
+        gemm.B.cs = 1;
+        gemm.C = r->C;
+        gemm.rs_c = r->ldc;
+        gemm.cs_c = 1;
+        gemm.num_thread = s->config.num_thread;
+        return packed_gemm(&gemm);
+    }
+
+    // Stacks the requests into one GEMM; false when the stacked C or the GEMM cannot be allocated
+    static bool run_stacked(struct gemm_server *s, struct open_batch *b)
+    {
+        size_t pointer_bytes = b->rows * sizeof(float *), c_bytes = (size_t)b->rows * b->n * sizeof(float);
+        if (!arena_reserve(&scratch.buffers, pointer_bytes + c_bytes + 2 * ARENA_ALIGNMENT, HUGE_PAGES))
+            return false;
+        const float **rows = (const float **)arena_alloc(&scratch.buffers, pointer_bytes);
+        float *C = (float *)arena_alloc(&scratch.buffers, c_bytes);
+        int row = 0;
+        for (struct gemm_request *r = b->head; r; r = r->next)
+            for (int i = 0; i < r->m; i++)
+                rows[row++] = &r->A[(long)i * r->lda];
+
+        struct gemm_params gemm = {};
+        gemm.M = b->rows;
+        gemm.N = b->n;
+        gemm.K = b->k;
+        gemm.alpha = 1.0f;
+        gemm.A.pack = pack_rows;
+        gemm.A.ctx = rows;
+        gemm.B.data = b->B;
+        gemm.B.rs = b->ldb;
+        gemm.B.cs = 1;
+        gemm.C = C;
+        gemm.rs_c = b->n;
+        gemm.cs_c = 1;
+        gemm.num_thread = s->config.num_thread;
+        if (!packed_gemm(&gemm))
+            return false;
+
+        row = 0;
+        for (struct gemm_request *r = b->head; r; r = r->next)
+            for (int i = 0; i < r->m; i++, row++)
+                memcpy(&r->C[(long)i * r->ldc], &C[(long)row * b->n], b->n * sizeof(float));
+        return true;
+    }
+
+    static void run_batch(struct gemm_server *s, struct open_batch *b)
+    {
+        bool stacked = run_stacked(s, b);
+        if (stacked)
+        {
+            s->stats.batches++;
+            s->stats.rows += b->rows;
+        }
+        else
+            printf("gemm_server: cannot run a batch of %d rows, running its requests one at a time\n", b->rows);
+
+        // The caller may reuse a request as soon as it is done, so next is read first
+        double now = now_ns();
+        for (struct gemm_request *r = b->head, *next; r; r = next)
+        {
+            next = r->next;
+            if (stacked)
+                r->ok = true;
+            else
+            {
+                r->ok = run_request(s, r);
+                now = now_ns();
+            }
+            r->latency_ms = (now - r->submit_ns) / 1e6;
+            r->done.store(true, std::memory_order_release);
+            s->stats.requests++;
+        }
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_broadcast(&s->completed);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    static void add_request(struct gemm_server *s, struct open_batch *open, int *num_open, struct gemm_request *r)
+    {
+        double flush = r->submit_ns + (r->deadline_us > 0 && r->deadline_us < s->config.batch_window_us
+                                           ? r->deadline_us : s->config.batch_window_us) * 1e3;
+        int j;
+        for (j = 0; j < *num_open; j++)
+            if (open[j].B == r->B && open[j].ldb == r->ldb && open[j].n == r->n && open[j].k == r->k)
+                break;
+        if (j == *num_open)
+        {
+            // No room for another B: the batch due first goes now
+            if (*num_open == SERVER_MAX_OPEN)
+            {
+                int first = 0;
+                for (int i = 1; i < *num_open; i++)
+                    if (open[i].flush_ns < open[first].flush_ns)
+                        first = i;
+                run_batch(s, &open[first]);
+                open[first] = open[--*num_open];
+                j = *num_open;
+            }
+            struct open_batch batch = {r->B, r->ldb, r->n, r->k, 0, flush, NULL, NULL};
+            open[(*num_open)++] = batch;
+        }
+
+        struct open_batch *b = &open[j];
+        r->next = NULL;
+        if (b->tail)
+            b->tail->next = r;
+        else
+            b->head = r;
+        b->tail = r;
+        b->rows += r->m;
+        if (flush < b->flush_ns)
+            b->flush_ns = flush;
+        if (b->rows >= s->config.max_batch_rows)
+        {
+            run_batch(s, b);
+            *b = open[--*num_open];
+        }
+    }
+
+    static void *dispatcher_func(void *args)
+    {
+        struct gemm_server *s = (struct gemm_server *)args;
+        struct open_batch open[SERVER_MAX_OPEN];
+        int num_open = 0;
+
+        for (;;)
+        {
+            bool stopping = !s->running.load(std::memory_order_acquire);
+            struct gemm_request *r;
+            while ((r = queue_pop(s)) != NULL)
+                add_request(s, open, &num_open, r);
+
+            // Expired batches run; once stopping, all of them do
+            double now = now_ns(), next_flush = 0;
+            for (int j = 0; j < num_open;)
+                if (stopping || open[j].flush_ns <= now)
+                {
+                    run_batch(s, &open[j]);
+                    open[j] = open[--num_open];
+                }
+                else
+                {
+                    if (next_flush == 0 || open[j].flush_ns < next_flush)
+                        next_flush = open[j].flush_ns;
+                    j++;
+                }
+            if (stopping)
+                break;
+
+            // Sleep until a submission or the next batch is due
+            TRACE_SCOPE(TRACE_WAIT);
+            if (next_flush == 0)
+                sem_wait(&s->pending);
+            else
+            {
+                struct timespec until;
+                clock_gettime(CLOCK_REALTIME, &until);
+                long wait_ns = (long)(next_flush - now_ns());
+                if (wait_ns > 0)
+                {
+                    until.tv_nsec += wait_ns % 1000000000;
+                    until.tv_sec += wait_ns / 1000000000 + until.tv_nsec / 1000000000;
+                    until.tv_nsec %= 1000000000;
+                    while (sem_timedwait(&s->pending, &until) == -1 && errno == EINTR)
+                        ;
+                }
+            }
+            while (sem_trywait(&s->pending) == 0)
+                ;
+        }
+        return NULL;
+    }
+
+    bool gemm_server_start(struct gemm_server *server, const struct gemm_server_config *config)
+    {
+        server->config = *config;
+        for (size_t i = 0; i < SERVER_QUEUE_SIZE; i++)
+        {
+            server->cells[i].sequence.store(i, std::memory_order_relaxed);
+            server->cells[i].request = NULL;
+        }
+        server->enqueue_pos.store(0, std::memory_order_relaxed);
+        server->dequeue_pos.store(0, std::memory_order_relaxed);
+        server->running.store(true, std::memory_order_release);
+        memset(&server->stats, 0, sizeof(server->stats));
+        sem_init(&server->pending, 0, 0);
+        pthread_mutex_init(&server->lock, NULL);
+        pthread_cond_init(&server->completed, NULL);
+        if (pthread_create(&server->dispatcher, NULL, dispatcher_func, server) != 0)
+        {
+            printf("gemm_server: cannot start the dispatcher\n");
+            return false;
+        }
+        return true;
+    }
+
+    bool gemm_server_submit(struct gemm_server *server, struct gemm_request *request)
+    {
+        request->done.store(false, std::memory_order_relaxed);
+        request->server = server;
+        request->submit_ns = now_ns();
+        if (!queue_push(server, request))
+            return false;
+        sem_post(&server->pending);
+        return true;
+    }
+
+    bool gemm_server_wait(struct gemm_request *request)
+    {
+        if (request->done.load(std::memory_order_acquire))
+            return request->ok;
+        struct gemm_server *s = request->server;
+        TRACE_SCOPE(TRACE_WAIT);
+        pthread_mutex_lock(&s->lock);
+        while (!request->done.load(std::memory_order_acquire))
+            pthread_cond_wait(&s->completed, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+        return request->ok;
+    }
+
+    void gemm_server_stop(struct gemm_server *server)
+    {
+        server->running.store(false, std::memory_order_release);
+        sem_post(&server->pending);
+        pthread_join(server->dispatcher, NULL);
+        sem_destroy(&server->pending);
+        pthread_mutex_destroy(&server->lock);
+        pthread_cond_destroy(&server->completed);
+    }
+}
@@ -0,0 +1,221 @@
+#include "level3.h"
+#include "gemm.h"
+#include "trace.h"
+#include <pthread.h>
+
+// Diagonal blocks with fewer multiply-adds than this are substituted on the calling thread
+#define TRSM_MIN_PARALLEL (64 * 1024)
+
+namespace matmul
+{
+    static bool run_gemm(int m, int n, int k, float alpha, struct gemm_view A, struct gemm_view B, float beta, float *C,
+                         long rs_c, long cs_c, enum gemm_triangle triangle, int num_thread)
+    {
+        struct gemm_params gemm = {};
+        gemm.M = m;
+        gemm.N = n;
+        gemm.K = k;
+        gemm.alpha = alpha;
+        gemm.beta = beta;
+        gemm.A = A;
+        gemm.B = B;
+        gemm.C = C;
+        gemm.rs_c = rs_c;
+        gemm.cs_c = cs_c;
+        gemm.num_thread = num_thread;
+        gemm.triangle = triangle;
+        return packed_gemm(&gemm);
+    }
+
+    bool syrk(bool lower, bool transpose, int n, int k, float alpha, const float *A, int lda, float beta, float *C,
+              int ldc, int num_thread)
+    {
+        // A * A^T reads A by rows on both sides, A^T * A by columns
+        struct gemm_view left = {A, transpose ? 1 : lda, transpose ? lda : 1, NULL, NULL};
+        struct gemm_view right = {A, transpose ? lda : 1, transpose ? 1 : lda, NULL, NULL};
+        return run_gemm(n, n, k, alpha, left, right, beta, C, ldc, 1, lower ? GEMM_C_LOWER : GEMM_C_UPPER, num_thread);
+    }
+
+    bool trmm(bool lower, bool transpose, int m, int n, float alpha, const float *T, int ldt, const float *B, int ldb,
+              float *C, int ldc, int num_thread)
+    {
+        // T^T is T read with the strides swapped, and the other triangle
+        struct gemm_view op_T = {T, transpose ? 1 : ldt, transpose ? ldt : 1, NULL, NULL};
+        struct gemm_view view_B = {B, ldb, 1, NULL, NULL};
+        return run_gemm(m, n, m, alpha, op_T, view_B, 0.0f, C, ldc, 1, lower != transpose ? GEMM_A_LOWER : GEMM_A_UPPER,
+                        num_thread);
+    }
+
+    // Substitution within the diagonal block of rows k .. k + b, for right-hand sides c0 .. c1
+    struct substitute_args
+    {
+        const float *T;
+        long rs, cs;
+        bool lower, unit_diagonal;
+        int k, b;
+        float *B;
+        long rs_b, cs_b;
+        int c0, c1;
+    };
+
+    static void *substitute_func(void *args)
+    {
+        const struct substitute_args *a = (const struct substitute_args *)args;
+        TRACE_SCOPE(TRACE_KERNEL);
+        for (int s = 0; s < a->b; s++)
+        {
+            int i = a->lower ? a->k + s : a->k + a->b - 1 - s;
+            float *row = &a->B[i * a->rs_b];
+            int j0 = a->lower ? a->k : i + 1, j1 = a->lower ? i : a->k + a->b;
+            for (int j = j0; j < j1; j++)
+            {
+                float t = a->T[i * a->rs + j * a->cs];
+                const float *solved = &a->B[j * a->rs_b];
+                // Contiguous right-hand sides (the left side) get a loop the compiler can vectorize
+                if (a->cs_b == 1)
+                    for (int c = a->c0; c < a->c1; c++)
+                        row[c] -= t * solved[c];
+                else
+                    for (int c = a->c0; c < a->c1; c++)
+                        row[c * a->cs_b] -= t * solved[c * a->cs_b];
+            }
+            if (!a->unit_diagonal)
+            {
+                float inv = 1.0f / a->T[i * a->rs + i * a->cs];
+                for (int c = a->c0; c < a->c1; c++)
+                    row[c * a->cs_b] *= inv;
+            }
+        }
+        return NULL;
+    }
+
+    // The right-hand sides are independent, so they are split across the threads
+    static void substitute(struct substitute_args *block, int nrhs, int num_thread)
+    {
+        if (num_thread > nrhs)
+            num_thread = nrhs;
+        if (num_thread <= 1 || (long)block->b * block->b * nrhs / 2 < TRSM_MIN_PARALLEL)
+        {
+            block->c0 = 0;
+            block->c1 = nrhs;
+            substitute_func(block);
+            return;
+        }
+        pthread_t thread_pool[num_thread];
+        struct substitute_args threads_args[num_thread];
+        for (int j = 0; j < num_thread; j++)
+        {
+            threads_args[j] = *block;
+            threads_args[j].c0 = (long)nrhs * j / num_thread;
+            threads_args[j].c1 = (long)nrhs * (j + 1) / num_thread;
+            pthread_create(&thread_pool[j], NULL, substitute_func, &threads_args[j]);
+        }
+        TRACE_SCOPE(TRACE_WAIT);
+        for (int j = 0; j < num_thread; j++)
+            pthread_join(thread_pool[j], NULL);
+    }
+
+    // B = T^-1 * B for triangular T (n x n) with element (i, j) at T[i * rs + j * cs] and B (n x nrhs) at
+    // B[i * rs_b + c * cs_b]. Diagonal blocks are solved by substitution, the rest of B is updated with GEMMs.
+    static bool solve_left(const float *T, long rs, long cs, bool lower, bool unit_diagonal, int n, float *B, int nrhs,
+                           long rs_b, long cs_b, int num_thread)
+    {
+        for (int done = 0; done < n; done += TRSM_BLOCK)
+        {
+            int b = n - done < TRSM_BLOCK ? n - done : TRSM_BLOCK;
+            // Lower: rows k .. k + b top down; upper: the same rows counted from the bottom
+            int k = lower ? done : n - done - b;
+            struct substitute_args block = {T, rs, cs, lower, unit_diagonal, k, b, B, rs_b, cs_b, 0, 0};
+            substitute(&block, nrhs, num_thread);
+
+            struct gemm_view solved = {&B[k * rs_b], rs_b, cs_b, NULL, NULL};
+            if (lower)
+            {
+                struct gemm_view below = {&T[(k + b) * rs + k * cs], rs, cs, NULL, NULL};
+                if (!run_gemm(n - k - b, nrhs, b, -1.0f, below, solved, 1.0f, &B[(k + b) * rs_b], rs_b, cs_b,
+                              GEMM_FULL, num_thread))
+                    return false;
+            }
+            else
+            {
+                struct gemm_view above = {&T[k * cs], rs, cs, NULL, NULL};
+                if (!run_gemm(k, nrhs, b, -1.0f, above, solved, 1.0f, B, rs_b, cs_b, GEMM_FULL, num_thread))
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    bool trsm(bool left, bool lower, bool transpose, bool unit_diagonal, int m, int n, float alpha, const float *T,
+              int ldt, float *B, int ldb, int num_thread)
+    {
+        if (alpha != 1.0f)
+            for (int i = 0; i < m; i++)
+                for (int j = 0; j < n; j++)
+                    B[(long)i * ldb + j] *= alpha;
+        // op(T), or for the right side op(T)^T, read with swapped strides, solved against B or B^T
+        bool flip = left ? transpose : !transpose;
+        if (left)
+            return solve_left(T, flip ? 1 : ldt, flip ? ldt : 1, lower != flip, unit_diagonal, m, B, n, ldb, 1,
+                              num_thread);
+        return solve_left(T, flip ? 1 : ldt, flip ? ldt : 1, lower != flip, unit_diagonal, n, B, m, 1, ldb, num_thread);
+    }
+
+    // Element (i, l) of op(T), zero outside its triangle
+    static inline float op_element(const float *T, int ldt, bool lower, bool transpose, int i, int l)
+    {
+        bool op_lower = lower != transpose;
+        if (op_lower ? l > i : l < i)
+            return 0;
+        return transpose ? T[(long)l * ldt + i] : T[(long)i * ldt + l];
+    }
+
+    void syrk_reference(bool lower, bool transpose, int n, int k, float alpha, const float *A, int lda, float beta,
+                        float *C, int ldc)
+    {
+        for (int i = 0; i < n; i++)
+            for (int j = lower ? 0 : i; j < (lower ? i + 1 : n); j++)
+            {
+                float sum = 0;
+                for (int l = 0; l < k; l++)
+                    sum += transpose ? A[(long)l * lda + i] * A[(long)l * lda + j] : A[(long)i * lda + l] * A[(long)j * lda + l];
+                float *c = &C[(long)i * ldc + j];
+                *c = beta == 0 ? alpha * sum : alpha * sum + beta * *c;
+            }
+    }
+
+    void trmm_reference(bool lower, bool transpose, int m, int n, float alpha, const float *T, int ldt, const float *B,
+                        int ldb, float *C, int ldc)
+    {
+        for (int i = 0; i < m; i++)
+            for (int j = 0; j < n; j++)
+            {
+                float sum = 0;
+                for (int l = 0; l < m; l++)
+                    sum += op_element(T, ldt, lower, transpose, i, l) * B[(long)l * ldb + j];
+                C[(long)i * ldc + j] = alpha * sum;
+            }
+    }
+
+    void trsm_reference(bool left, bool lower, bool transpose, bool unit_diagonal, int m, int n, float alpha,
+                        const float *T, int ldt, float *B, int ldb)
+    {
+        // One system per column of B (left) or per row (right, as op(T)^T * x^T = alpha * b^T)
+        int size = left ? m : n, count = left ? n : m;
+        bool forward = left ? lower != transpose : lower == transpose;
+        for (int r = 0; r < count; r++)
+            for (int s = 0; s < size; s++)
+            {
+                int i = forward ? s : size - 1 - s;
+                float *x = left ? &B[(long)i * ldb + r] : &B[(long)r * ldb + i];
+                float sum = alpha * *x;
+                for (int t = 0; t < s; t++)
+                {
+                    int l = forward ? t : size - 1 - t;
+                    float solved = left ? B[(long)l * ldb + r] : B[(long)r * ldb + l];
+                    sum -= (left ? op_element(T, ldt, lower, transpose, i, l) : op_element(T, ldt, lower, transpose, l, i)) * solved;
+                }
+                *x = unit_diagonal ? sum : sum / op_element(T, ldt, lower, transpose, i, i);
+            }
+    }
+}
@@ -1,4 +1,5 @@
 #include "matmul.h"
+#include "trace.h"
 #include <stdio.h>
 #include <assert.h>
 #include <pthread.h>
@@ -14,6 +15,7 @@ namespace matmul
         const struct matrix *C = mat_args->C;
         float *data_A = A->data_ptr, *data_B = B->data_ptr, *data_C = C->data_ptr;
         int start_i = mat_args->start_i, end_i = mat_args->end_i;
+        TRACE_SCOPE(TRACE_KERNEL);
 
         for (int i = start_i; i < end_i; i++)
             for (int j = 0; j < C->column; j++)
@@ -50,6 +52,7 @@ namespace matmul
             pthread_create(&thread_pool[j], NULL, thread_func, &threads_args[j]);
         }
         // Join threads
+        TRACE_SCOPE(TRACE_WAIT);
         for (j = 0; j < num_thread; j++)
         {
             pthread_join(thread_pool[j], NULL);
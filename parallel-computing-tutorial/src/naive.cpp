@@ -95,6 +95,16 @@ namespace matmul
             for (int i = 0; i < RUNS; i++)
                 this->mat_mul_fast(params);
             break;
+        case PACKED:
+            function_name = "mat_mul_packed";
+            for (int i = 0; i < RUNS; i++)
+                this->mat_mul_packed(params);
+            break;
+        case PIPELINED:
+            function_name = "mat_mul_pipelined";
+            for (int i = 0; i < RUNS; i++)
+                this->mat_mul_pipelined(params);
+            break;
         default:
             break;
         }
@@ -0,0 +1,275 @@
+#include "ooc_gemm.h"
+#include "gemm.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PAGE_SIZE 4096
+
+namespace matmul
+{
+    static void init_layout(struct tiled_matrix *mat, int rows, int cols, int tile)
+    {
+        mat->rows = rows;
+        mat->cols = cols;
+        mat->tile = tile;
+        mat->tile_rows = (rows + tile - 1) / tile;
+        mat->tile_cols = (cols + tile - 1) / tile;
+        mat->tile_stride = ((size_t)tile * tile * sizeof(float) + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+        mat->map_size = TILE_FILE_HEADER_SIZE + mat->tile_stride * mat->tile_rows * mat->tile_cols;
+    }
+
+    static bool map_file(struct tiled_matrix *mat, bool writable)
+    {
+        int prot = PROT_READ | (writable ? PROT_WRITE : 0);
+        void *map = mmap(NULL, mat->map_size, prot, MAP_SHARED, mat->fd, 0);
+        if (map == MAP_FAILED)
+        {
+            perror("mmap");
+            close(mat->fd);
+            mat->fd = -1;
+            return false;
+        }
+        mat->map = (char *)map;
+        return true;
+    }
+
+    bool tiled_matrix_create(const char *path, int rows, int cols, int tile, struct tiled_matrix *mat)
+    {
+        assert(rows > 0 && cols > 0 && tile > 0);
+        init_layout(mat, rows, cols, tile);
+        mat->map = NULL;
+
+        mat->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (mat->fd < 0)
+        {
+            perror(path);
+            return false;
+        }
+        // The file is sparse until tiles are written, so padding costs no disk space
+        if (ftruncate(mat->fd, mat->map_size) != 0)
+        {
+            perror("ftruncate");
+            close(mat->fd);
+            mat->fd = -1;
+            return false;
+        }
+        if (!map_file(mat, true))
+            return false;
+
+        struct tile_file_header header;
+        memcpy(header.magic, TILE_FILE_MAGIC, sizeof(header.magic));
+        header.rows = rows;
+        header.cols = cols;
+        header.tile = tile;
+        memcpy(mat->map, &header, sizeof(header));
+        return true;
+    }
+
+    bool tiled_matrix_open(const char *path, bool writable, struct tiled_matrix *mat)
+    {
+        mat->map = NULL;
+        mat->fd = open(path, writable ? O_RDWR : O_RDONLY);
+        if (mat->fd < 0)
+        {
+            perror(path);
+            return false;
+        }
+
+        struct tile_file_header header;
+        struct stat st;
+        if (pread(mat->fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+            memcmp(header.magic, TILE_FILE_MAGIC, sizeof(header.magic)) != 0 ||
+            header.rows <= 0 || header.cols <= 0 || header.tile <= 0)
+        {
+            fprintf(stderr, "%s: not a tile file\n", path);
+            close(mat->fd);
+            mat->fd = -1;
+            return false;
+        }
+        init_layout(mat, header.rows, header.cols, header.tile);
+        if (fstat(mat->fd, &st) != 0 || (size_t)st.st_size < mat->map_size)
+        {
+            fprintf(stderr, "%s: truncated tile file\n", path);
+            close(mat->fd);
+            mat->fd = -1;
+            return false;
+        }
+        return map_file(mat, writable);
+    }
+
+    void tiled_matrix_close(struct tiled_matrix *mat)
+    {
+        if (mat->map)
+            munmap(mat->map, mat->map_size);
+        if (mat->fd >= 0)
+            close(mat->fd);
+        mat->map = NULL;
+        mat->fd = -1;
+    }
+
+    float *tiled_matrix_tile(const struct tiled_matrix *mat, int ti, int tj)
+    {
+        return (float *)(mat->map + TILE_FILE_HEADER_SIZE + mat->tile_stride * ((size_t)ti * mat->tile_cols + tj));
+    }
+
+    void tiled_matrix_from_dense(struct tiled_matrix *mat, const float *data)
+    {
+        int T = mat->tile;
+        for (int ti = 0; ti < mat->tile_rows; ti++)
+            for (int tj = 0; tj < mat->tile_cols; tj++)
+            {
+                float *tile = tiled_matrix_tile(mat, ti, tj);
+                int m = mat->rows - ti * T < T ? mat->rows - ti * T : T;
+                int n = mat->cols - tj * T < T ? mat->cols - tj * T : T;
+                for (int i = 0; i < m; i++)
+                    memcpy(&tile[i * T], &data[(size_t)(ti * T + i) * mat->cols + tj * T], n * sizeof(float));
+            }
+    }
+
+    void tiled_matrix_to_dense(const struct tiled_matrix *mat, float *data)
+    {
+        int T = mat->tile;
+        for (int ti = 0; ti < mat->tile_rows; ti++)
+            for (int tj = 0; tj < mat->tile_cols; tj++)
+            {
+                const float *tile = tiled_matrix_tile(mat, ti, tj);
+                int m = mat->rows - ti * T < T ? mat->rows - ti * T : T;
+                int n = mat->cols - tj * T < T ? mat->cols - tj * T : T;
+                for (int i = 0; i < m; i++)
+                    memcpy(&data[(size_t)(ti * T + i) * mat->cols + tj * T], &tile[i * T], n * sizeof(float));
+            }
+    }
+
+    static void advise_tiles(const struct tiled_matrix *mat, int ti0, int ti1, int tj0, int tj1, int advice)
+    {
+        for (int ti = ti0; ti < ti1; ti++)
+            for (int tj = tj0; tj < tj1; tj++)
+                madvise(tiled_matrix_tile(mat, ti, tj), mat->tile_stride, advice);
+    }
+
+    // One step of the schedule: the C block at (bi, bj) accumulating the k-th tile product
+    struct ooc_step
+    {
+        int bi, bj, k;
+    };
+
+    static void step_of(int s, int num_bj, int num_k, struct ooc_step *step)
+    {
+        step->k = s % num_k;
+        s /= num_k;
+        step->bi = s / num_bj;
+        step->bj = s % num_bj;
+        // Sweep block columns back and forth so consecutive blocks share the tail of B
+        if (step->bi % 2 == 1)
+            step->bj = num_bj - 1 - step->bj;
+    }
+
+    bool ooc_gemm(const struct tiled_matrix *A, const struct tiled_matrix *B, struct tiled_matrix *C,
+                  size_t memory_budget, int num_thread, struct ooc_stats *stats)
+    {
+        assert(A->cols == B->rows && C->rows == A->rows && C->cols == B->cols);
+        assert(A->tile == B->tile && B->tile == C->tile);
+        int T = A->tile, Mt = C->tile_rows, Nt = C->tile_cols, Kt = A->tile_cols;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        // Keep an mb x nb block of C resident and stream k: one column of mb A tiles and one
+        // row of nb B tiles per step, double-buffered for prefetch. Pick the block with the
+        // most tile products per tile read, mb * nb / (mb + nb), that fits in the budget
+        // left after the packing buffers of packed_gemm.
+        size_t scratch_size = packed_gemm_scratch_size(T, T, num_thread, false);
+        long capacity = memory_budget > scratch_size ? (memory_budget - scratch_size) / C->tile_stride : 0;
+        int mb = 0, nb = 0;
+        for (int m = 1; m <= Mt; m++)
+            for (int n = 1; n <= Nt; n++)
+                if ((long)m * n + 2L * (m + n) <= capacity &&
+                    (mb == 0 || (long)m * n * (mb + nb) > (long)mb * nb * (m + n)))
+                {
+                    mb = m;
+                    nb = n;
+                }
+        if (mb == 0)
+        {
+            fprintf(stderr, "ooc_gemm: memory budget of %zu bytes holds fewer than 5 tiles besides %zu bytes of packing buffers\n",
+                    memory_budget, scratch_size);
+            return false;
+        }
+
+        int num_bi = (Mt + mb - 1) / mb, num_bj = (Nt + nb - 1) / nb;
+        int num_step = num_bi * num_bj * Kt;
+        long tiles_read = 0;
+
+        struct gemm_params gemm = {};
+        gemm.alpha = 1.0f;
+        gemm.A.rs = gemm.B.rs = gemm.rs_c = T;
+        gemm.A.cs = gemm.B.cs = gemm.cs_c = 1;
+        gemm.num_thread = num_thread;
+        gemm.pipeline = false;
+        gemm.stats = NULL;
+
+        struct ooc_step step;
+        step_of(0, num_bj, Kt, &step);
+        advise_tiles(A, step.bi * mb, step.bi * mb + mb < Mt ? step.bi * mb + mb : Mt, 0, 1, MADV_WILLNEED);
+        advise_tiles(B, 0, 1, step.bj * nb, step.bj * nb + nb < Nt ? step.bj * nb + nb : Nt, MADV_WILLNEED);
+
+        for (int s = 0; s < num_step; s++)
+        {
+            step_of(s, num_bj, Kt, &step);
+            int i0 = step.bi * mb, i1 = i0 + mb < Mt ? i0 + mb : Mt;
+            int j0 = step.bj * nb, j1 = j0 + nb < Nt ? j0 + nb : Nt;
+
+            // Start reading the tiles of the next step while this one computes
+            if (s + 1 < num_step)
+            {
+                struct ooc_step next;
+                step_of(s + 1, num_bj, Kt, &next);
+                int ni0 = next.bi * mb, ni1 = ni0 + mb < Mt ? ni0 + mb : Mt;
+                int nj0 = next.bj * nb, nj1 = nj0 + nb < Nt ? nj0 + nb : Nt;
+                advise_tiles(A, ni0, ni1, next.k, next.k + 1, MADV_WILLNEED);
+                advise_tiles(B, next.k, next.k + 1, nj0, nj1, MADV_WILLNEED);
+            }
+
+            int k = step.k;
+            gemm.K = A->cols - k * T < T ? A->cols - k * T : T;
+            gemm.beta = k == 0 ? 0.0f : 1.0f;
+            for (int ti = i0; ti < i1; ti++)
+                for (int tj = j0; tj < j1; tj++)
+                {
+                    gemm.M = C->rows - ti * T < T ? C->rows - ti * T : T;
+                    gemm.N = C->cols - tj * T < T ? C->cols - tj * T : T;
+                    gemm.A.data = tiled_matrix_tile(A, ti, k);
+                    gemm.B.data = tiled_matrix_tile(B, k, tj);
+                    gemm.C = tiled_matrix_tile(C, ti, tj);
+                    if (!packed_gemm(&gemm))
+                        return false;
+                }
+            tiles_read += (i1 - i0) + (j1 - j0);
+
+            // Release the streamed tiles; a finished C block is written back and released too
+            advise_tiles(A, i0, i1, k, k + 1, MADV_DONTNEED);
+            advise_tiles(B, k, k + 1, j0, j1, MADV_DONTNEED);
+            if (k == Kt - 1)
+                for (int ti = i0; ti < i1; ti++)
+                {
+                    msync(tiled_matrix_tile(C, ti, j0), C->tile_stride * (j1 - j0), MS_ASYNC);
+                    advise_tiles(C, ti, ti + 1, j0, j1, MADV_DONTNEED);
+                }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (stats)
+        {
+            stats->block_rows = mb;
+            stats->block_cols = nb;
+            stats->tiles_read = tiles_read;
+            stats->ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        }
+        return true;
+    }
+}
@@ -1,4 +1,6 @@
 #include "matmul.h"
+#include "small_gemm.h"
+#include "trace.h"
 #include <stdio.h>
 #include <assert.h>
 #include <pthread.h>
@@ -30,6 +32,7 @@ namespace matmul
 
         for (int ti = start_i; ti < end_i; ti += BLK_SIZE)
         {
+            TRACE_SCOPE(TRACE_KERNEL);
             for (int tj = 0; tj < C->column; tj += BLK_SIZE)
             {
                 for (int i = ti; i < ti + BLK_SIZE; i++)
@@ -100,6 +103,18 @@ namespace matmul
         assert(A->column == B->column);
         assert(C->column == B->row);
         assert(C->row == A->row);
+
+        // Tiny shapes: transpose B back on the stack and run the fixed-size kernel on this thread
+        if (small_gemm_routable(C->row, C->column, A->column))
+        {
+            float B_kn[SMALL_GEMM_MAX * SMALL_GEMM_MAX];
+            for (int k = 0; k < A->column; k++)
+                for (int n = 0; n < B->row; n++)
+                    B_kn[k * B->row + n] = B->data_ptr[n * B->column + k];
+            small_gemm_dispatch(C->row, C->column, A->column, A->data_ptr, B_kn, C->data_ptr);
+            return;
+        }
+
         assert(num_thread != 0);
         assert(C->row % num_thread == 0);
 
@@ -118,6 +133,7 @@ namespace matmul
             pthread_create(&thread_pool[j], NULL, fast_thread_func, &threads_args[j]);
         }
         // Join threads
+        TRACE_SCOPE(TRACE_WAIT);
         for (j = 0; j < num_thread; j++)
         {
             pthread_join(thread_pool[j], NULL);
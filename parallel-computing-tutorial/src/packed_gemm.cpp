@@ -0,0 +1,567 @@
+#include "matmul.h"
+#include "gemm.h"
+#include "small_gemm.h"
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __SSE__
+#include <immintrin.h> // intel SSE/AVX intrinsic
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+namespace matmul
+{
+    // Packing buffers of the calling thread, kept across calls so repeated GEMMs reuse warm, huge-page-backed memory
+    struct gemm_scratch
+    {
+        struct arena buffers = {};
+        ~gemm_scratch() { arena_destroy(&buffers); }
+    };
+    static thread_local struct gemm_scratch scratch;
+    static enum arena_pages scratch_pages = HUGE_PAGES;
+
+    void gemm_set_scratch_pages(enum arena_pages pages)
+    {
+        scratch_pages = pages;
+        arena_destroy(&scratch.buffers);
+    }
+
+    static inline double now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+    }
+
+    void gemm_pack(const float *src, long rs, long cs, int rows, int kc, int r, float *dst)
+    {
+        for (int s = 0; s < rows; s += r, dst += r * kc)
+        {
+            int rem = rows - s < r ? rows - s : r;
+            const float *sliver = &src[s * rs];
+            if (cs == 1)
+            {
+                // Rows are contiguous in memory: stream along k
+                for (int i = 0; i < rem; i++)
+                    for (int k = 0; k < kc; k++)
+                        dst[k * r + i] = sliver[i * rs + k];
+            }
+            else
+            {
+                for (int k = 0; k < kc; k++)
+                    for (int i = 0; i < rem; i++)
+                        dst[k * r + i] = sliver[i * rs + k * cs];
+            }
+            if (rem < r)
+                for (int k = 0; k < kc; k++)
+                    for (int i = rem; i < r; i++)
+                        dst[k * r + i] = 0;
+        }
+    }
+
+    void gemm_micro_kernel(int kc, const float *a, const float *b, float *ab)
+    {
+#if defined(__AVX__) && defined(__FMA__)
+        __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+        __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+        __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+        __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+        __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+        __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+        for (int k = 0; k < kc; k++, a += GEMM_MR, b += GEMM_NR)
+        {
+            __m256 b0 = _mm256_load_ps(b), b1 = _mm256_load_ps(b + 8);
+            __m256 ai;
+            ai = _mm256_broadcast_ss(a);
+            c00 = _mm256_fmadd_ps(ai, b0, c00); c01 = _mm256_fmadd_ps(ai, b1, c01);
+            ai = _mm256_broadcast_ss(a + 1);
+            c10 = _mm256_fmadd_ps(ai, b0, c10); c11 = _mm256_fmadd_ps(ai, b1, c11);
+            ai = _mm256_broadcast_ss(a + 2);
+            c20 = _mm256_fmadd_ps(ai, b0, c20); c21 = _mm256_fmadd_ps(ai, b1, c21);
+            ai = _mm256_broadcast_ss(a + 3);
+            c30 = _mm256_fmadd_ps(ai, b0, c30); c31 = _mm256_fmadd_ps(ai, b1, c31);
+            ai = _mm256_broadcast_ss(a + 4);
+            c40 = _mm256_fmadd_ps(ai, b0, c40); c41 = _mm256_fmadd_ps(ai, b1, c41);
+            ai = _mm256_broadcast_ss(a + 5);
+            c50 = _mm256_fmadd_ps(ai, b0, c50); c51 = _mm256_fmadd_ps(ai, b1, c51);
+        }
+        _mm256_storeu_ps(&ab[0 * GEMM_NR], c00); _mm256_storeu_ps(&ab[0 * GEMM_NR + 8], c01);
+        _mm256_storeu_ps(&ab[1 * GEMM_NR], c10); _mm256_storeu_ps(&ab[1 * GEMM_NR + 8], c11);
+        _mm256_storeu_ps(&ab[2 * GEMM_NR], c20); _mm256_storeu_ps(&ab[2 * GEMM_NR + 8], c21);
+        _mm256_storeu_ps(&ab[3 * GEMM_NR], c30); _mm256_storeu_ps(&ab[3 * GEMM_NR + 8], c31);
+        _mm256_storeu_ps(&ab[4 * GEMM_NR], c40); _mm256_storeu_ps(&ab[4 * GEMM_NR + 8], c41);
+        _mm256_storeu_ps(&ab[5 * GEMM_NR], c50); _mm256_storeu_ps(&ab[5 * GEMM_NR + 8], c51);
+#elif defined(__SSE__)
+        __m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+        __m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+        __m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+        __m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+        for (int k = 0; k < kc; k++, a += GEMM_MR, b += GEMM_NR)
+        {
+            __m128 b0 = _mm_load_ps(b), b1 = _mm_load_ps(b + 4);
+            __m128 ai;
+            ai = _mm_load1_ps(a);
+            c00 = _mm_add_ps(c00, _mm_mul_ps(ai, b0)); c01 = _mm_add_ps(c01, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(a + 1);
+            c10 = _mm_add_ps(c10, _mm_mul_ps(ai, b0)); c11 = _mm_add_ps(c11, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(a + 2);
+            c20 = _mm_add_ps(c20, _mm_mul_ps(ai, b0)); c21 = _mm_add_ps(c21, _mm_mul_ps(ai, b1));
+            ai = _mm_load1_ps(a + 3);
+            c30 = _mm_add_ps(c30, _mm_mul_ps(ai, b0)); c31 = _mm_add_ps(c31, _mm_mul_ps(ai, b1));
+        }
+        _mm_storeu_ps(&ab[0 * GEMM_NR], c00); _mm_storeu_ps(&ab[0 * GEMM_NR + 4], c01);
+        _mm_storeu_ps(&ab[1 * GEMM_NR], c10); _mm_storeu_ps(&ab[1 * GEMM_NR + 4], c11);
+        _mm_storeu_ps(&ab[2 * GEMM_NR], c20); _mm_storeu_ps(&ab[2 * GEMM_NR + 4], c21);
+        _mm_storeu_ps(&ab[3 * GEMM_NR], c30); _mm_storeu_ps(&ab[3 * GEMM_NR + 4], c31);
+#elif defined(__ARM_NEON)
+        float32x4_t c00 = vdupq_n_f32(0), c01 = vdupq_n_f32(0);
+        float32x4_t c10 = vdupq_n_f32(0), c11 = vdupq_n_f32(0);
+        float32x4_t c20 = vdupq_n_f32(0), c21 = vdupq_n_f32(0);
+        float32x4_t c30 = vdupq_n_f32(0), c31 = vdupq_n_f32(0);
+        for (int k = 0; k < kc; k++, a += GEMM_MR, b += GEMM_NR)
+        {
+            float32x4_t b0 = vld1q_f32(b), b1 = vld1q_f32(b + 4);
+            c00 = vmlaq_n_f32(c00, b0, a[0]); c01 = vmlaq_n_f32(c01, b1, a[0]);
+            c10 = vmlaq_n_f32(c10, b0, a[1]); c11 = vmlaq_n_f32(c11, b1, a[1]);
+            c20 = vmlaq_n_f32(c20, b0, a[2]); c21 = vmlaq_n_f32(c21, b1, a[2]);
+            c30 = vmlaq_n_f32(c30, b0, a[3]); c31 = vmlaq_n_f32(c31, b1, a[3]);
+        }
+        vst1q_f32(&ab[0 * GEMM_NR], c00); vst1q_f32(&ab[0 * GEMM_NR + 4], c01);
+        vst1q_f32(&ab[1 * GEMM_NR], c10); vst1q_f32(&ab[1 * GEMM_NR + 4], c11);
+        vst1q_f32(&ab[2 * GEMM_NR], c20); vst1q_f32(&ab[2 * GEMM_NR + 4], c21);
+        vst1q_f32(&ab[3 * GEMM_NR], c30); vst1q_f32(&ab[3 * GEMM_NR + 4], c31);
+#else
+        float acc[GEMM_MR * GEMM_NR] = {};
+        for (int k = 0; k < kc; k++, a += GEMM_MR, b += GEMM_NR)
+            for (int i = 0; i < GEMM_MR; i++)
+                for (int j = 0; j < GEMM_NR; j++)
+                    acc[i * GEMM_NR + j] += a[i] * b[j];
+        memcpy(ab, acc, sizeof(acc));
+#endif
+    }
+
+    void gemm_update_tile(int m, int n, float alpha, const float *ab, float beta, float *C, long rs_c, long cs_c)
+    {
+        for (int i = 0; i < m; i++)
+        {
+            float *c = &C[i * rs_c];
+            if (beta == 0)
+                for (int j = 0; j < n; j++)
+                    c[j * cs_c] = alpha * ab[i * GEMM_NR + j];
+            else
+                for (int j = 0; j < n; j++)
+                    c[j * cs_c] = alpha * ab[i * GEMM_NR + j] + beta * c[j * cs_c];
+        }
+    }
+
+    // Rows of C (i0 .. i0 + m, columns j0 .. j0 + n) that lie in its computed triangle: columns [*first, *last)
+    static inline void triangle_columns(const struct gemm_params *p, int i, int j0, int n, int *first, int *last)
+    {
+        *first = 0;
+        *last = n;
+        if (p->triangle == GEMM_C_LOWER)
+            *last = i - j0 + 1 < n ? (i - j0 + 1 > 0 ? i - j0 + 1 : 0) : n;
+        else if (p->triangle == GEMM_C_UPPER)
+            *first = i - j0 > 0 ? (i - j0 < n ? i - j0 : n) : 0;
+    }
+
+    // gemm_update_tile for the tile at (i0, j0) of C, writing only its computed triangle
+    static void store_tile(const struct gemm_params *p, int i0, int j0, int m, int n, const float *ab, float beta)
+    {
+        float *C = &p->C[i0 * p->rs_c + j0 * p->cs_c];
+        bool full = p->triangle == GEMM_C_LOWER ? j0 + n - 1 <= i0 : p->triangle == GEMM_C_UPPER ? j0 >= i0 + m - 1 : true;
+        if (full)
+        {
+            gemm_update_tile(m, n, p->alpha, ab, beta, C, p->rs_c, p->cs_c);
+            return;
+        }
+        for (int i = 0; i < m; i++)
+        {
+            int first, last;
+            triangle_columns(p, i0 + i, j0, n, &first, &last);
+            if (first < last)
+                gemm_update_tile(1, last - first, p->alpha, &ab[i * GEMM_NR + first], beta, &C[i * p->rs_c + first * p->cs_c],
+                                 p->rs_c, p->cs_c);
+        }
+    }
+
+    // K range [*k0, *k1) of a packed KC block (starting at pc) that rows i0 .. i0 + m of a triangular A touch
+    static inline void triangle_k_range(const struct gemm_params *p, int i0, int m, int pc, int kc, int *k0, int *k1)
+    {
+        *k0 = 0;
+        *k1 = kc;
+        if (p->triangle == GEMM_A_LOWER && i0 + m - pc < kc)
+            *k1 = i0 + m - pc;
+        else if (p->triangle == GEMM_A_UPPER && i0 - pc > 0)
+            *k0 = i0 - pc;
+    }
+
+    // Zero the elements of a packed block of A (rows ic .., columns pc ..) outside its triangle
+    static void mask_packed_A(const struct gemm_params *p, int ic, int mc, int pc, int kc, float *packed_A)
+    {
+        for (int s = 0; s < mc; s += GEMM_MR)
+            for (int i = 0; i < GEMM_MR; i++)
+            {
+                int row = ic + s + i;
+                float *a = &packed_A[s * kc + i];
+                if (p->triangle == GEMM_A_LOWER)
+                    for (int k = row + 1 - pc > 0 ? row + 1 - pc : 0; k < kc; k++)
+                        a[k * GEMM_MR] = 0;
+                else
+                    for (int k = 0; k < row - pc && k < kc; k++)
+                        a[k * GEMM_MR] = 0;
+            }
+    }
+
+    struct gemm_shared
+    {
+        const struct gemm_params *params;
+        float *packed_B[2];
+        int num_worker, num_pc, num_panel;
+        pthread_barrier_t barrier;
+        // Barrier arrival times, double-buffered by step parity
+        double *arrive_ns[2];
+        double pack_ns, exposed_ns;
+    };
+
+    struct gemm_thread_args
+    {
+        struct gemm_shared *shared;
+        int tid;
+        int start_i, end_i;
+        float *packed_A;
+    };
+
+    static inline void panel_of(const struct gemm_shared *sh, int t, int *jc, int *nc, int *pc, int *kc)
+    {
+        const struct gemm_params *p = sh->params;
+        *jc = (t / sh->num_pc) * GEMM_NC;
+        *pc = (t % sh->num_pc) * GEMM_KC;
+        *nc = p->N - *jc < GEMM_NC ? p->N - *jc : GEMM_NC;
+        *kc = p->K - *pc < GEMM_KC ? p->K - *pc : GEMM_KC;
+    }
+
+    static void pack_B_slivers(const struct gemm_params *p, int pc, int kc, int jc, int nc, int first, int last, float *packed_B)
+    {
+        // B slivers are packed as slivers of the transposed view, NR columns at a time
+        TRACE_SCOPE(TRACE_PACK);
+        const struct gemm_view *B = &p->B;
+        int j0 = first * GEMM_NR, j1 = last * GEMM_NR < nc ? last * GEMM_NR : nc;
+        if (j0 >= j1)
+            return;
+        if (B->pack)
+        {
+            B->pack(B->ctx, pc, kc, jc + j0, j1 - j0, GEMM_NR, &packed_B[j0 * kc]);
+            return;
+        }
+        gemm_pack(&B->data[pc * B->rs + (jc + j0) * B->cs], B->cs, B->rs, j1 - j0, kc, GEMM_NR, &packed_B[j0 * kc]);
+    }
+
+    static void compute_panel(const struct gemm_thread_args *t_args, const float *packed_B, int jc, int nc, int pc, int kc)
+    {
+        const struct gemm_params *p = t_args->shared->params;
+        const struct gemm_view *A = &p->A;
+        float beta = pc == 0 ? p->beta : 1.0f;
+        bool triangular_A = p->triangle == GEMM_A_LOWER || p->triangle == GEMM_A_UPPER;
+        alignas(64) float ab[GEMM_MR * GEMM_NR];
+
+        for (int ic = t_args->start_i; ic < t_args->end_i; ic += GEMM_MC)
+        {
+            int mc = t_args->end_i - ic < GEMM_MC ? t_args->end_i - ic : GEMM_MC;
+            // Blocks outside a triangular C, or against a zero block of a triangular A, add nothing
+            int k0, k1;
+            triangle_k_range(p, ic, mc, pc, kc, &k0, &k1);
+            if ((p->triangle == GEMM_C_LOWER && jc > ic + mc - 1) || (p->triangle == GEMM_C_UPPER && jc + nc - 1 < ic) ||
+                (k0 >= k1 && pc > 0))
+                continue;
+            {
+                TRACE_SCOPE(TRACE_PACK);
+                if (A->pack)
+                    A->pack(A->ctx, pc, kc, ic, mc, GEMM_MR, t_args->packed_A);
+                else
+                    gemm_pack(&A->data[ic * A->rs + pc * A->cs], A->rs, A->cs, mc, kc, GEMM_MR, t_args->packed_A);
+                if (triangular_A)
+                    mask_packed_A(p, ic, mc, pc, kc, t_args->packed_A);
+            }
+            TRACE_SCOPE(TRACE_KERNEL);
+            for (int jr = 0; jr < nc; jr += GEMM_NR)
+            {
+                int n = nc - jr < GEMM_NR ? nc - jr : GEMM_NR;
+                for (int ir = 0; ir < mc; ir += GEMM_MR)
+                {
+                    int m = mc - ir < GEMM_MR ? mc - ir : GEMM_MR;
+                    int i0 = ic + ir, j0 = jc + jr;
+                    if ((p->triangle == GEMM_C_LOWER && j0 > i0 + m - 1) || (p->triangle == GEMM_C_UPPER && j0 + n - 1 < i0))
+                        continue;
+                    // Packed slivers are k-major, so a sub-range of k is a shorter product from an offset
+                    triangle_k_range(p, i0, m, pc, kc, &k0, &k1);
+                    if (k0 < k1)
+                        gemm_micro_kernel(k1 - k0, &t_args->packed_A[ir * kc + k0 * GEMM_MR], &packed_B[jr * kc + k0 * GEMM_NR], ab);
+                    else if (pc > 0)
+                        continue;
+                    else
+                        memset(ab, 0, sizeof(ab));
+                    store_tile(p, i0, j0, m, n, ab, beta);
+                }
+            }
+        }
+    }
+
+    static inline void barrier_wait(struct gemm_shared *sh)
+    {
+        TRACE_SCOPE(TRACE_WAIT);
+        pthread_barrier_wait(&sh->barrier);
+    }
+
+    // Every worker packs a share of each panel of B, then all of them compute on it
+    static void *gemm_worker_func(void *args)
+    {
+        struct gemm_thread_args *t_args = (struct gemm_thread_args *)args;
+        struct gemm_shared *sh = t_args->shared;
+        const struct gemm_params *p = sh->params;
+        int jc, nc, pc, kc;
+
+        for (int t = 0; t < sh->num_panel; t++)
+        {
+            panel_of(sh, t, &jc, &nc, &pc, &kc);
+            int num_sliver = (nc + GEMM_NR - 1) / GEMM_NR;
+            double start = now_ns();
+            pack_B_slivers(p, pc, kc, jc, nc, num_sliver * t_args->tid / sh->num_worker,
+                           num_sliver * (t_args->tid + 1) / sh->num_worker, sh->packed_B[0]);
+            barrier_wait(sh);
+            if (t_args->tid == 0)
+                sh->pack_ns += now_ns() - start;
+            compute_panel(t_args, sh->packed_B[0], jc, nc, pc, kc);
+            barrier_wait(sh);
+        }
+        return NULL;
+    }
+
+    // Pipelined worker: computes on panel t while the helper packs panel t + 1
+    static void *gemm_pipeline_worker_func(void *args)
+    {
+        struct gemm_thread_args *t_args = (struct gemm_thread_args *)args;
+        struct gemm_shared *sh = t_args->shared;
+        int jc, nc, pc, kc;
+
+        barrier_wait(sh);
+        for (int t = 0; t < sh->num_panel; t++)
+        {
+            panel_of(sh, t, &jc, &nc, &pc, &kc);
+            compute_panel(t_args, sh->packed_B[t & 1], jc, nc, pc, kc);
+            sh->arrive_ns[t & 1][t_args->tid] = now_ns();
+            barrier_wait(sh);
+        }
+        return NULL;
+    }
+
+    static void *gemm_pack_helper_func(void *args)
+    {
+        struct gemm_thread_args *t_args = (struct gemm_thread_args *)args;
+        struct gemm_shared *sh = t_args->shared;
+        const struct gemm_params *p = sh->params;
+        int jc, nc, pc, kc;
+
+        // Nothing to overlap the first panel with
+        double start = now_ns();
+        panel_of(sh, 0, &jc, &nc, &pc, &kc);
+        pack_B_slivers(p, pc, kc, jc, nc, 0, (nc + GEMM_NR - 1) / GEMM_NR, sh->packed_B[0]);
+        sh->pack_ns += now_ns() - start;
+        sh->exposed_ns += now_ns() - start;
+        barrier_wait(sh);
+
+        for (int t = 0; t < sh->num_panel; t++)
+        {
+            double packed = now_ns();
+            if (t + 1 < sh->num_panel)
+            {
+                start = now_ns();
+                panel_of(sh, t + 1, &jc, &nc, &pc, &kc);
+                pack_B_slivers(p, pc, kc, jc, nc, 0, (nc + GEMM_NR - 1) / GEMM_NR, sh->packed_B[(t + 1) & 1]);
+                packed = now_ns();
+                sh->pack_ns += packed - start;
+            }
+            barrier_wait(sh);
+
+            // Packing is exposed only when it finished after the slowest worker
+            double computed = 0;
+            for (int j = 0; j < sh->num_worker; j++)
+                if (sh->arrive_ns[t & 1][j] > computed)
+                    computed = sh->arrive_ns[t & 1][j];
+            if (packed > computed)
+                sh->exposed_ns += packed - computed;
+        }
+        return NULL;
+    }
+
+    // First sliver of worker j. Row i of a lower triangle costs i + 1, so lower-triangular shapes are split
+    // at equal areas, sqrt(j / num_thread) of the way down; upper ones mirror that.
+    static int split_slivers(const struct gemm_params *p, int num_sliver, int j, int num_thread)
+    {
+        double f = (double)j / num_thread;
+        if (p->triangle == GEMM_C_LOWER || p->triangle == GEMM_A_LOWER)
+            f = sqrt(f);
+        else if (p->triangle == GEMM_C_UPPER || p->triangle == GEMM_A_UPPER)
+            f = 1 - sqrt(1 - f);
+        return j == num_thread ? num_sliver : (int)(f * num_sliver + 0.5);
+    }
+
+    size_t packed_gemm_scratch_size(int M, int N, int num_thread, bool pipeline)
+    {
+        int num_sliver = (M + GEMM_MR - 1) / GEMM_MR;
+        if (num_thread > num_sliver)
+            num_thread = num_sliver;
+        int num_pack_B = pipeline ? 2 : 1;
+        size_t panel_size = (size_t)GEMM_KC * ((GEMM_NC < N ? GEMM_NC : N) + GEMM_NR);
+        size_t block_size = (size_t)GEMM_KC * (GEMM_MC + GEMM_MR);
+        return (num_pack_B * panel_size + num_thread * block_size) * sizeof(float) + (num_pack_B + 1) * ARENA_ALIGNMENT;
+    }
+
+    bool packed_gemm(const struct gemm_params *params)
+    {
+        int j, num_thread = params->num_thread;
+        assert(num_thread > 0);
+        assert(params->M >= 0 && params->N >= 0 && params->K >= 0);
+        assert((params->triangle != GEMM_C_LOWER && params->triangle != GEMM_C_UPPER) || params->M == params->N);
+        assert((params->triangle != GEMM_A_LOWER && params->triangle != GEMM_A_UPPER) || params->M == params->K);
+
+        if (params->stats)
+            memset(params->stats, 0, sizeof(struct gemm_stats));
+        if (params->M == 0 || params->N == 0)
+            return true;
+        if (params->K == 0)
+        {
+            float zero[GEMM_MR * GEMM_NR] = {};
+            for (int i = 0; i < params->M; i += GEMM_MR)
+                for (int jj = 0; jj < params->N; jj += GEMM_NR)
+                    store_tile(params, i, jj, params->M - i < GEMM_MR ? params->M - i : GEMM_MR,
+                               params->N - jj < GEMM_NR ? params->N - jj : GEMM_NR, zero, params->beta);
+            return true;
+        }
+        // Tiny dense products: a fixed-size register kernel beats packing and thread launch
+        const struct gemm_view *A = &params->A, *B = &params->B;
+        if (!A->pack && !B->pack && params->triangle == GEMM_FULL && params->alpha == 1.0f && params->beta == 0.0f &&
+            A->rs == params->K && A->cs == 1 && B->rs == params->N && B->cs == 1 && params->rs_c == params->N &&
+            params->cs_c == 1 && small_gemm_dispatch(params->M, params->N, params->K, A->data, B->data, params->C))
+            return true;
+
+        struct gemm_shared sh;
+        sh.params = params;
+        sh.num_pc = (params->K + GEMM_KC - 1) / GEMM_KC;
+        sh.num_panel = sh.num_pc * ((params->N + GEMM_NC - 1) / GEMM_NC);
+        sh.pack_ns = sh.exposed_ns = 0;
+
+        // Give each worker a whole number of MR-row slivers
+        int num_sliver = (params->M + GEMM_MR - 1) / GEMM_MR;
+        if (num_thread > num_sliver)
+            num_thread = num_sliver;
+        sh.num_worker = num_thread;
+
+        int num_pack_B = params->pipeline ? 2 : 1;
+        size_t panel_size = (size_t)GEMM_KC * ((GEMM_NC < params->N ? GEMM_NC : params->N) + GEMM_NR);
+        size_t block_size = (size_t)GEMM_KC * (GEMM_MC + GEMM_MR);
+        size_t scratch_size = packed_gemm_scratch_size(params->M, params->N, num_thread, params->pipeline);
+        if (!arena_reserve(&scratch.buffers, scratch_size, scratch_pages))
+        {
+            fprintf(stderr, "packed_gemm: cannot allocate %zu bytes of packing buffers\n", scratch_size);
+            return false;
+        }
+        for (j = 0; j < num_pack_B; j++)
+            sh.packed_B[j] = (float *)arena_alloc(&scratch.buffers, panel_size * sizeof(float));
+        float *packed_A = (float *)arena_alloc(&scratch.buffers, block_size * num_thread * sizeof(float));
+        double arrive_ns[2][num_thread];
+        sh.arrive_ns[0] = arrive_ns[0];
+        sh.arrive_ns[1] = arrive_ns[1];
+
+        int num_total = num_thread + (params->pipeline ? 1 : 0);
+        pthread_barrier_init(&sh.barrier, NULL, num_total);
+        pthread_t thread_pool[num_total];
+        struct gemm_thread_args threads_args[num_total];
+
+        // Thread creation; a single worker without helper runs on the calling thread
+        for (j = 0; j < num_thread; j++)
+        {
+            threads_args[j].shared = &sh;
+            threads_args[j].tid = j;
+            threads_args[j].start_i = split_slivers(params, num_sliver, j, num_thread) * GEMM_MR;
+            threads_args[j].end_i = split_slivers(params, num_sliver, j + 1, num_thread) * GEMM_MR;
+            if (threads_args[j].end_i > params->M)
+                threads_args[j].end_i = params->M;
+            threads_args[j].packed_A = &packed_A[block_size * j];
+            if (num_total == 1)
+            {
+                gemm_worker_func(&threads_args[j]);
+                break;
+            }
+            pthread_create(&thread_pool[j], NULL, params->pipeline ? gemm_pipeline_worker_func : gemm_worker_func, &threads_args[j]);
+        }
+        if (params->pipeline)
+        {
+            threads_args[num_thread].shared = &sh;
+            threads_args[num_thread].tid = num_thread;
+            pthread_create(&thread_pool[num_thread], NULL, gemm_pack_helper_func, &threads_args[num_thread]);
+        }
+        // Join threads
+        {
+            TRACE_SCOPE(TRACE_WAIT);
+            for (j = 0; j < num_total && num_total > 1; j++)
+            {
+                pthread_join(thread_pool[j], NULL);
+            }
+        }
+        pthread_barrier_destroy(&sh.barrier);
+
+        if (params->stats)
+        {
+            params->stats->panels = sh.num_panel;
+            params->stats->pack_ms = sh.pack_ns / 1e6;
+            // Without the helper thread all packing stalls the workers
+            params->stats->exposed_ms = (params->pipeline ? sh.exposed_ns : sh.pack_ns) / 1e6;
+        }
+        return true;
+    }
+
+    static bool mat_mul_packed_impl(const struct matmul_params *params, bool pipeline)
+    {
+        const struct matrix *A = &params->A, *B = &params->B, *C = &params->C;
+
+        struct gemm_params gemm = {};
+        gemm.M = C->row;
+        gemm.N = C->column;
+        gemm.K = A->column;
+        gemm.alpha = 1.0f;
+        gemm.beta = 0.0f;
+        gemm.A = gemm_view_of(A);
+        gemm.B = gemm_view_of(B);
+        gemm.C = C->data_ptr;
+        gemm.rs_c = C->column;
+        gemm.cs_c = 1;
+        gemm.num_thread = params->opt_params.num_thread;
+        gemm.pipeline = pipeline;
+        gemm.stats = params->opt_params.stats;
+        return packed_gemm(&gemm);
+    }
+
+    // The operators cannot report a failure, so without packing buffers they fall back to the
+    // loops that need none; packed_gemm has already said why on stderr
+    void MatmulOperator::mat_mul_packed(const struct matmul_params *params)
+    {
+        CHECK_MATRICES(&params->A, &params->B, &params->C);
+        if (!mat_mul_packed_impl(params, false))
+            naive_mat_mul(params);
+    }
+
+    void MatmulOperator::mat_mul_pipelined(const struct matmul_params *params)
+    {
+        CHECK_MATRICES(&params->A, &params->B, &params->C);
+        if (!mat_mul_packed_impl(params, true))
+            naive_mat_mul(params);
+    }
+}
@@ -0,0 +1,77 @@
+#include "small_gemm.h"
+
+namespace matmul
+{
+    typedef void (*small_gemm_func)(int M, const float *A, const float *B, float *C);
+
+    // One row of C for N that is not a multiple of the SIMD width. Only the loop over N is unrolled (and
+    // vectorized by the compiler): unrolling K as well multiplies the build time of the table.
+    template <int N, int K>
+    static inline void small_gemm_row_scalar(const float *A, const float *B, float *C)
+    {
+        float acc[N] = {};
+        for (int k = 0; k < K; k++)
+#pragma GCC unroll 32
+            for (int j = 0; j < N; j++)
+                acc[j] += A[k] * B[k * N + j];
+#pragma GCC unroll 32
+        for (int j = 0; j < N; j++)
+            C[j] = acc[j];
+    }
+
+    // small_gemm with N and K fixed and M given at run time: blocks of rows, then single rows. One
+    // instance per N, K keeps the table quadratic rather than cubic in the number of sizes.
+    template <int N, int K>
+    static void small_gemm_m(int M, const float *A, const float *B, float *C)
+    {
+        int i = 0;
+#if defined(__AVX__) || defined(__SSE__) || defined(__ARM_NEON)
+        if constexpr (N % small_vec::width == 0)
+        {
+            const int NV = N / small_vec::width;
+            const int R = NV >= 12 ? 1 : 12 / NV;
+            for (; i + R <= M; i += R)
+                small_gemm_rows<R, N, K, small_vec>(&A[i * K], B, &C[i * N]);
+            for (; i < M; i++)
+                small_gemm_rows<1, N, K, small_vec>(&A[i * K], B, &C[i * N]);
+            return;
+        }
+#endif
+        for (; i < M; i++)
+            small_gemm_row_scalar<N, K>(&A[i * K], B, &C[i * N]);
+    }
+
+#define SMALL_GEMM_ROW(N)                                                                                         \
+    {small_gemm_m<N, 4>,  small_gemm_m<N, 6>,  small_gemm_m<N, 8>,  small_gemm_m<N, 10>, small_gemm_m<N, 12>,    \
+     small_gemm_m<N, 14>, small_gemm_m<N, 16>, small_gemm_m<N, 18>, small_gemm_m<N, 20>, small_gemm_m<N, 22>,    \
+     small_gemm_m<N, 24>, small_gemm_m<N, 26>, small_gemm_m<N, 28>, small_gemm_m<N, 30>, small_gemm_m<N, 32>}
+
+#define SMALL_GEMM_SIZES ((SMALL_GEMM_MAX - SMALL_GEMM_MIN) / 2 + 1)
+
+    // Indexed by (N - 4) / 2 and (K - 4) / 2
+    static const small_gemm_func small_gemm_table[SMALL_GEMM_SIZES][SMALL_GEMM_SIZES] = {
+        SMALL_GEMM_ROW(4),  SMALL_GEMM_ROW(6),  SMALL_GEMM_ROW(8),  SMALL_GEMM_ROW(10), SMALL_GEMM_ROW(12),
+        SMALL_GEMM_ROW(14), SMALL_GEMM_ROW(16), SMALL_GEMM_ROW(18), SMALL_GEMM_ROW(20), SMALL_GEMM_ROW(22),
+        SMALL_GEMM_ROW(24), SMALL_GEMM_ROW(26), SMALL_GEMM_ROW(28), SMALL_GEMM_ROW(30), SMALL_GEMM_ROW(32)};
+
+    // (n - 4) / 2 for the even sizes in [SMALL_GEMM_MIN, SMALL_GEMM_MAX], -1 otherwise
+    static inline int size_index(int n)
+    {
+        if (n < SMALL_GEMM_MIN || n > SMALL_GEMM_MAX || n % 2 != 0)
+            return -1;
+        return (n - SMALL_GEMM_MIN) / 2;
+    }
+
+    bool small_gemm_routable(int M, int N, int K)
+    {
+        return M >= SMALL_GEMM_MIN && M <= SMALL_GEMM_MAX && size_index(N) >= 0 && size_index(K) >= 0;
+    }
+
+    bool small_gemm_dispatch(int M, int N, int K, const float *A, const float *B, float *C)
+    {
+        if (!small_gemm_routable(M, N, K))
+            return false;
+        small_gemm_table[size_index(N)][size_index(K)](M, A, B, C);
+        return true;
+    }
+}
@@ -0,0 +1,165 @@
+#include "trace.h"
+#include <stdio.h>
+
+#ifdef MATMUL_TRACE
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+namespace matmul
+{
+    struct trace_event
+    {
+        uint64_t begin, end;
+        enum trace_phase phase;
+    };
+
+    struct trace_lane
+    {
+        uint64_t count; // events ever recorded; the last TRACE_RING_SIZE are kept
+        bool in_use;
+        struct trace_event events[TRACE_RING_SIZE];
+    };
+
+    static struct trace_lane *lanes[TRACE_MAX_LANES];
+    static int num_lanes;
+    static long dropped;
+    static pthread_mutex_t lanes_lock = PTHREAD_MUTEX_INITIALIZER;
+    // Clock reading at trace_reset, for the tick rate and the origin of the timeline
+    static uint64_t start_ticks;
+    static double start_ns;
+
+    // The calling thread's lane, returned for reuse when the thread exits
+    struct trace_thread
+    {
+        struct trace_lane *lane = NULL;
+        bool no_lane = false;
+        ~trace_thread()
+        {
+            if (!lane)
+                return;
+            pthread_mutex_lock(&lanes_lock);
+            lane->in_use = false;
+            pthread_mutex_unlock(&lanes_lock);
+        }
+    };
+    static thread_local struct trace_thread local;
+
+    static const char *phase_names[] = {"pack", "kernel", "reduce", "wait"};
+
+    static inline double now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1e9 + ts.tv_nsec;
+    }
+
+    static struct trace_lane *acquire_lane()
+    {
+        struct trace_lane *lane = NULL;
+        pthread_mutex_lock(&lanes_lock);
+        if (start_ns == 0)
+        {
+            start_ticks = trace_clock();
+            start_ns = now_ns();
+        }
+        for (int j = 0; j < num_lanes && !lane; j++)
+            if (!lanes[j]->in_use)
+                lane = lanes[j];
+        if (!lane && num_lanes < TRACE_MAX_LANES)
+        {
+            lane = (struct trace_lane *)calloc(1, sizeof(struct trace_lane));
+            if (lane)
+                lanes[num_lanes++] = lane;
+        }
+        if (lane)
+            lane->in_use = true;
+        pthread_mutex_unlock(&lanes_lock);
+        return lane;
+    }
+
+    void trace_record(enum trace_phase phase, uint64_t begin, uint64_t end)
+    {
+        struct trace_thread *t = &local;
+        if (!t->lane)
+        {
+            if (t->no_lane || !(t->lane = acquire_lane()))
+            {
+                t->no_lane = true;
+                __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+                return;
+            }
+        }
+        struct trace_event *e = &t->lane->events[t->lane->count++ & (TRACE_RING_SIZE - 1)];
+        e->begin = begin;
+        e->end = end;
+        e->phase = phase;
+    }
+
+    void trace_reset()
+    {
+        pthread_mutex_lock(&lanes_lock);
+        for (int j = 0; j < num_lanes; j++)
+            lanes[j]->count = 0;
+        dropped = 0;
+        start_ticks = trace_clock();
+        start_ns = now_ns();
+        pthread_mutex_unlock(&lanes_lock);
+    }
+
+    bool trace_dump(const char *path)
+    {
+        FILE *f = fopen(path, "w");
+        if (!f)
+        {
+            printf("trace: cannot open %s\n", path);
+            return false;
+        }
+        // Ticks per microsecond over at least 10 ms since the reset
+        while (now_ns() - start_ns < 1e7)
+        {
+            struct timespec ts = {0, 1000000};
+            nanosleep(&ts, NULL);
+        }
+        pthread_mutex_lock(&lanes_lock);
+        double ticks_per_us = (trace_clock() - start_ticks) / ((now_ns() - start_ns) / 1e3);
+        long events = 0, overwritten = 0;
+        fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+        for (int j = 0; j < num_lanes; j++)
+        {
+            fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, \"args\": {\"name\": \"lane %d\"}}",
+                    j, j);
+            const struct trace_lane *lane = lanes[j];
+            uint64_t first = lane->count > TRACE_RING_SIZE ? lane->count - TRACE_RING_SIZE : 0;
+            overwritten += first;
+            for (uint64_t i = first; i < lane->count; i++, events++)
+            {
+                const struct trace_event *e = &lane->events[i & (TRACE_RING_SIZE - 1)];
+                fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                        phase_names[e->phase], j, (int64_t)(e->begin - start_ticks) / ticks_per_us,
+                        (e->end - e->begin) / ticks_per_us);
+            }
+            fprintf(f, j + 1 < num_lanes ? ",\n" : "\n");
+        }
+        fprintf(f, "]}\n");
+        pthread_mutex_unlock(&lanes_lock);
+        bool ok = fclose(f) == 0;
+        printf("trace: %ld events on %d lanes written to %s (%ld overwritten, %ld without a lane)\n", events, num_lanes,
+               path, overwritten, dropped);
+        return ok;
+    }
+}
+#else
+namespace matmul
+{
+    void trace_reset()
+    {
+    }
+
+    bool trace_dump(const char *path)
+    {
+        printf("trace: not compiled in, rebuild with make TRACE=1 to write %s\n", path);
+        return false;
+    }
+}
+#endif
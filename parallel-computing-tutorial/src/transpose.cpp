@@ -0,0 +1,314 @@
+#include "transpose.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#ifdef __SSE__
+#include <immintrin.h> // intel SSE/AVX intrinsic
+#endif
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+// Cache block: a 64x64 fp32 tile of src and dst fits in L1 and touches at most 64 pages
+#define TRANSPOSE_BLK 64
+// Outputs larger than this are written with non-temporal stores, bypassing the cache
+#define NT_STORE_THRESHOLD (8 * 1024 * 1024)
+
+namespace matmul
+{
+    // Register kernels: transpose a KERNEL_SIZE x KERNEL_SIZE tile held entirely in vector registers
+#if defined(__AVX512F__)
+    #define KERNEL_SIZE 16
+    #define VEC_BYTES 64
+    static inline void kernel_transpose(const float *src, int ld_src, float *dst, int ld_dst)
+    {
+        __m512 r[16], t[16];
+        for (int i = 0; i < 16; i++)
+            r[i] = _mm512_loadu_ps(&src[(size_t)i * ld_src]);
+        for (int i = 0; i < 8; i++)
+        {
+            t[2 * i] = _mm512_unpacklo_ps(r[2 * i], r[2 * i + 1]);
+            t[2 * i + 1] = _mm512_unpackhi_ps(r[2 * i], r[2 * i + 1]);
+        }
+        // r[4i + c] now holds column (4L + c) of rows 4i..4i+3 in 128-bit lane L
+        for (int i = 0; i < 4; i++)
+        {
+            r[4 * i] = _mm512_shuffle_ps(t[4 * i], t[4 * i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            r[4 * i + 1] = _mm512_shuffle_ps(t[4 * i], t[4 * i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            r[4 * i + 2] = _mm512_shuffle_ps(t[4 * i + 1], t[4 * i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            r[4 * i + 3] = _mm512_shuffle_ps(t[4 * i + 1], t[4 * i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            t[c] = _mm512_shuffle_f32x4(r[c], r[4 + c], 0x88);
+            t[c + 4] = _mm512_shuffle_f32x4(r[c], r[4 + c], 0xdd);
+            t[c + 8] = _mm512_shuffle_f32x4(r[8 + c], r[12 + c], 0x88);
+            t[c + 12] = _mm512_shuffle_f32x4(r[8 + c], r[12 + c], 0xdd);
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            r[c] = _mm512_shuffle_f32x4(t[c], t[c + 8], 0x88);
+            r[8 + c] = _mm512_shuffle_f32x4(t[c], t[c + 8], 0xdd);
+            r[4 + c] = _mm512_shuffle_f32x4(t[c + 4], t[c + 12], 0x88);
+            r[12 + c] = _mm512_shuffle_f32x4(t[c + 4], t[c + 12], 0xdd);
+        }
+        for (int i = 0; i < 16; i++)
+            _mm512_storeu_ps(&dst[(size_t)i * ld_dst], r[i]);
+    }
+#elif defined(__AVX__)
+    #define KERNEL_SIZE 8
+    #define VEC_BYTES 32
+    static inline void kernel_transpose(const float *src, int ld_src, float *dst, int ld_dst)
+    {
+        __m256 r[8], t[8];
+        for (int i = 0; i < 8; i++)
+            r[i] = _mm256_loadu_ps(&src[(size_t)i * ld_src]);
+        for (int i = 0; i < 4; i++)
+        {
+            t[2 * i] = _mm256_unpacklo_ps(r[2 * i], r[2 * i + 1]);
+            t[2 * i + 1] = _mm256_unpackhi_ps(r[2 * i], r[2 * i + 1]);
+        }
+        for (int i = 0; i < 2; i++)
+        {
+            r[4 * i] = _mm256_shuffle_ps(t[4 * i], t[4 * i + 2], _MM_SHUFFLE(1, 0, 1, 0));
+            r[4 * i + 1] = _mm256_shuffle_ps(t[4 * i], t[4 * i + 2], _MM_SHUFFLE(3, 2, 3, 2));
+            r[4 * i + 2] = _mm256_shuffle_ps(t[4 * i + 1], t[4 * i + 3], _MM_SHUFFLE(1, 0, 1, 0));
+            r[4 * i + 3] = _mm256_shuffle_ps(t[4 * i + 1], t[4 * i + 3], _MM_SHUFFLE(3, 2, 3, 2));
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            t[c] = _mm256_permute2f128_ps(r[c], r[4 + c], 0x20);
+            t[4 + c] = _mm256_permute2f128_ps(r[c], r[4 + c], 0x31);
+        }
+        for (int i = 0; i < 8; i++)
+            _mm256_storeu_ps(&dst[(size_t)i * ld_dst], t[i]);
+    }
+#elif defined(__SSE__)
+    #define KERNEL_SIZE 4
+    #define VEC_BYTES 16
+    static inline void kernel_transpose(const float *src, int ld_src, float *dst, int ld_dst)
+    {
+        __m128 r0 = _mm_loadu_ps(&src[0]);
+        __m128 r1 = _mm_loadu_ps(&src[(size_t)ld_src]);
+        __m128 r2 = _mm_loadu_ps(&src[(size_t)2 * ld_src]);
+        __m128 r3 = _mm_loadu_ps(&src[(size_t)3 * ld_src]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _mm_storeu_ps(&dst[0], r0);
+        _mm_storeu_ps(&dst[(size_t)ld_dst], r1);
+        _mm_storeu_ps(&dst[(size_t)2 * ld_dst], r2);
+        _mm_storeu_ps(&dst[(size_t)3 * ld_dst], r3);
+    }
+#elif defined(__ARM_NEON)
+    #define KERNEL_SIZE 4
+    #define VEC_BYTES 0 // no non-temporal stores
+    static inline void kernel_transpose(const float *src, int ld_src, float *dst, int ld_dst)
+    {
+        float32x4x2_t t01 = vtrnq_f32(vld1q_f32(&src[0]), vld1q_f32(&src[(size_t)ld_src]));
+        float32x4x2_t t23 = vtrnq_f32(vld1q_f32(&src[(size_t)2 * ld_src]), vld1q_f32(&src[(size_t)3 * ld_src]));
+        vst1q_f32(&dst[0], vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0])));
+        vst1q_f32(&dst[(size_t)ld_dst], vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1])));
+        vst1q_f32(&dst[(size_t)2 * ld_dst], vcombine_f32(vget_high_f32(t01.val[0]), vget_high_f32(t23.val[0])));
+        vst1q_f32(&dst[(size_t)3 * ld_dst], vcombine_f32(vget_high_f32(t01.val[1]), vget_high_f32(t23.val[1])));
+    }
+#else
+    #define KERNEL_SIZE 4
+    #define VEC_BYTES 0
+    static inline void kernel_transpose(const float *src, int ld_src, float *dst, int ld_dst)
+    {
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                dst[(size_t)j * ld_dst + i] = src[(size_t)i * ld_src + j];
+    }
+#endif
+
+    // Transpose one cache block (rows, cols <= TRANSPOSE_BLK); ragged edges fall back to scalar copies
+    static void transpose_block(const float *src, int ld_src, float *dst, int ld_dst, int rows, int cols)
+    {
+        int i, j;
+        int rows_k = rows - rows % KERNEL_SIZE, cols_k = cols - cols % KERNEL_SIZE;
+
+        for (i = 0; i < rows_k; i += KERNEL_SIZE)
+            for (j = 0; j < cols_k; j += KERNEL_SIZE)
+                kernel_transpose(&src[(size_t)i * ld_src + j], ld_src, &dst[(size_t)j * ld_dst + i], ld_dst);
+
+        for (i = 0; i < rows; i++)
+            for (j = (i < rows_k) ? cols_k : 0; j < cols; j++)
+                dst[(size_t)j * ld_dst + i] = src[(size_t)i * ld_src + j];
+    }
+
+    // Copy one row of a transposed tile out with non-temporal stores; dst must be VEC_BYTES aligned.
+    // Staging the tile in L1 first lets every streaming store fill whole cache lines.
+    static inline void stream_row(float *dst, const float *src, int n)
+    {
+        int i = 0;
+#if defined(__AVX512F__)
+        for (; i + 16 <= n; i += 16)
+            _mm512_stream_ps(&dst[i], _mm512_load_ps(&src[i]));
+#elif defined(__AVX__)
+        for (; i + 8 <= n; i += 8)
+            _mm256_stream_ps(&dst[i], _mm256_load_ps(&src[i]));
+#elif defined(__SSE__)
+        for (; i + 4 <= n; i += 4)
+            _mm_stream_ps(&dst[i], _mm_load_ps(&src[i]));
+#endif
+        for (; i < n; i++)
+            dst[i] = src[i];
+    }
+
+    struct transpose_args
+    {
+        const float *src;
+        float *dst;
+        int ld_src, ld_dst, rows, cols;
+        int start_i, end_i;
+        bool nt;
+    };
+
+    static void *transpose_thread_func(void *args)
+    {
+        struct transpose_args *t_args = (struct transpose_args *)args;
+        alignas(64) float tile[TRANSPOSE_BLK * TRANSPOSE_BLK];
+
+        for (int bi = t_args->start_i; bi < t_args->end_i; bi += TRANSPOSE_BLK)
+        {
+            int rows = t_args->end_i - bi < TRANSPOSE_BLK ? t_args->end_i - bi : TRANSPOSE_BLK;
+            for (int bj = 0; bj < t_args->cols; bj += TRANSPOSE_BLK)
+            {
+                int cols = t_args->cols - bj < TRANSPOSE_BLK ? t_args->cols - bj : TRANSPOSE_BLK;
+                const float *src = &t_args->src[(size_t)bi * t_args->ld_src + bj];
+                float *dst = &t_args->dst[(size_t)bj * t_args->ld_dst + bi];
+                if (!t_args->nt)
+                {
+                    transpose_block(src, t_args->ld_src, dst, t_args->ld_dst, rows, cols);
+                    continue;
+                }
+                transpose_block(src, t_args->ld_src, tile, TRANSPOSE_BLK, rows, cols);
+                for (int j = 0; j < cols; j++)
+                    stream_row(&dst[(size_t)j * t_args->ld_dst], &tile[j * TRANSPOSE_BLK], rows);
+            }
+        }
+#ifdef __SSE__
+        if (t_args->nt)
+            _mm_sfence();
+#endif
+        return NULL;
+    }
+
+    void transpose(const float *src, int ld_src, float *dst, int ld_dst, int rows, int cols, int num_thread)
+    {
+        int j;
+        assert(ld_src >= cols && ld_dst >= rows);
+        assert(num_thread > 0);
+
+        // Streaming stores need every vector store to be aligned
+        bool nt = VEC_BYTES > 0 && (size_t)rows * cols * sizeof(float) >= NT_STORE_THRESHOLD;
+        if (nt)
+            nt = (uintptr_t)dst % VEC_BYTES == 0 && ((size_t)ld_dst * sizeof(float)) % VEC_BYTES == 0;
+
+        // Split the rows of src into whole cache blocks per thread
+        int num_blk = (rows + TRANSPOSE_BLK - 1) / TRANSPOSE_BLK;
+        if (num_thread > num_blk)
+            num_thread = num_blk > 0 ? num_blk : 1;
+
+        pthread_t thread_pool[num_thread];
+        struct transpose_args threads_args[num_thread];
+
+        for (j = 0; j < num_thread; j++)
+        {
+            threads_args[j].src = src;
+            threads_args[j].dst = dst;
+            threads_args[j].ld_src = ld_src;
+            threads_args[j].ld_dst = ld_dst;
+            threads_args[j].rows = rows;
+            threads_args[j].cols = cols;
+            threads_args[j].start_i = (num_blk * j / num_thread) * TRANSPOSE_BLK;
+            threads_args[j].end_i = (num_blk * (j + 1) / num_thread) * TRANSPOSE_BLK;
+            if (threads_args[j].end_i > rows)
+                threads_args[j].end_i = rows;
+            threads_args[j].nt = nt;
+        }
+
+        if (num_thread == 1)
+        {
+            transpose_thread_func(&threads_args[0]);
+            return;
+        }
+        for (j = 0; j < num_thread; j++)
+            pthread_create(&thread_pool[j], NULL, transpose_thread_func, &threads_args[j]);
+        for (j = 0; j < num_thread; j++)
+            pthread_join(thread_pool[j], NULL);
+    }
+
+    void transpose(const float *src, float *dst, int rows, int cols, int num_thread)
+    {
+        transpose(src, cols, dst, rows, rows, cols, num_thread);
+    }
+
+    static void transpose_inplace_square(float *data, int n)
+    {
+        float tile_a[TRANSPOSE_BLK * TRANSPOSE_BLK], tile_b[TRANSPOSE_BLK * TRANSPOSE_BLK];
+
+        for (int bi = 0; bi < n; bi += TRANSPOSE_BLK)
+        {
+            int rows = n - bi < TRANSPOSE_BLK ? n - bi : TRANSPOSE_BLK;
+            for (int bj = bi; bj < n; bj += TRANSPOSE_BLK)
+            {
+                int cols = n - bj < TRANSPOSE_BLK ? n - bj : TRANSPOSE_BLK;
+                float *blk_ij = &data[(size_t)bi * n + bj], *blk_ji = &data[(size_t)bj * n + bi];
+
+                // Swap the tile pair (bi, bj) <-> (bj, bi) through two L1-resident buffers
+                transpose_block(blk_ij, n, tile_a, rows, rows, cols);
+                if (bi != bj)
+                {
+                    transpose_block(blk_ji, n, tile_b, cols, cols, rows);
+                    for (int i = 0; i < rows; i++)
+                        memcpy(&blk_ij[(size_t)i * n], &tile_b[i * cols], cols * sizeof(float));
+                }
+                for (int j = 0; j < cols; j++)
+                    memcpy(&blk_ji[(size_t)j * n], &tile_a[j * rows], rows * sizeof(float));
+            }
+        }
+    }
+
+    bool transpose_inplace(float *data, int rows, int cols)
+    {
+        if (rows == cols)
+        {
+            transpose_inplace_square(data, rows);
+            return true;
+        }
+        if (rows <= 1 || cols <= 1)
+            return true;
+
+        // Element k moves to k * rows mod (n - 1); the first and last elements stay put.
+        // One bit per element marks positions already placed by an earlier cycle.
+        size_t n = (size_t)rows * cols, mod = n - 1;
+        uint64_t *visited = (uint64_t *)calloc((n + 63) / 64, sizeof(uint64_t));
+        if (visited == NULL)
+        {
+            fprintf(stderr, "transpose_inplace: cannot allocate the %zu-byte visited bitmap\n", (n + 63) / 64 * sizeof(uint64_t));
+            return false;
+        }
+
+        for (size_t start = 1; start < mod; start++)
+        {
+            if (visited[start / 64] & (1ULL << (start % 64)))
+                continue;
+            float carry = data[start];
+            size_t next = start;
+            do
+            {
+                next = (next * rows) % mod;
+                float tmp = data[next];
+                data[next] = carry;
+                carry = tmp;
+                visited[next / 64] |= 1ULL << (next % 64);
+            } while (next != start);
+        }
+        free(visited);
+        return true;
+    }
+}